@@ -1,6 +1,14 @@
 #version 330 
 
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params; // Tiles per pixel, then log depth to slice
+};
 uniform sampler2D texture_id; 
+#include "point_lighting.glsl"
 in vec3 var_view_pos; 
 in vec2 var_uv; 
 in vec3 var_normal; 
@@ -15,5 +23,7 @@ vec4 ApplyFog(vec4 color) {
 void main() { 
     outputColor = texture(texture_id, var_uv); 
     //outputColor.xyz = var_normal * 0.5 + vec3(0.5); 
+    vec3 view_normal = normalize(mat3(view_mat) * var_normal);
+    outputColor.xyz *= vec3(1.0) + GetPointLighting(var_view_pos, view_normal);
     outputColor = ApplyFog(outputColor);
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #version 330 
 
-uniform mat4 mv_mat; 
-uniform mat4 proj_mat; 
-uniform mat3 norm_mat; 
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params;
+};
+uniform samplerBuffer instance_data; // One model matrix per instance
+uniform int instance_base; // Texel offset of this batch's first instance
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 uv; 
 layout(location = 2) in vec3 normal; 
@@ -11,9 +17,15 @@ out vec3 var_normal;
 out vec3 var_view_pos; 
 
 void main() { 
-	gl_Position = proj_mat * mv_mat * vec4(position, 1.0);
-	var_view_pos = vec3(mv_mat * vec4(position, 1.0));
+	int texel = instance_base + gl_InstanceID * 4;
+	mat4 model_mat = mat4(texelFetch(instance_data, texel),
+	                      texelFetch(instance_data, texel+1),
+	                      texelFetch(instance_data, texel+2),
+	                      texelFetch(instance_data, texel+3));
+	vec4 world_pos = model_mat * vec4(position, 1.0);
+	gl_Position = proj_view_mat * world_pos;
+	var_view_pos = vec3(view_mat * world_pos);
 	var_uv = uv;
 	var_uv.y *= -1.0;
-	var_normal = normal;
+	var_normal = mat3(model_mat) * normal;
 }
\ No newline at end of file
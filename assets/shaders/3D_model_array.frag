@@ -0,0 +1,29 @@
+#version 330 
+
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params; // Tiles per pixel, then log depth to slice
+};
+uniform sampler2DArray texture_id; 
+#include "point_lighting.glsl"
+in vec3 var_view_pos; 
+in vec2 var_uv; 
+in vec3 var_normal; 
+flat in float var_layer;
+out vec4 outputColor;
+
+vec4 ApplyFog(vec4 color) {
+    vec3 fog_color = vec3(0.5,0.5,0.5);
+	float depth = length(var_view_pos);
+	return vec4(mix(color.xyz, fog_color, max(0.0, min(1.0, (depth - 10.0) * 0.1))), color.a);
+}
+
+void main() { 
+    outputColor = texture(texture_id, vec3(var_uv, var_layer)); 
+    vec3 view_normal = normalize(mat3(view_mat) * var_normal);
+    outputColor.xyz *= vec3(1.0) + GetPointLighting(var_view_pos, view_normal);
+    outputColor = ApplyFog(outputColor);
+}
@@ -0,0 +1,37 @@
+#version 330 
+
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params;
+};
+uniform samplerBuffer instance_data; // One model matrix per instance, w of column 3 is the layer
+uniform int instance_base; // Texel offset of this batch's first instance
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec2 uv; 
+layout(location = 2) in vec3 normal; 
+// Only merged tile chunks have this, for everything else the attribute is
+// off and reads as 0 so the layer comes from the instance alone
+layout(location = 3) in float layer; 
+out vec2 var_uv; 
+out vec3 var_normal; 
+out vec3 var_view_pos; 
+flat out float var_layer;
+
+void main() { 
+	int texel = instance_base + gl_InstanceID * 4;
+	vec4 column_3 = texelFetch(instance_data, texel+3);
+	var_layer = column_3.w + layer;
+	mat4 model_mat = mat4(texelFetch(instance_data, texel),
+	                      texelFetch(instance_data, texel+1),
+	                      texelFetch(instance_data, texel+2),
+	                      vec4(column_3.xyz, 1.0));
+	vec4 world_pos = model_mat * vec4(position, 1.0);
+	gl_Position = proj_view_mat * world_pos;
+	var_view_pos = vec3(view_mat * world_pos);
+	var_uv = uv;
+	var_uv.y *= -1.0;
+	var_normal = mat3(model_mat) * normal;
+}
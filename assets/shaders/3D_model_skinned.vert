@@ -1,9 +1,15 @@
 #version 330 
 
-uniform mat4 mv_mat; 
-uniform mat4 proj_mat; 
-uniform mat4 bone_matrices[128];
-uniform mat3 norm_mat; 
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params;
+};
+uniform samplerBuffer instance_data; // Pose palettes and instance records
+uniform int instance_base; // Texel offset of this batch's first instance record
+uniform bool dual_quaternion_skinning; // Palette is 2 texels per bone instead of 4
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 uv; 
 layout(location = 2) in vec3 normal; 
@@ -13,17 +19,64 @@ out vec2 var_uv;
 out vec3 var_normal; 
 out vec3 var_view_pos; 
 
-void main() { 
+mat4 FetchMat4(int texel) {
+	return mat4(texelFetch(instance_data, texel),
+	            texelFetch(instance_data, texel+1),
+	            texelFetch(instance_data, texel+2),
+	            texelFetch(instance_data, texel+3));
+}
+
+void SkinMatrix(int palette_base, out vec3 skinned_pos, out vec3 skinned_normal) {
 	mat4 skinned_mat = mat4(0.0);
 	for(int i=0; i<4; ++i){
 		int index = int(indices[i]+0.5);
 		if(indices[i] != -1.0){
-			skinned_mat += bone_matrices[index] * weights[i];
+			skinned_mat += FetchMat4(palette_base + index * 4) * weights[i];
 		}
 	}
-	gl_Position = proj_mat * mv_mat * skinned_mat * vec4(position, 1.0);
+	skinned_pos = vec3(skinned_mat * vec4(position, 1.0));
+	skinned_normal = mat3(skinned_mat) * normal;
+}
+
+void SkinDualQuaternion(int palette_base, out vec3 skinned_pos, out vec3 skinned_normal) {
+	vec4 real = vec4(0.0);
+	vec4 dual = vec4(0.0);
+	vec4 first_real = texelFetch(instance_data, palette_base + int(indices[0]+0.5) * 2);
+	for(int i=0; i<4; ++i){
+		int index = int(indices[i]+0.5);
+		if(indices[i] != -1.0){
+			vec4 bone_real = texelFetch(instance_data, palette_base + index * 2);
+			vec4 bone_dual = texelFetch(instance_data, palette_base + index * 2 + 1);
+			// Keep all rotations in the same hemisphere as the first
+			float weight = weights[i] * sign(dot(bone_real, first_real) + 0.00001);
+			real += bone_real * weight;
+			dual += bone_dual * weight;
+		}
+	}
+	float len = length(real);
+	real /= len;
+	dual /= len;
+	skinned_pos = position + 2.0 * cross(real.xyz, cross(real.xyz, position) + real.w * position);
+	skinned_pos += 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+	skinned_normal = normal + 2.0 * cross(real.xyz, cross(real.xyz, normal) + real.w * normal);
+}
+
+void main() { 
+	// Instance record is the model matrix with the palette offset in [3].w
+	mat4 model_mat = FetchMat4(instance_base + gl_InstanceID * 4);
+	int palette_base = int(model_mat[3].w + 0.5);
+	model_mat[3].w = 1.0;
+	vec3 skinned_pos;
+	vec3 skinned_normal;
+	if(dual_quaternion_skinning){
+		SkinDualQuaternion(palette_base, skinned_pos, skinned_normal);
+	} else {
+		SkinMatrix(palette_base, skinned_pos, skinned_normal);
+	}
+	vec4 world_pos = model_mat * vec4(skinned_pos, 1.0);
+	gl_Position = proj_view_mat * world_pos;
 	var_uv = uv;
 	var_uv.y *= -1.0;
-	var_normal = normalize(mat3(skinned_mat) * normal);
-	var_view_pos = vec3(mv_mat * skinned_mat * vec4(position, 1.0));
+	var_normal = normalize(mat3(model_mat) * skinned_normal);
+	var_view_pos = vec3(view_mat * world_pos);
 }
\ No newline at end of file
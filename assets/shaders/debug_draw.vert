@@ -1,11 +1,17 @@
 #version 330 
 
-uniform mat4 mv_mat; 
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params;
+};
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec4 color;
 out vec4 var_color;
 
 void main() { 
-	gl_Position = mv_mat * vec4(position, 1.0);
+	gl_Position = proj_view_mat * vec4(position, 1.0);
 	var_color = color;
 }
\ No newline at end of file
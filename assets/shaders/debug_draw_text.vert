@@ -1,11 +1,17 @@
 #version 330 
 
-uniform mat4 proj_mat; 
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params;
+};
 layout(location = 0) in vec2 position;
 layout(location = 1) in vec2 uv;
 out vec2 var_uv;
 
 void main() { 
-	gl_Position = proj_mat * vec4(position, 0.0, 1.0);
+	gl_Position = screen_ortho_mat * vec4(position, 0.0, 1.0);
 	var_uv = uv;
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #version 330 
 
-uniform mat4 mv_mat; 
+layout(std140) uniform PerFrame {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 proj_view_mat;
+	mat4 screen_ortho_mat;
+	vec4 light_cluster_params;
+};
 layout(location = 0) in vec3 position;
 
 void main() { 
-	gl_Position = mv_mat * vec4(position + vec3(0.0, 0.1, 0.0), 1.0);
+	gl_Position = proj_view_mat * vec4(position + vec3(0.0, 0.1, 0.0), 1.0);
 }
\ No newline at end of file
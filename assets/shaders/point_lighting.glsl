@@ -0,0 +1,33 @@
+// Clustered point lighting, see LightGrid. Included by the model fragment
+// shaders after the PerFrame block; the loader defines the LIGHT_GRID_*
+// sizes from LightGrid so they can't drift.
+uniform samplerBuffer lights; // View space position and radius, then color
+uniform samplerBuffer light_clusters; // First index and count
+uniform samplerBuffer light_indices; // Four to a texel
+const int kClusterTilesX = LIGHT_GRID_TILES_X;
+const int kClusterTilesY = LIGHT_GRID_TILES_Y;
+const int kClusterSlices = LIGHT_GRID_SLICES;
+
+// Sum of the lights binned into this fragment's cluster
+vec3 GetPointLighting(vec3 view_pos, vec3 view_normal) {
+	ivec2 tile = ivec2(gl_FragCoord.xy * light_cluster_params.xy);
+	tile = clamp(tile, ivec2(0), ivec2(kClusterTilesX-1, kClusterTilesY-1));
+	int slice = int(floor(log(-view_pos.z) * light_cluster_params.z + light_cluster_params.w));
+	slice = clamp(slice, 0, kClusterSlices-1);
+	vec4 cluster = texelFetch(light_clusters, (slice * kClusterTilesY + tile.y) * kClusterTilesX + tile.x);
+	int first = int(cluster.x + 0.5);
+	int count = int(cluster.y + 0.5);
+	vec3 total = vec3(0.0);
+	for(int i=0; i<count; ++i){
+		int index = first + i;
+		int light = int(texelFetch(light_indices, index / 4)[index % 4] + 0.5);
+		vec4 pos_radius = texelFetch(lights, light * 2);
+		vec3 color = texelFetch(lights, light * 2 + 1).xyz;
+		vec3 to_light = pos_radius.xyz - view_pos;
+		float dist_sq = dot(to_light, to_light);
+		float falloff = max(0.0, 1.0 - dist_sq / (pos_radius.w * pos_radius.w));
+		float n_dot_l = max(0.0, dot(view_normal, to_light * inversesqrt(max(dist_sq, 0.0001))));
+		total += color * (falloff * falloff * n_dot_l);
+	}
+	return total;
+}
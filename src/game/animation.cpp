@@ -0,0 +1,175 @@
+#include "game/animation.h"
+#include "platform_sdl/blender_file_io.h"
+#include "platform_sdl/error.h"
+#include "internal/common.h"
+#include "glm/gtc/quaternion.hpp"
+#include "SDL.h"
+#include <cstdlib>
+
+using namespace glm;
+
+static SeparableTransform DecomposeMatrix(const mat4& mat) {
+    SeparableTransform transform;
+    mat3 rotation_mat;
+    for(int i=0; i<3; ++i){
+        vec3 column = vec3(mat[i]);
+        transform.scale[i] = length(column);
+        rotation_mat[i] = column / transform.scale[i];
+    }
+    transform.rotation = normalize(quat_cast(rotation_mat));
+    transform.translation = vec3(mat[3]);
+    return transform;
+}
+
+// Normalized lerp, taking the short way around
+static quat QuatNlerp(const quat& a, const quat& b, float t) {
+    float sign = (dot(a, b) < 0.0f)?-1.0f:1.0f;
+    quat result;
+    result.x = a.x + (b.x * sign - a.x) * t;
+    result.y = a.y + (b.y * sign - a.y) * t;
+    result.z = a.z + (b.z * sign - a.z) * t;
+    result.w = a.w + (b.w * sign - a.w) * t;
+    return normalize(result);
+}
+
+// Spherical lerp, taking the short way around
+static quat QuatSlerp(const quat& a, const quat& b, float t) {
+    quat b_near = b;
+    float cos_angle = dot(a, b);
+    if(cos_angle < 0.0f){
+        b_near = -b;
+        cos_angle = -cos_angle;
+    }
+    if(cos_angle > 0.9995f){
+        // Too close for slerp to be numerically stable
+        return QuatNlerp(a, b_near, t);
+    }
+    float angle = acosf(cos_angle);
+    float sin_angle = sinf(angle);
+    float a_weight = sinf((1.0f - t) * angle) / sin_angle;
+    float b_weight = sinf(t * angle) / sin_angle;
+    quat result;
+    result.x = a.x * a_weight + b_near.x * b_weight;
+    result.y = a.y * a_weight + b_near.y * b_weight;
+    result.z = a.z * a_weight + b_near.z * b_weight;
+    result.w = a.w * a_weight + b_near.w * b_weight;
+    return result;
+}
+
+void CreateAnimationSet(AnimationSet* animation_set, const ParseMesh& parse_mesh, int frames_per_key) {
+    SDL_assert(frames_per_key >= 1);
+    if(parse_mesh.num_animations > AnimationSet::kMaxClips){
+        FormattedError("Too many animations", "Mesh has %d animations, max is %d",
+                       parse_mesh.num_animations, AnimationSet::kMaxClips);
+        exit(1);
+    }
+    animation_set->num_bones = parse_mesh.num_bones;
+    animation_set->num_clips = parse_mesh.num_animations;
+    int num_keys = 0;
+    for(int i=0; i<animation_set->num_clips; ++i){
+        AnimationClip& clip = animation_set->clips[i];
+        clip.num_frames = parse_mesh.animations[i].num_frames;
+        clip.frames_per_key = frames_per_key;
+        clip.num_keys = (clip.num_frames - 1 + frames_per_key - 1) / frames_per_key + 1;
+        clip.key_start = num_keys;
+        num_keys += clip.num_keys;
+    }
+    animation_set->keys = (SeparableTransform*)malloc(
+        sizeof(SeparableTransform) * num_keys * animation_set->num_bones);
+    animation_set->inv_rest_mats = (mat4*)malloc(sizeof(mat4) * animation_set->num_bones);
+    for(int i=0; i<animation_set->num_clips; ++i){
+        const AnimationClip& clip = animation_set->clips[i];
+        for(int key=0; key<clip.num_keys; ++key){
+            // Last key always lands on last frame, so spacing may be uneven there
+            int frame = min(key * clip.frames_per_key, clip.num_frames - 1);
+            int src_index = parse_mesh.animations[i].anim_transform_start +
+                            frame * parse_mesh.num_bones;
+            int dst_index = (clip.key_start + key) * animation_set->num_bones;
+            for(int bone=0; bone<animation_set->num_bones; ++bone){
+                animation_set->keys[dst_index + bone] =
+                    DecomposeMatrix(parse_mesh.anim_transforms[src_index + bone]);
+            }
+        }
+    }
+    for(int bone=0; bone<animation_set->num_bones; ++bone){
+        animation_set->inv_rest_mats[bone] = inverse(parse_mesh.rest_mats[bone]);
+    }
+}
+
+void SampleAnimation(const AnimationSet& animation_set, int clip_index, float frame, SeparableTransform* pose) {
+    SDL_assert(clip_index >= 0 && clip_index < animation_set.num_clips);
+    const AnimationClip& clip = animation_set.clips[clip_index];
+    frame = max(0.0f, min((float)(clip.num_frames - 1), frame));
+    int key = min((int)frame / clip.frames_per_key, clip.num_keys - 1);
+    int next_key = min(key + 1, clip.num_keys - 1);
+    int key_frame = key * clip.frames_per_key;
+    int next_key_frame = min(next_key * clip.frames_per_key, clip.num_frames - 1);
+    float t = 0.0f;
+    if(next_key_frame > key_frame){
+        t = (frame - (float)key_frame) / (float)(next_key_frame - key_frame);
+    }
+    const SeparableTransform* keys_a =
+        &animation_set.keys[(clip.key_start + key) * animation_set.num_bones];
+    const SeparableTransform* keys_b =
+        &animation_set.keys[(clip.key_start + next_key) * animation_set.num_bones];
+    for(int bone=0; bone<animation_set.num_bones; ++bone){
+        pose[bone].rotation = QuatNlerp(keys_a[bone].rotation, keys_b[bone].rotation, t);
+        pose[bone].scale = mix(keys_a[bone].scale, keys_b[bone].scale, t);
+        pose[bone].translation = mix(keys_a[bone].translation, keys_b[bone].translation, t);
+    }
+}
+
+void BlendPoses(const SeparableTransform* pose_a, const SeparableTransform* pose_b,
+                float weight, int num_bones, SeparableTransform* pose)
+{
+    for(int bone=0; bone<num_bones; ++bone){
+        pose[bone].rotation = QuatSlerp(pose_a[bone].rotation, pose_b[bone].rotation, weight);
+        pose[bone].scale = mix(pose_a[bone].scale, pose_b[bone].scale, weight);
+        pose[bone].translation = mix(pose_a[bone].translation, pose_b[bone].translation, weight);
+    }
+}
+
+void GetSkinningMatrices(const AnimationSet& animation_set, const SeparableTransform* pose, mat4* bone_mats) {
+    for(int bone=0; bone<animation_set.num_bones; ++bone){
+        SeparableTransform bone_transform = pose[bone];
+        bone_mats[bone] = bone_transform.GetCombination() * animation_set.inv_rest_mats[bone];
+    }
+}
+
+void GetSkinningDualQuaternions(const mat4* bone_mats, int num_bones, vec4* dual_quats) {
+    for(int bone=0; bone<num_bones; ++bone){
+        const mat4& mat = bone_mats[bone];
+        mat3 rotation_mat;
+        for(int i=0; i<3; ++i){
+            rotation_mat[i] = normalize(vec3(mat[i]));
+        }
+        quat real = normalize(quat_cast(rotation_mat));
+        vec3 t = vec3(mat[3]);
+        // dual = 0.5 * (0, t) * real
+        quat dual;
+        dual.w = -0.5f * ( t.x * real.x + t.y * real.y + t.z * real.z);
+        dual.x =  0.5f * ( t.x * real.w + t.y * real.z - t.z * real.y);
+        dual.y =  0.5f * (-t.x * real.z + t.y * real.w + t.z * real.x);
+        dual.z =  0.5f * ( t.x * real.y - t.y * real.x + t.z * real.w);
+        dual_quats[bone*2+0] = vec4(real.x, real.y, real.z, real.w);
+        dual_quats[bone*2+1] = vec4(dual.x, dual.y, dual.z, dual.w);
+    }
+}
+
+int GetPaletteTexelsPerBone(SkinningMode skinning_mode) {
+    switch(skinning_mode){
+    case kMatrixSkinning: return 4;
+    case kDualQuaternionSkinning: return 2;
+    default: SDL_assert(false); return 4;
+    }
+}
+
+void AnimationSet::Dispose() {
+    free(keys); keys = NULL;
+    free(inv_rest_mats); inv_rest_mats = NULL;
+}
+
+AnimationSet::~AnimationSet() {
+    SDL_assert(keys == NULL);
+    SDL_assert(inv_rest_mats == NULL);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef GAME_ANIMATION_H
+#define GAME_ANIMATION_H
+
+#include "glm/glm.hpp"
+#include "internal/separable_transform.h"
+
+class ParseMesh;
+
+enum SkinningMode {
+    kMatrixSkinning, // 4 texels (mat4) per bone
+    kDualQuaternionSkinning // 2 texels (real, dual) per bone, ignores scale
+};
+
+struct AnimationClip {
+    int num_frames; // In source frames, this is the range that can be sampled
+    int frames_per_key;
+    int num_keys;
+    int key_start; // Index of first key in AnimationSet::keys
+};
+
+// Animation data stored as decomposed keyframes so that it can be kept at
+// a lower rate than it was exported at and interpolated on playback
+struct AnimationSet {
+    static const int kMaxClips = 8;
+    int num_bones;
+    int num_clips;
+    AnimationClip clips[kMaxClips];
+    SeparableTransform* keys; // num_bones per key
+    glm::mat4* inv_rest_mats;
+
+    void Dispose();
+    ~AnimationSet();
+};
+
+void CreateAnimationSet(AnimationSet* animation_set, const ParseMesh& parse_mesh, int frames_per_key);
+// Frame is in source frames, so it does not depend on how the clip is stored
+void SampleAnimation(const AnimationSet& animation_set, int clip, float frame, SeparableTransform* pose);
+void BlendPoses(const SeparableTransform* pose_a, const SeparableTransform* pose_b,
+                float weight, int num_bones, SeparableTransform* pose);
+void GetSkinningMatrices(const AnimationSet& animation_set, const SeparableTransform* pose, glm::mat4* bone_mats);
+// Writes two vec4 per bone: real part then dual part, both xyzw
+void GetSkinningDualQuaternions(const glm::mat4* bone_mats, int num_bones, glm::vec4* dual_quats);
+int GetPaletteTexelsPerBone(SkinningMode skinning_mode);
+
+#endif
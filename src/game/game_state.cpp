@@ -5,15 +5,23 @@
 #include "platform_sdl/file_io.h"
 #include "platform_sdl/graphics.h"
 #include "platform_sdl/profiler.h"
+#include "platform_sdl/program_cache.h"
+#include "platform_sdl/thread_pool.h"
 #include "fbx/fbx.h"
 #include "internal/common.h"
+#include "internal/aabb_tree.h"
+#include "internal/command_list.h"
+#include "internal/frustum.h"
 #include "internal/memory.h"
+#include "internal/mesh_simplify.h"
+#include "internal/occlusion.h"
+#include "internal/skinning.h"
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "SDL.h"
-#include "GL/glew.h"
-#include "GL/gl.h"
 #include <cstring>
+#include <cfloat>
+#include <sys/stat.h>
 
 using namespace glm;
 
@@ -45,6 +53,7 @@ const char* asset_list[] = {
     ASSET_PATH "fonts/LiberationMono-Regular.ttf",
     ASSET_PATH "shaders/3D_model",
     ASSET_PATH "shaders/3D_model_skinned",
+    ASSET_PATH "shaders/3D_model_array",
     ASSET_PATH "shaders/debug_draw",
     ASSET_PATH "shaders/debug_draw_text",
     ASSET_PATH "shaders/nav_mesh"
@@ -78,12 +87,60 @@ enum {
     kFontDebug,
     kShader3DModel,
     kShader3DModelSkinned,
+    kShader3DModelArray,
     kShaderDebugDraw,
     kShaderDebugDrawText,
     kShaderNavMesh
 };
 
 static const bool kDrawNavMesh = false;
+static const float kNearPlane = 0.1f;
+static const float kFarPlane = 100.0f;
+// Clips are exported at one key per frame, we only keep every nth and interpolate
+static const int kAnimationFramesPerKey = 3;
+// The character rig has no scaling, so it can use the smaller palettes
+static const SkinningMode kCharacterSkinningMode = kDualQuaternionSkinning;
+static const bool kRunSkinningBenchmark = false;
+// Animation can reach outside the rest pose bounds
+static const float kCharacterBoundsPadding = 1.5f;
+// Pre-transform the tile map into one buffer per chunk and piece type 
+// instead of drawing each tile as an instance
+static const bool kMergeTileChunks = false;
+// Skip drawables hidden behind raised ground, tested on the CPU
+static const bool kOcclusionCulling = true;
+// Occluders are pulled in a little so they stay inside the real geometry
+static const float kOccluderInset = 0.05f;
+// Start with a few raised blocks of tiles, so the wall pieces and the 
+// occluders under them are used
+static const bool kRaisedTiles = true;
+// In editor mode these raise and lower the tile under the camera
+static const SDL_Scancode kRaiseTileKey = SDL_SCANCODE_R;
+static const SDL_Scancode kLowerTileKey = SDL_SCANCODE_F;
+static const int kMaxTileHeight = 4;
+// Meshes with fewer triangles than this are not worth simplifying
+static const int kMinLodTriangles = 512;
+// Use the coarsest level whose error projects to no more than this
+static const float kMaxLodPixelError = 1.0f;
+// Load the .dds that tools/texture_compressor writes next to a texture 
+// instead, if there is one and the driver can sample DXT
+static const bool kUseCompressedTextures = true;
+// Upload only the small mips of each texture at load, and the rest over
+// the following frames as drawables get close enough to need them
+static const bool kStreamTextures = true;
+static const int kTextureUploadBudget = 2 * 1024 * 1024; // Bytes per frame
+static const int kTextureResidentBudget = 128 * 1024 * 1024;
+// Put the tile textures in one array texture so tiles share texture state
+// and differ only by the layer in their instance data
+static const bool kTileTextureArray = true;
+// Stand street lamps on a grid of tiles, each with a point light at its top
+static const bool kLampLights = true;
+static const int kLampSpacing = 4; // In tiles
+static const float kLampLightRadius = 6.0f;
+static const vec3 kLampLightColor(1.0f, 0.75f, 0.45f);
+// Keep linked shader programs in the write dir and reuse them next launch
+static const bool kProgramBinaryCache = true;
+// Room for one frame of debug lines and text
+static const int kStreamBufferSegmentSize = 2 * 1024 * 1024;
 
 quat Camera::GetRotation() {
     quat xRot = angleAxis(rotation_x, vec3(1,0,0));
@@ -139,58 +196,276 @@ void LoadTTF(const char* path, TextAtlas* text_atlas, FileLoadThreadData* file_l
     stbtt_BakeFontBitmap((const unsigned char*)file_load_data->memory, 0, 
         pixel_height, temp_bitmap, 512, 512, 32, 96, text_atlas->cdata); // no guarantee this fits!
     SDL_UnlockMutex(file_load_data->mutex);
-    GLuint tmp_texture;
-    glGenTextures(1, &tmp_texture);
-    text_atlas->texture = tmp_texture;
+    text_atlas->texture = CreateSingleChannelTexture(kAtlasSize, kAtlasSize, temp_bitmap);
     text_atlas->pixel_height = pixel_height;
-    glBindTexture(GL_TEXTURE_2D, text_atlas->texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, kAtlasSize, kAtlasSize, 0,
-        GL_RED, GL_UNSIGNED_BYTE, temp_bitmap);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     EndLoadFile(file_load_data);
 }
 
-int CreateProgramFromFile(FileLoadThreadData* file_load_data, const char* path){
+// Returns the compressed version of path written by texture_compressor if
+// there is one and it can be used, otherwise path itself
+static const char* GetTexturePath(const char* path, 
+                                  char dds_path[FileRequest::kMaxFileRequestPathLen]) 
+{
+    if(kUseCompressedTextures && SupportsCompressedTextures()){
+        const char* ext = strrchr(path, '.');
+        int stem_len = ext ? (int)(ext - path) : (int)strlen(path);
+        if(stem_len + 5 <= FileRequest::kMaxFileRequestPathLen){
+            memcpy(dds_path, path, stem_len);
+            strcpy(dds_path + stem_len, ".dds");
+            struct stat st;
+            if(stat(dds_path, &st) == 0){
+                return dds_path;
+            }
+        }
+    }
+    return path;
+}
+
+static int LoadTexture(const char* path, FileLoadThreadData* file_load_data, 
+                       ThreadPool* thread_pool, TextureStreamer* texture_streamer) 
+{
+    char dds_path[FileRequest::kMaxFileRequestPathLen];
+    path = GetTexturePath(path, dds_path);
+    if(!kStreamTextures){
+        return LoadImage(path, file_load_data, thread_pool);
+    }
+    TextureSource source;
+    ReadTextureSource(path, file_load_data, thread_pool, &source);
+    return texture_streamer->Add(&source);
+}
+
+// One layer per path, each compressed and streamed like LoadTexture. Returns
+// -1 if they can't share an array, e.g. only some have a compressed version.
+static int LoadTextureArray(const char* const* paths, int num_paths, 
+                            FileLoadThreadData* file_load_data, ThreadPool* thread_pool, 
+                            TextureStreamer* texture_streamer) 
+{
+    static const int kMaxLayers = 8;
+    SDL_assert(num_paths <= kMaxLayers);
+    char dds_paths[kMaxLayers][FileRequest::kMaxFileRequestPathLen];
+    const char* layer_paths[kMaxLayers];
+    for(int i=0; i<num_paths; ++i){
+        layer_paths[i] = GetTexturePath(paths[i], dds_paths[i]);
+    }
+    if(!kStreamTextures){
+        return LoadImageArray(layer_paths, num_paths, file_load_data, thread_pool);
+    }
+    TextureSource sources[kMaxLayers];
+    for(int i=0; i<num_paths; ++i){
+        ReadTextureSource(layer_paths[i], file_load_data, thread_pool, &sources[i]);
+    }
+    int texture = texture_streamer->AddArray(sources, num_paths);
+    if(texture == -1){
+        SDL_Log("Can't put %s and the rest in one array, they differ in size or format\n", 
+                layer_paths[0]);
+        for(int i=0; i<num_paths; ++i){
+            FreeTextureSource(&sources[i]);
+        }
+    }
+    return texture;
+}
+
+static const int kMaxShaderIncludes = 8;
+static const int kMaxLineDirectiveLen = 32;
+
+// The loader reuses its memory for the next file, so this keeps a copy
+static char* LoadShaderSource(FileLoadThreadData* file_load_data, const char* path) {
+    StartLoadFile(path, file_load_data);
+    char* source = (char*)malloc(file_load_data->memory_len + 1);
+    if(!source){
+        FormattedError("Malloc failed", "Could not allocate memory for %s", path);
+        exit(1);
+    }
+    memcpy(source, file_load_data->memory, file_load_data->memory_len);
+    source[file_load_data->memory_len] = '\0';
+    EndLoadFile(file_load_data);
+    return source;
+}
+
+// Puts header straight after the #version line, and replaces each 
+// #include "file" line with that file from the directory of path. #line
+// directives keep compile errors pointing at the right line, with 
+// includes as source string 1.
+static char* PreprocessShaderSource(FileLoadThreadData* file_load_data, const char* path,
+                                    const char* source, const char* header)
+{
+    char* includes[kMaxShaderIncludes];
+    int num_includes = 0;
+    const char* dir_end = strrchr(path, '/');
+    int dir_len = dir_end ? (int)(dir_end - path) + 1 : 0;
+    int max_len = (int)strlen(source) + (int)strlen(header) + kMaxLineDirectiveLen;
+    for(const char* line = source; *line != '\0'; ){
+        const char* line_end = strchr(line, '\n');
+        if(!line_end){
+            line_end = line + strlen(line);
+        }
+        if(strncmp(line, "#include \"", 10) == 0){
+            const char* name = line + 10;
+            const char* name_end = strchr(name, '"');
+            if(!name_end || name_end > line_end || 
+               dir_len + (name_end - name) >= FileRequest::kMaxFileRequestPathLen)
+            {
+                FormattedError("Bad shader include", "Could not read #include in %s", path);
+                exit(1);
+            }
+            if(num_includes == kMaxShaderIncludes){
+                FormattedError("Too many shader includes", "%s has more than %d #includes", 
+                               path, kMaxShaderIncludes);
+                exit(1);
+            }
+            char include_path[FileRequest::kMaxFileRequestPathLen];
+            memcpy(include_path, path, dir_len);
+            memcpy(include_path + dir_len, name, name_end - name);
+            include_path[dir_len + (name_end - name)] = '\0';
+            includes[num_includes] = LoadShaderSource(file_load_data, include_path);
+            max_len += (int)strlen(includes[num_includes]) + kMaxLineDirectiveLen * 2;
+            ++num_includes;
+        }
+        line = (*line_end != '\0') ? line_end + 1 : line_end;
+    }
+
+    char* result = (char*)malloc(max_len + 1);
+    if(!result){
+        FormattedError("Malloc failed", "Could not allocate memory for %s", path);
+        exit(1);
+    }
+    char* dest = result;
+    int line_num = 1;
+    int include_index = 0;
+    for(const char* line = source; *line != '\0'; ++line_num){
+        const char* line_end = strchr(line, '\n');
+        if(!line_end){
+            line_end = line + strlen(line);
+        }
+        const char* next_line = (*line_end != '\0') ? line_end + 1 : line_end;
+        if(strncmp(line, "#include \"", 10) == 0){
+            const char* include = includes[include_index++];
+            int include_len = (int)strlen(include);
+            dest += sprintf(dest, "#line 1 1\n");
+            memcpy(dest, include, include_len);
+            dest += include_len;
+            dest += sprintf(dest, "\n#line %d 0\n", line_num + 1);
+        } else {
+            memcpy(dest, line, next_line - line);
+            dest += next_line - line;
+            if(line_num == 1){
+                if(*line_end == '\0'){
+                    *(dest++) = '\n';
+                }
+                int header_len = (int)strlen(header);
+                memcpy(dest, header, header_len);
+                dest += header_len;
+                dest += sprintf(dest, "#line 2 0\n");
+            }
+        }
+        line = next_line;
+    }
+    *dest = '\0';
+    SDL_assert(dest - result <= max_len);
+    for(int i=0; i<num_includes; ++i){
+        free(includes[i]);
+    }
+    return result;
+}
+
+// Sources are hashed to look the program up in program_cache first, and
+// only compiled if it isn't there. header goes after each #version line.
+int CreateProgramFromFile(FileLoadThreadData* file_load_data, const char* path, 
+                          const char* header, ProgramCache* program_cache)
+{
     char shader_path[FileRequest::kMaxFileRequestPathLen];
     static const int kNumShaders = 2;
-    int shaders[kNumShaders];
+    char* sources[kNumShaders];
 
     for(int i=0; i<kNumShaders; ++i){
         FormatString(shader_path, FileRequest::kMaxFileRequestPathLen, 
             (i==0)?"%s.vert":"%s.frag", path);
-        StartLoadFile(shader_path, file_load_data);
-        char* mem_text = (char*)file_load_data->memory;
-        mem_text[file_load_data->memory_len] = '\0';
-        shaders[i] = CreateShader(i==0?GL_VERTEX_SHADER:GL_FRAGMENT_SHADER, mem_text);
-        EndLoadFile(file_load_data);
+        char* source = LoadShaderSource(file_load_data, shader_path);
+        sources[i] = PreprocessShaderSource(file_load_data, shader_path, source, header);
+        free(source);
+    }
+    int shader_program = program_cache->Load(sources, kNumShaders);
+    if(shader_program == -1){
+        int shaders[kNumShaders];
+        for(int i=0; i<kNumShaders; ++i){
+            shaders[i] = CreateShader(i==0?kVertexShader:kFragmentShader, sources[i]);
+        }
+        shader_program = CreateProgram(shaders, kNumShaders);
+        for(int i=0; i<kNumShaders; ++i){
+            DeleteShader(shaders[i]);
+        }
+        program_cache->Save(shader_program, sources, kNumShaders);
     }
-    int shader_program = CreateProgram(shaders, kNumShaders);
     for(int i=0; i<kNumShaders; ++i){
-        glDeleteShader(shaders[i]);
+        free(sources[i]);
     }
     return shader_program;
 }
 
-void VBOFromMesh(const Mesh* mesh, int* vert_vbo, int* index_vbo) {
+static void InterleaveVert(const Mesh* mesh, int corner, int vert, const vec3& normal, 
+                           float* interleaved) 
+{
+    for(int j=0; j<3; ++j){
+        interleaved[j] = mesh->vert_coords[vert*3+j];
+    }
+    for(int j=0; j<2; ++j){
+        interleaved[3+j] = mesh->tri_uvs[corner*2+j];
+    }
+    for(int j=0; j<3; ++j){
+        interleaved[5+j] = normal[j];
+    }
+}
+
+// Level 0 is the mesh itself, with any simplified levels appended after it 
+// in the same buffers. If keep_verts is not NULL it receives the 
+// interleaved verts, which the caller then owns.
+void VBOFromMesh(const Mesh* mesh, const SimplifiedMesh* levels, int num_levels,
+                 int* vert_vbo, int* index_vbo, float** keep_verts) 
+{
     // TODO: remove duplicated verts
-    int interleaved_size = sizeof(float)*mesh->num_tris*3*8;
+    int num_index = mesh->num_tris*3;
+    for(int i=0; i<num_levels; ++i){
+        num_index += levels[i].num_tris*3;
+    }
+    int interleaved_size = sizeof(float)*num_index*8;
     float* interleaved = (float*)malloc(interleaved_size);
-    int consecutive_size = sizeof(unsigned)*mesh->num_tris*3;
+    int consecutive_size = sizeof(unsigned)*num_index;
     unsigned* consecutive = (unsigned*)malloc(consecutive_size);
-    for(int i=0, index=0, len=mesh->num_tris*3; i<len; ++i){
-        for(int j=0; j<3; ++j){
-            interleaved[index++] = mesh->vert_coords[mesh->tri_indices[i]*3+j];
-        }
-        for(int j=0; j<2; ++j){
-            interleaved[index++] = mesh->tri_uvs[i*2+j];
-        }
-        for(int j=0; j<3; ++j){
-            interleaved[index++] = mesh->tri_normals[i*3+j];
+    int index = 0;
+    for(int len=mesh->num_tris*3; index<len; ++index){
+        vec3 normal(mesh->tri_normals[index*3+0], mesh->tri_normals[index*3+1],
+                    mesh->tri_normals[index*3+2]);
+        InterleaveVert(mesh, index, mesh->tri_indices[index], normal, &interleaved[index*8]);
+    }    
+    for(int i=0; i<num_levels; ++i){
+        const SimplifiedMesh& level = levels[i];
+        for(int tri=0; tri<level.num_tris; ++tri){
+            // Collapses change which verts each face spans, so flat normals 
+            // have to be redone
+            vec3 pos[3];
+            for(int j=0; j<3; ++j){
+                const float* coords = &mesh->vert_coords[level.indices[tri*3+j]*3];
+                pos[j] = vec3(coords[0], coords[1], coords[2]);
+            }
+            vec3 normal = normalize(cross(pos[1] - pos[0], pos[2] - pos[0]));
+            for(int j=0; j<3; ++j){
+                InterleaveVert(mesh, level.source_corners[tri*3+j], level.indices[tri*3+j], 
+                               normal, &interleaved[index*8]);
+                ++index;
+            }
         }
+    }
+    for(int i=0; i<num_index; ++i){
         consecutive[i] = i;
-    }    
+    }
     *vert_vbo = CreateVBO(kArrayVBO, kStaticVBO, interleaved, interleaved_size);
     *index_vbo = CreateVBO(kElementVBO, kStaticVBO, consecutive, consecutive_size);
+    free(consecutive);
+    if(keep_verts){
+        *keep_verts = interleaved;
+    } else {
+        free(interleaved);
+    }
 }
 
 void VBOFromSkinnedMesh(Mesh* mesh, int* vert_vbo, int* index_vbo) {
@@ -241,15 +516,8 @@ void RecalculateNormals(Mesh* mesh){
     }    
 }
 
-struct MeshAsset {
-    int vert_vbo;
-    int index_vbo;
-    int num_index;
-    vec3 bounding_box[2];
-};
-
 void LoadMeshAsset(FileLoadThreadData* file_load_thread_data,
-                   MeshAsset* mesh_asset, const char* path) 
+                   MeshAsset* mesh_asset, const char* path, bool keep_verts = false) 
 {
     FBXParseScene parse_scene;
     LoadFBX(&parse_scene, path, file_load_thread_data, NULL);
@@ -257,7 +525,44 @@ void LoadMeshAsset(FileLoadThreadData* file_load_thread_data,
     RecalculateNormals(&mesh);
     mesh_asset->num_index = mesh.num_tris*3;
     GetBoundingBox(&mesh, mesh_asset->bounding_box);
-    VBOFromMesh(&mesh, &mesh_asset->vert_vbo, &mesh_asset->index_vbo);
+    mesh_asset->verts = NULL;
+
+    // Halve the triangle count for each level
+    static const int kMaxLevels = MeshAsset::kMaxLods - 1;
+    SimplifiedMesh levels[kMaxLevels];
+    int num_levels = 0;
+    if(mesh.num_tris >= kMinLodTriangles){
+        int target_tris[kMaxLevels];
+        for(int i=0; i<kMaxLevels; ++i){
+            target_tris[i] = mesh.num_tris >> (i+1);
+        }
+        num_levels = SimplifyMesh(mesh.vert_coords, mesh.num_verts, mesh.tri_indices, 
+            mesh.tri_uvs, mesh.num_tris, target_tris, kMaxLevels, levels);
+    }
+    mesh_asset->num_lods = 1;
+    mesh_asset->lods[0].first_index = 0;
+    mesh_asset->lods[0].num_indices = mesh_asset->num_index;
+    mesh_asset->lods[0].error = 0.0f;
+    for(int i=0; i<num_levels; ++i){
+        const MeshLod& prev = mesh_asset->lods[mesh_asset->num_lods-1];
+        MeshLod& lod = mesh_asset->lods[mesh_asset->num_lods++];
+        lod.first_index = prev.first_index + prev.num_indices;
+        lod.num_indices = levels[i].num_tris*3;
+        lod.error = levels[i].error;
+    }
+    if(num_levels > 0){
+        for(int i=0; i<mesh_asset->num_lods; ++i){
+            SDL_Log("%s LOD %d: %d tris, error %g\n", path, i, 
+                    mesh_asset->lods[i].num_indices/3, mesh_asset->lods[i].error);
+        }
+    }
+    VBOFromMesh(&mesh, levels, num_levels, &mesh_asset->vert_vbo, &mesh_asset->index_vbo, 
+                keep_verts?&mesh_asset->verts:NULL);
+    mesh_asset->vao = CreateVertexArray(kInterleave_3V2T3N, mesh_asset->vert_vbo, 
+                                        mesh_asset->index_vbo);
+    for(int i=0; i<num_levels; ++i){
+        levels[i].Dispose();
+    }
     parse_scene.Dispose();
 }
 
@@ -266,16 +571,30 @@ void FillStaticDrawable(Drawable* drawable, const MeshAsset& mesh_asset,
 {
     drawable->vert_vbo = mesh_asset.vert_vbo;
     drawable->index_vbo = mesh_asset.index_vbo;
+    drawable->vao = mesh_asset.vao;
     drawable->num_indices = mesh_asset.num_index;
     drawable->vbo_layout = kInterleave_3V2T3N;
     drawable->texture_id = texture;
+    drawable->texture_layer = -1;
     drawable->shader_id = shader;
+    drawable->character = NULL;
+    drawable->bounding_box[0] = mesh_asset.bounding_box[0];
+    drawable->bounding_box[1] = mesh_asset.bounding_box[1];
+    drawable->num_lods = mesh_asset.num_lods;
+    for(int i=0; i<mesh_asset.num_lods; ++i){
+        drawable->lods[i] = mesh_asset.lods[i];
+    }
     SeparableTransform sep_transform;
     sep_transform.translation = translation;
     drawable->transform = sep_transform.GetCombination();
 }
 
-void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_data, StackAllocator* stack_allocator) {
+void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_data, 
+                     StackAllocator* stack_allocator, ThreadPool* thread_pool, 
+                     const char* write_dir) 
+{
+    this->thread_pool = thread_pool;
+    InitJobCounter(&occlusion_job_counter);
     { // Allocate memory for debug lines
         int mem_needed = lines.AllocMemory(NULL);
         void* mem = stack_allocator->Alloc(mem_needed);
@@ -285,73 +604,106 @@ void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_da
             lines.AllocMemory(mem);
         }
     }
+    { // Allocate memory for shared skinning palettes
+        int mem_needed = pose_cache.AllocMemory(NULL);
+        void* mem = stack_allocator->Alloc(mem_needed);
+        if(!mem) {
+            FormattedError("Error", "Could not allocate memory for PoseCache (%d bytes)", mem_needed);
+            exit(1);
+        } else {
+            pose_cache.AllocMemory(mem);
+        }
+    }
 
-    MeshAsset fbx_lamp, fbx_floor, fbx_fountain, fbx_flowerbox, 
-              fbx_garden_tall_corner, fbx_garden_tall_nook, fbx_garden_tall_stairs,
-              fbx_garden_tall_wall, fbx_short_wall, fbx_wall_pillar, fbx_tree;
+    MeshAsset fbx_lamp, fbx_fountain, fbx_flowerbox, fbx_garden_tall_stairs,
+              fbx_short_wall, fbx_wall_pillar, fbx_tree;
     LoadMeshAsset(file_load_thread_data, &fbx_lamp, 
                   asset_list[kFBXLamp]);
     LoadMeshAsset(file_load_thread_data, &fbx_fountain, 
                   asset_list[kFBXFountain]);
     LoadMeshAsset(file_load_thread_data, &fbx_flowerbox, 
                   asset_list[kFBXFlowerbox]);
-    LoadMeshAsset(file_load_thread_data, &fbx_garden_tall_corner, 
-                  asset_list[kFBXGardenTallCorner]);
-    LoadMeshAsset(file_load_thread_data, &fbx_garden_tall_nook, 
-                  asset_list[kFBXGardenTallNook]);
+    LoadMeshAsset(file_load_thread_data, &tile_meshes[kTileCorner], 
+                  asset_list[kFBXGardenTallCorner], kMergeTileChunks);
+    LoadMeshAsset(file_load_thread_data, &tile_meshes[kTileNook], 
+                  asset_list[kFBXGardenTallNook], kMergeTileChunks);
     LoadMeshAsset(file_load_thread_data, &fbx_garden_tall_stairs, 
                   asset_list[kFBXGardenTallStairs]);
-    LoadMeshAsset(file_load_thread_data, &fbx_garden_tall_wall, 
-                  asset_list[kFBXGardenTallWall]);
+    LoadMeshAsset(file_load_thread_data, &tile_meshes[kTileWall], 
+                  asset_list[kFBXGardenTallWall], kMergeTileChunks);
     LoadMeshAsset(file_load_thread_data, &fbx_short_wall, 
                   asset_list[kFBXShortWall]);
     LoadMeshAsset(file_load_thread_data, &fbx_wall_pillar, 
                   asset_list[kFBXTree]);
     LoadMeshAsset(file_load_thread_data, &fbx_wall_pillar, 
                   asset_list[kFBXWallPillar]);
-    LoadMeshAsset(file_load_thread_data, &fbx_floor, 
-                  asset_list[kFBXFloor]);
+    LoadMeshAsset(file_load_thread_data, &tile_meshes[kTileFloor], 
+                  asset_list[kFBXFloor], kMergeTileChunks);
     LoadMeshAsset(file_load_thread_data, &fbx_tree, 
                   asset_list[kFBXTree]);
 
     profiler->StartEvent("Loading textures");
+    texture_streamer.Init(kTextureUploadBudget, kTextureResidentBudget);
+    int tile_texture_array = -1;
+    if(kTileTextureArray){
+        const char* paths[kNumTilePieceTypes];
+        paths[kTileFloor] = asset_list[kTexFloor];
+        paths[kTileWall] = asset_list[kTexGardenTallWall];
+        paths[kTileNook] = asset_list[kTexGardenTallNook];
+        paths[kTileCorner] = asset_list[kTexGardenTallCorner];
+        tile_texture_array = LoadTextureArray(paths, kNumTilePieceTypes, 
+            file_load_thread_data, thread_pool, &texture_streamer);
+    }
+    bool separate_tile_textures = (tile_texture_array == -1);
     int tex_lamp = 
-        LoadImage(asset_list[kTexLamp], file_load_thread_data);
+        LoadTexture(asset_list[kTexLamp], file_load_thread_data, thread_pool, &texture_streamer);
     int tex_fountain = 
-        LoadImage(asset_list[kTexFountain], file_load_thread_data);
+        LoadTexture(asset_list[kTexFountain], file_load_thread_data, thread_pool, &texture_streamer);
     int tex_flower_box = 
-        LoadImage(asset_list[kTexFlowerbox], file_load_thread_data);
-    int tex_garden_tall_corner = 
-        LoadImage(asset_list[kTexGardenTallCorner], file_load_thread_data);
-    int tex_garden_tall_nook = 
-        LoadImage(asset_list[kTexGardenTallNook], file_load_thread_data);
+        LoadTexture(asset_list[kTexFlowerbox], file_load_thread_data, thread_pool, &texture_streamer);
+    int tex_garden_tall_corner = !separate_tile_textures ? -1 :
+        LoadTexture(asset_list[kTexGardenTallCorner], file_load_thread_data, thread_pool, &texture_streamer);
+    int tex_garden_tall_nook = !separate_tile_textures ? -1 :
+        LoadTexture(asset_list[kTexGardenTallNook], file_load_thread_data, thread_pool, &texture_streamer);
     int tex_garden_tall_stairs = 
-        LoadImage(asset_list[kTexGardenTallStairs], file_load_thread_data);
-    int tex_garden_tall_wall = 
-        LoadImage(asset_list[kTexGardenTallWall], file_load_thread_data);
+        LoadTexture(asset_list[kTexGardenTallStairs], file_load_thread_data, thread_pool, &texture_streamer);
+    int tex_garden_tall_wall = !separate_tile_textures ? -1 :
+        LoadTexture(asset_list[kTexGardenTallWall], file_load_thread_data, thread_pool, &texture_streamer);
     int tex_short_wall = 
-        LoadImage(asset_list[kTexShortWall], file_load_thread_data);
+        LoadTexture(asset_list[kTexShortWall], file_load_thread_data, thread_pool, &texture_streamer);
     int tex_tree = 
-        LoadImage(asset_list[kTexTree], file_load_thread_data);
+        LoadTexture(asset_list[kTexTree], file_load_thread_data, thread_pool, &texture_streamer);
     int tex_wall_pillar = 
-        LoadImage(asset_list[kTexWallPillar], file_load_thread_data);
-    int tex_floor = 
-        LoadImage(asset_list[kTexFloor], file_load_thread_data);
+        LoadTexture(asset_list[kTexWallPillar], file_load_thread_data, thread_pool, &texture_streamer);
+    int tex_floor = !separate_tile_textures ? -1 :
+        LoadTexture(asset_list[kTexFloor], file_load_thread_data, thread_pool, &texture_streamer);
     int tex_char = 
-        LoadImage(asset_list[kTexChar], file_load_thread_data);
+        LoadTexture(asset_list[kTexChar], file_load_thread_data, thread_pool, &texture_streamer);
     profiler->EndEvent();
 
     profiler->StartEvent("Loading shaders");
-    int shader_3d_model = 
-        CreateProgramFromFile(file_load_thread_data, asset_list[kShader3DModel]);
-    int shader_3d_model_skinned = 
-        CreateProgramFromFile(file_load_thread_data, asset_list[kShader3DModelSkinned]);
-    int shader_debug_draw = 
-        CreateProgramFromFile(file_load_thread_data, asset_list[kShaderDebugDraw]);
-    int shader_debug_draw_text = 
-        CreateProgramFromFile(file_load_thread_data, asset_list[kShaderDebugDrawText]);
-    int shader_nav_mesh = 
-        CreateProgramFromFile(file_load_thread_data, asset_list[kShaderNavMesh]);
+    static const int kShaderAssets[kNumShaderPrograms] = {
+        kShader3DModel,
+        kShader3DModelSkinned,
+        kShader3DModelArray,
+        kShaderDebugDraw,
+        kShaderDebugDrawText,
+        kShaderNavMesh
+    };
+    // Keeps point_lighting.glsl in step with LightGrid
+    char shader_header[256];
+    FormatString(shader_header, sizeof(shader_header), 
+        "#define LIGHT_GRID_TILES_X %d\n#define LIGHT_GRID_TILES_Y %d\n"
+        "#define LIGHT_GRID_SLICES %d\n",
+        LightGrid::kTilesX, LightGrid::kTilesY, LightGrid::kSlices);
+    ProgramCache program_cache;
+    program_cache.Init(kProgramBinaryCache ? write_dir : NULL);
+    for(int i=0; i<kNumShaderPrograms; ++i){
+        int program = CreateProgramFromFile(file_load_thread_data, asset_list[kShaderAssets[i]],
+                                            shader_header, &program_cache);
+        CreateShaderProgram(&shader_programs[i], program);
+    }
+    per_frame_ubo = CreateVBO(kUniformVBO, kStreamVBO, NULL, sizeof(PerFrameUniforms));
     profiler->EndEvent();
 
     camera.position = vec3(0.0f,0.0f,20.0f);
@@ -360,18 +712,23 @@ void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_da
 
     editor_mode = false;
 
-    lines.shader = shader_debug_draw;
+    CreateStreamBuffer(&stream_buffer, kStreamBufferSegmentSize);
+    lines.shader = shader_programs[kProgramDebugDraw].program;
+    lines.stream_buffer = &stream_buffer;
 
     LoadTTF(asset_list[kFontDebug], &text_atlas, file_load_thread_data, 18.0f);
-    text_atlas.shader = shader_debug_draw_text;
-    text_atlas.vert_vbo = CreateVBO(kArrayVBO, kStreamVBO, NULL, 0);
-    text_atlas.index_vbo = CreateVBO(kElementVBO, kStreamVBO, NULL, 0);
+    text_atlas.shader = shader_programs[kProgramDebugDrawText].program;
+    InitTextAtlasBuffers(&text_atlas, &stream_buffer);
     debug_text.Init(&text_atlas);
+    draw_stats_text = debug_text.GetDebugTextHandle();
 
     lines.num_lines = 0;
     num_drawables = 0;
-
-    lines.vbo = CreateVBO(kArrayVBO, kStreamVBO, NULL, 0);
+    scene_tree.Init();
+    for(int i=0; i<kMaxDrawables; ++i){
+        drawable_proxies[i] = AABBTree::kNullNode;
+    }
+    selected_drawable = -1;
 
     num_character_assets = 0;
     {
@@ -383,33 +740,77 @@ void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_da
         character_assets[num_character_assets].index_vbo = 
             CreateVBO(kElementVBO, kStaticVBO, parse_mesh->indices, 
                       parse_mesh->num_index*sizeof(Uint32));
+        character_assets[num_character_assets].vao = CreateVertexArray(kInterleave_3V2T3N4I4W,
+            character_assets[num_character_assets].vert_vbo, 
+            character_assets[num_character_assets].index_vbo);
         for(int bone_index=0; bone_index<parse_mesh->num_bones; ++bone_index){
             character_assets[num_character_assets].bind_transforms[bone_index] = 
                 parse_mesh->rest_mats[bone_index];
         }
+        CreateAnimationSet(&character_assets[num_character_assets].animation_set,
+                           *parse_mesh, kAnimationFramesPerKey);
+        character_assets[num_character_assets].skinning_mode = kCharacterSkinningMode;
+        { // Bounding sphere around the rest pose, padded for animation
+            vec3 bb_min(FLT_MAX), bb_max(-FLT_MAX);
+            for(int i=0; i<parse_mesh->num_vert; ++i){
+                vec3 pos = *(vec3*)&parse_mesh->vert[i*ParseMesh::kFloatsPerVert];
+                bb_min = min(bb_min, pos);
+                bb_max = max(bb_max, pos);
+            }
+            character_assets[num_character_assets].bounding_sphere_center = (bb_min + bb_max) * 0.5f;
+            character_assets[num_character_assets].bounding_sphere_radius = 
+                length(bb_max - bb_min) * 0.5f * kCharacterBoundsPadding;
+        }
+        if(kRunSkinningBenchmark){
+            const AnimationSet& animation_set = 
+                character_assets[num_character_assets].animation_set;
+            SeparableTransform pose[CharacterAsset::kMaxBones];
+            mat4 palette[CharacterAsset::kMaxBones];
+            SampleAnimation(animation_set, Character::kWalkAnimation, 
+                            (float)Character::kWalkCycleStart, pose);
+            GetSkinningMatrices(animation_set, pose, palette);
+            BenchmarkSkinning(*parse_mesh, palette, 100, profiler);
+        }
+        // Sampling only uses the decomposed keys from here on
+        free(parse_mesh->anim_transforms);
+        parse_mesh->anim_transforms = NULL;
         ++num_character_assets;
     }
 
+    CreateTextureBuffer(&static_instance_buffer, kMaxDrawables * sizeof(mat4));
+    CreateTextureBuffer(&light_buffer, sizeof(light_grid.light_texels));
+    CreateTextureBuffer(&light_cluster_buffer, sizeof(light_grid.cluster_texels));
+    CreateTextureBuffer(&light_index_buffer, sizeof(light_grid.indices));
+    InitJobCounter(&light_job_counter);
+    CreateTextureBuffer(&skinning_buffer, 
+        PoseCache::kMaxPaletteTexels * sizeof(vec4) + kMaxCharacters * sizeof(mat4));
+
     num_characters = 0;
     for(int i=0; i<kMaxCharacters; ++i){
         characters[num_characters].nav_mesh_walker.tri = 0;
         characters[num_characters].nav_mesh_walker.bary_pos = vec3(1/3.0f);
         characters[num_characters].character_asset = &character_assets[0];
         characters[num_characters].transform.translation = vec3(kMapSize-i/10,0,kMapSize-i%10);
-        characters[num_characters].walk_cycle_frame = rand()%100;
+        characters[num_characters].walk_cycle_frame = (float)(Character::kWalkCycleStart + 
+            rand()%(Character::kWalkCycleEnd - Character::kWalkCycleStart));
+        characters[num_characters].walk_weight = 0.0f;
 
         char_drawable = num_drawables;
         drawables[num_drawables].vert_vbo = 
             characters[num_characters].character_asset->vert_vbo;
         drawables[num_drawables].index_vbo = 
             characters[num_characters].character_asset->index_vbo;
+        drawables[num_drawables].vao = 
+            characters[num_characters].character_asset->vao;
         drawables[num_drawables].num_indices = 
             characters[num_characters].character_asset->parse_mesh.num_index;
         drawables[num_drawables].vbo_layout = kInterleave_3V2T3N4I4W;
         drawables[num_drawables].transform = mat4();
         drawables[num_drawables].texture_id = tex_char;
-        drawables[num_drawables].shader_id = shader_3d_model_skinned;
+        drawables[num_drawables].texture_layer = -1;
+        drawables[num_drawables].shader_id = kProgram3DModelSkinned;
         drawables[num_drawables].character = &characters[num_characters];
+        drawables[num_drawables].num_lods = 0;
         ++num_drawables;
         ++num_characters;
     }
@@ -420,114 +821,124 @@ void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_da
             tile_height[z*kMapSize+j] = 0;
         }
     }
+    if(kRaisedTiles){
+        // Away from where the characters start
+        static const int kRaisedBlocks[][5] = { // x, z, width, depth, height
+            {4, 4, 6, 8, 1},
+            {12, 4, 5, 4, 2},
+            {3, 17, 5, 6, 1}
+        };
+        static const int kNumRaisedBlocks = sizeof(kRaisedBlocks) / sizeof(kRaisedBlocks[0]);
+        for(int i=0; i<kNumRaisedBlocks; ++i){
+            const int* block = kRaisedBlocks[i];
+            for(int z=block[1]; z<block[1]+block[3]; ++z){
+                for(int x=block[0]; x<block[0]+block[2]; ++x){
+                    tile_height[z*kMapSize+x] = block[4];
+                }
+            }
+        }
+    }
+    num_pending_tile_edits = 0;
 
     /*
     FillStaticDrawable(&drawables[num_drawables++], fbx_lamp, tex_lamp,
-        shader_3d_model, vec3(0,0,2));
+        kProgram3DModel, vec3(0,0,2));
     FillStaticDrawable(&drawables[num_drawables++], fbx_tree, tex_tree,
-        shader_3d_model, vec3(2,0,0));
+        kProgram3DModel, vec3(2,0,0));
     FillStaticDrawable(&drawables[num_drawables++], fbx_fountain, tex_fountain,
-        shader_3d_model, vec3(4,0,0));
+        kProgram3DModel, vec3(4,0,0));
     FillStaticDrawable(&drawables[num_drawables++], fbx_flowerbox, tex_flower_box,
-        shader_3d_model, vec3(6,0,0));
-    FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_corner, tex_garden_tall_corner,
-        shader_3d_model, vec3(8,0,0));
-    FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_nook, tex_garden_tall_nook,
-        shader_3d_model, vec3(10,0,0));
-    FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_wall, tex_garden_tall_wall,
-        shader_3d_model, vec3(12,0,0));
+        kProgram3DModel, vec3(6,0,0));
+    FillStaticDrawable(&drawables[num_drawables++], tile_meshes[kTileCorner], tex_garden_tall_corner,
+        kProgram3DModel, vec3(8,0,0));
+    FillStaticDrawable(&drawables[num_drawables++], tile_meshes[kTileNook], tex_garden_tall_nook,
+        kProgram3DModel, vec3(10,0,0));
+    FillStaticDrawable(&drawables[num_drawables++], tile_meshes[kTileWall], tex_garden_tall_wall,
+        kProgram3DModel, vec3(12,0,0));
     FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_stairs, tex_garden_tall_stairs,
-        shader_3d_model, vec3(14,0,0));
+        kProgram3DModel, vec3(14,0,0));
     FillStaticDrawable(&drawables[num_drawables++], fbx_short_wall, tex_short_wall,
-        shader_3d_model, vec3(16,0,0));
+        kProgram3DModel, vec3(16,0,0));
     FillStaticDrawable(&drawables[num_drawables++], fbx_wall_pillar, tex_wall_pillar,
-        shader_3d_model, vec3(18,0,0));*/
+        kProgram3DModel, vec3(18,0,0));*/
+    tile_textures[kTileFloor] = tex_floor;
+    tile_textures[kTileWall] = tex_garden_tall_wall;
+    tile_textures[kTileNook] = tex_garden_tall_nook;
+    tile_textures[kTileCorner] = tex_garden_tall_corner;
+    for(int type=0; type<kNumTilePieceTypes; ++type){
+        tile_texture_layers[type] = -1;
+        if(!separate_tile_textures){
+            tile_textures[type] = tile_texture_array;
+            tile_texture_layers[type] = type;
+        }
+    }
+    if(kMergeTileChunks){
+        // With the texture array, all piece types go into one batch
+        VBO_Setup chunk_layout = separate_tile_textures ? 
+            kInterleave_3V2T3N : kInterleave_3V2T3N1L;
+        for(int chunk_index=0; chunk_index<kNumTileChunks; ++chunk_index){
+            TileChunk& chunk = tile_chunks[chunk_index];
+            chunk.num_batches = separate_tile_textures ? kNumTilePieceTypes : 1;
+            for(int type=0; type<chunk.num_batches; ++type){
+                TileChunkBatch& batch = chunk.batches[type];
+                batch.vert_vbo = CreateVBO(kArrayVBO, kStaticVBO, NULL, 0);
+                batch.index_vbo = CreateVBO(kElementVBO, kStaticVBO, NULL, 0);
+                batch.num_indices = 0;
+                batch.drawable = num_drawables;
+                Drawable& drawable = drawables[num_drawables++];
+                drawable.vert_vbo = batch.vert_vbo;
+                drawable.index_vbo = batch.index_vbo;
+                drawable.vao = CreateVertexArray(chunk_layout, batch.vert_vbo, batch.index_vbo);
+                drawable.vbo_layout = chunk_layout;
+                drawable.texture_id = tile_textures[type];
+                // Layers come from the verts, the instance adds nothing
+                drawable.texture_layer = separate_tile_textures ? -1 : 0;
+                drawable.shader_id = separate_tile_textures ? kProgram3DModel : kProgram3DModelArray;
+                drawable.character = NULL;
+                drawable.transform = mat4();
+                drawable.num_lods = 0;
+            }
+            chunk.dirty = true;
+        }
+    } else {
+        for(int i=0; i<kMapSize*kMapSize; ++i){
+            tile_drawables[i] = num_drawables;
+            drawables[num_drawables++].character = NULL;
+        }
+        for(int chunk_index=0; chunk_index<kNumTileChunks; ++chunk_index){
+            tile_chunks[chunk_index].dirty = true;
+        }
+    }
+    UpdateTileGeometry();
+
+    num_lights = 0;
+    if(kLampLights){
+        bool full = false;
+        for(int z=kLampSpacing/2; z<kMapSize && !full; z+=kLampSpacing){
+            for(int x=kLampSpacing/2; x<kMapSize; x+=kLampSpacing){
+                if(num_drawables == kMaxDrawables || num_lights == LightGrid::kMaxLights){
+                    full = true;
+                    break;
+                }
+                // Middle of the tile, see the nav mesh below
+                vec3 translation(x*2-1, tile_height[z*kMapSize+x]*2, z*2+1);
+                FillStaticDrawable(&drawables[num_drawables++], fbx_lamp, tex_lamp,
+                    kProgram3DModel, translation);
+                PointLight& light = lights[num_lights++];
+                light.position = translation + vec3(0.0f, fbx_lamp.bounding_box[1][1], 0.0f);
+                light.radius = kLampLightRadius;
+                light.color = kLampLightColor;
+            }
+        }
+        SDL_assert(num_lights > 0);
+    }
+
     nav_mesh.num_verts = 0;
     nav_mesh.num_indices = 0;
-
     for(int z=0; z<kMapSize; ++z){
         for(int x=0; x<kMapSize; ++x){
-            vec3 translation(x*2,tile_height[z*kMapSize+x]*2,z*2);// Check nooks
-            if(x<kMapSize-1 && z<kMapSize-1 && tile_height[z*kMapSize+x] < tile_height[z*kMapSize+(x+1)] && tile_height[z*kMapSize+x] < tile_height[(z+1)*kMapSize+x]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_nook, tex_garden_tall_nook,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(0,0,2);
-                transform.rotation = angleAxis(-half_pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(x>0 && z>0 && tile_height[z*kMapSize+x] < tile_height[z*kMapSize+(x-1)] && tile_height[z*kMapSize+x] < tile_height[(z-1)*kMapSize+x]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_nook, tex_garden_tall_nook,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(-2,0,0);
-                transform.rotation = angleAxis(half_pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(x>0 && z<kMapSize-1 && tile_height[z*kMapSize+x] < tile_height[z*kMapSize+(x-1)] && tile_height[z*kMapSize+x] < tile_height[(z+1)*kMapSize+x]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_nook, tex_garden_tall_nook,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(-2,0,2);
-                transform.rotation = angleAxis(pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(x<kMapSize-1 && z>0 && tile_height[z*kMapSize+x] < tile_height[z*kMapSize+(x+1)] && tile_height[z*kMapSize+x] < tile_height[(z-1)*kMapSize+x]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_nook, tex_garden_tall_nook,
-                    shader_3d_model, translation);
-            } 
-            // Check walls
-            else if(x<kMapSize-1 && tile_height[z*kMapSize+x] < tile_height[z*kMapSize+(x+1)]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_wall, tex_garden_tall_wall,
-                    shader_3d_model, translation);
-            } else if(x>0 && tile_height[z*kMapSize+x] < tile_height[z*kMapSize+(x-1)]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_wall, tex_garden_tall_wall,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(-2,0,2);
-                transform.rotation = angleAxis(pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(z>0 && tile_height[z*kMapSize+x] < tile_height[(z-1)*kMapSize+x]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_wall, tex_garden_tall_wall,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(-2,0,0);
-                transform.rotation = angleAxis(half_pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(z<kMapSize-1 && tile_height[z*kMapSize+x] < tile_height[(z+1)*kMapSize+x]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_wall, tex_garden_tall_wall,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(0,0,2);
-                transform.rotation = angleAxis(-half_pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            }
-            // Check corners 
-            else if(x<kMapSize-1 && z<kMapSize-1 && tile_height[z*kMapSize+x] < tile_height[(z+1)*kMapSize+(x+1)]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_corner, tex_garden_tall_corner,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(0,0,2);
-                transform.rotation = angleAxis(-half_pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(x>0 && z>0 && tile_height[z*kMapSize+x] < tile_height[(z-1)*kMapSize+(x-1)]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_corner, tex_garden_tall_corner,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(-2,0,0);
-                transform.rotation = angleAxis(half_pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(x>0 && z<kMapSize-1 && tile_height[z*kMapSize+x] < tile_height[(z+1)*kMapSize+(x-1)]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_corner, tex_garden_tall_corner,
-                    shader_3d_model, translation);
-                SeparableTransform transform;
-                transform.translation = translation + vec3(-2,0,2);
-                transform.rotation = angleAxis(pi<float>(), vec3(0,1,0));
-                drawables[num_drawables-1].transform = transform.GetCombination();
-            } else if(x<kMapSize-1 && z>0 && tile_height[z*kMapSize+x] < tile_height[(z-1)*kMapSize+(x+1)]){
-                FillStaticDrawable(&drawables[num_drawables++], fbx_garden_tall_corner, tex_garden_tall_corner,
-                    shader_3d_model, translation);
-            } // Basic floor
-            else {
-                FillStaticDrawable(&drawables[num_drawables++], fbx_floor, tex_floor,
-                    shader_3d_model, translation);
+            if(GetTilePiece(tile_height, kMapSize, x, z).type == kTileFloor){
+                vec3 translation(x*2,tile_height[z*kMapSize+x]*2,z*2);
                 nav_mesh.verts[nav_mesh.num_verts++] = translation;
                 nav_mesh.verts[nav_mesh.num_verts++] = translation + vec3(-2,0,0);
                 nav_mesh.verts[nav_mesh.num_verts++] = translation + vec3(-2,0,2);
@@ -544,7 +955,7 @@ void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_da
 
     nav_mesh.vert_vbo = CreateVBO(kArrayVBO, kStaticVBO, nav_mesh.verts, nav_mesh.num_verts*sizeof(vec3));
     nav_mesh.index_vbo = CreateVBO(kElementVBO, kStaticVBO, nav_mesh.indices, nav_mesh.num_indices*sizeof(Uint32));
-    nav_mesh.shader = shader_nav_mesh;
+    nav_mesh.shader = shader_programs[kProgramNavMesh].program;
     if(kDrawNavMesh) {
         for(int i=0; i<nav_mesh.num_indices; i+=3){
             for(int j=0; j<3; ++j){
@@ -555,6 +966,13 @@ void GameState::Init(Profiler* profiler, FileLoadThreadData* file_load_thread_da
         }
     }
     nav_mesh.CalcNeighbors(stack_allocator);
+
+    update_frame = 0;
+    PublishFrame(SDL_GetTicks());
+    SwapFrames();
+    for(int i=0; i<num_drawables; ++i){
+        UpdateDrawableProxy(i);
+    }
 }
 
 static void UpdateCharacter(Character* character, vec3 target_dir, float time_step,
@@ -615,15 +1033,15 @@ static void UpdateCharacter(Character* character, vec3 target_dir, float time_st
 
     float walk_anim_speed = 30.0f;
     character->walk_cycle_frame += length(character->velocity) * walk_anim_speed * time_step;
-    // TODO: this could be done much more elegantly using modf or similar
-    while((int)character->walk_cycle_frame > Character::kWalkCycleEnd){
-        character->walk_cycle_frame -=
-            (float)(Character::kWalkCycleEnd - Character::kWalkCycleStart);
-    }
-    while((int)character->walk_cycle_frame < Character::kWalkCycleStart){
-        character->walk_cycle_frame +=
-            (float)(Character::kWalkCycleEnd - Character::kWalkCycleStart);
+    // Last frame of the cycle matches the first, so wrap to [start, end)
+    float walk_cycle_len = (float)(Character::kWalkCycleEnd - Character::kWalkCycleStart);
+    float walk_cycle_offset = fmodf(character->walk_cycle_frame - 
+        (float)Character::kWalkCycleStart, walk_cycle_len);
+    if(walk_cycle_offset < 0.0f){
+        walk_cycle_offset += walk_cycle_len;
     }
+    character->walk_cycle_frame = (float)Character::kWalkCycleStart + walk_cycle_offset;
+    character->walk_weight = min(1.0f, length(character->velocity) / char_speed);
 
     target_dir = character->velocity;
 
@@ -652,6 +1070,132 @@ static void UpdateCharacter(Character* character, vec3 target_dir, float time_st
     }
 }
 
+// Where a skinned drawable's character was in the frame being drawn
+static const CharacterFrame& GetCharacterFrame(const GameState* game_state, 
+                                               const Drawable& drawable) 
+{
+    int index = (int)(drawable.character - game_state->characters);
+    SDL_assert(index >= 0 && index < game_state->draw_frame->num_characters);
+    return game_state->draw_frame->characters[index];
+}
+
+// World bounds for the scene tree. Characters use the box around their sphere.
+static void GetDrawableWorldBounds(const GameState* game_state, const Drawable& drawable, 
+                                   vec3* bounds) 
+{
+    if(drawable.vbo_layout == kInterleave_3V2T3N4I4W){
+        const CharacterAsset* character_asset = drawable.character->character_asset;
+        SeparableTransform transform = GetCharacterFrame(game_state, drawable).transform;
+        vec3 center = vec3(transform.GetCombination() * 
+                           vec4(character_asset->bounding_sphere_center, 1.0f));
+        bounds[0] = center - vec3(character_asset->bounding_sphere_radius);
+        bounds[1] = center + vec3(character_asset->bounding_sphere_radius);
+    } else {
+        vec3 center, extent;
+        TransformAABB(drawable.transform, drawable.bounding_box, &center, &extent);
+        bounds[0] = center - extent;
+        bounds[1] = center + extent;
+    }
+}
+
+void GameState::UpdateDrawableProxy(int drawable_index) {
+    vec3 bounds[2];
+    GetDrawableWorldBounds(this, drawables[drawable_index], bounds);
+    int& proxy = drawable_proxies[drawable_index];
+    if(proxy == AABBTree::kNullNode){
+        proxy = scene_tree.CreateProxy(bounds, drawable_index);
+    } else {
+        scene_tree.MoveProxy(proxy, bounds);
+    }
+}
+
+void GameState::SetTileHeight(int x, int z, int height) {
+    SDL_assert(x >= 0 && x < kMapSize && z >= 0 && z < kMapSize);
+    tile_height[z*kMapSize+x] = height;
+    // Pieces depend on their neighbors' heights too
+    for(int neighbor_z=max(0, z-1); neighbor_z<=min(kMapSize-1, z+1); ++neighbor_z){
+        for(int neighbor_x=max(0, x-1); neighbor_x<=min(kMapSize-1, x+1); ++neighbor_x){
+            int chunk_x = neighbor_x / kTileChunkSize;
+            int chunk_z = neighbor_z / kTileChunkSize;
+            tile_chunks[chunk_z*kTileChunksPerSide+chunk_x].dirty = true;
+        }
+    }
+}
+
+// The wall, nook and corner pieces enclose the ground under any tile that
+// is raised above the lowest one, so that ground makes a simple, solid
+// occluder. Neighboring tiles of equal height in a row share one box.
+static void GatherOccluders(GameState* game_state) {
+    static const int kMapSize = GameState::kMapSize;
+    const int* tile_height = game_state->tile_height;
+    int lowest = tile_height[0];
+    for(int i=1; i<kMapSize*kMapSize; ++i){
+        lowest = min(lowest, tile_height[i]);
+    }
+    game_state->num_occluders = 0;
+    for(int z=0; z<kMapSize; ++z){
+        const int* row = &tile_height[z*kMapSize];
+        int x = 0;
+        while(x < kMapSize){
+            int run_end = x+1;
+            while(run_end < kMapSize && row[run_end] == row[x]){
+                ++run_end;
+            }
+            if(row[x] > lowest){
+                // Tile x covers [x*2-2, x*2] along x and [z*2, z*2+2] along z
+                vec3* bounds = game_state->occluder_bounds[game_state->num_occluders++];
+                bounds[0] = vec3(x*2-2, lowest*2, z*2) + vec3(kOccluderInset);
+                bounds[1] = vec3((run_end-1)*2, row[x]*2, z*2+2) - vec3(kOccluderInset);
+            }
+            x = run_end;
+        }
+    }
+}
+
+void GameState::UpdateTileGeometry() {
+    bool changed = false;
+    for(int chunk_z=0; chunk_z<kTileChunksPerSide; ++chunk_z){
+        for(int chunk_x=0; chunk_x<kTileChunksPerSide; ++chunk_x){
+            TileChunk& chunk = tile_chunks[chunk_z*kTileChunksPerSide+chunk_x];
+            if(!chunk.dirty){
+                continue;
+            }
+            changed = true;
+            if(kMergeTileChunks){
+                BuildTileChunk(&chunk, chunk_x, chunk_z, kTileChunkSize, 
+                               tile_height, kMapSize, tile_meshes, 
+                               chunk.num_batches == 1 ? tile_texture_layers : NULL);
+                for(int type=0; type<chunk.num_batches; ++type){
+                    Drawable& drawable = drawables[chunk.batches[type].drawable];
+                    drawable.num_indices = chunk.batches[type].num_indices;
+                    // Slightly loose, but cheaper than bounds per piece type
+                    drawable.bounding_box[0] = chunk.bounding_box[0];
+                    drawable.bounding_box[1] = chunk.bounding_box[1];
+                    UpdateDrawableProxy(chunk.batches[type].drawable);
+                }
+            } else {
+                for(int z=chunk_z*kTileChunkSize; z<(chunk_z+1)*kTileChunkSize; ++z){
+                    for(int x=chunk_x*kTileChunkSize; x<(chunk_x+1)*kTileChunkSize; ++x){
+                        TilePiece piece = GetTilePiece(tile_height, kMapSize, x, z);
+                        Drawable* drawable = &drawables[tile_drawables[z*kMapSize+x]];
+                        int layer = tile_texture_layers[piece.type];
+                        FillStaticDrawable(drawable, tile_meshes[piece.type], 
+                            tile_textures[piece.type], 
+                            layer == -1 ? kProgram3DModel : kProgram3DModelArray, vec3(0.0f));
+                        drawable->texture_layer = layer;
+                        drawable->transform = piece.transform;
+                        UpdateDrawableProxy(tile_drawables[z*kMapSize+x]);
+                    }
+                }
+                chunk.dirty = false;
+            }
+        }
+    }
+    if(changed){
+        GatherOccluders(this);
+    }
+}
+
 void GameState::Update(const vec2& mouse_rel, float time_step) {
     float cam_speed = 10.0f;
     const Uint8 *state = SDL_GetKeyboardState(NULL);
@@ -722,6 +1266,53 @@ void GameState::Update(const vec2& mouse_rel, float time_step) {
         editor_mode = !editor_mode;
     }
     old_tab = (state[SDL_SCANCODE_TAB] != 0);
+
+    // Draw owns the tile map once the game is running, so this only 
+    // queues the change. The nav mesh and lamps are left where they were.
+    static bool old_raise = false, old_lower = false;
+    bool raise = state[kRaiseTileKey] != 0, lower = state[kLowerTileKey] != 0;
+    if(editor_mode && ((raise && !old_raise) || (lower && !old_lower)) &&
+       num_pending_tile_edits < FrameSnapshot::kMaxTileEdits)
+    {
+        // Tile x covers [x*2-2, x*2] along x and [z*2, z*2+2] along z
+        int x = (int)floorf(camera.position[0] * 0.5f) + 1;
+        int z = (int)floorf(camera.position[2] * 0.5f);
+        if(x >= 0 && x < kMapSize && z >= 0 && z < kMapSize){
+            TileEdit& tile_edit = pending_tile_edits[num_pending_tile_edits++];
+            tile_edit.x = x;
+            tile_edit.z = z;
+            tile_edit.height_change = (raise && !old_raise) ? 1 : -1;
+        }
+    }
+    old_raise = raise;
+    old_lower = lower;
+}
+
+void GameState::PublishFrame(int ticks) {
+    FrameSnapshot& frame = frames[update_frame];
+    frame.camera = camera;
+    frame.camera_fov = camera_fov;
+    frame.editor_mode = editor_mode;
+    frame.ticks = ticks;
+    Uint32 mouse_button_bitmask = SDL_GetMouseState(&frame.mouse_pos[0], &frame.mouse_pos[1]);
+    frame.mouse_right_down = (mouse_button_bitmask & SDL_BUTTON_RMASK) != 0;
+    frame.num_tile_edits = num_pending_tile_edits;
+    for(int i=0; i<num_pending_tile_edits; ++i){
+        frame.tile_edits[i] = pending_tile_edits[i];
+    }
+    num_pending_tile_edits = 0;
+    frame.num_characters = num_characters;
+    for(int i=0; i<num_characters; ++i){
+        CharacterFrame& character_frame = frame.characters[i];
+        character_frame.transform = characters[i].transform;
+        character_frame.walk_cycle_frame = characters[i].walk_cycle_frame;
+        character_frame.walk_weight = characters[i].walk_weight;
+    }
+}
+
+void GameState::SwapFrames() {
+    draw_frame = &frames[update_frame];
+    update_frame = 1 - update_frame;
 }
 
 void DrawCoordinateGrid(GameState* game_state){
@@ -740,114 +1331,560 @@ void DrawCoordinateGrid(GameState* game_state){
                           y_axis_color, kDraw, 1);
 }
 
-void DrawDrawable(const mat4 &proj_mat, const mat4 &view_mat, Drawable* drawable) {
-    glUseProgram(drawable->shader_id);
-
-    GLuint modelview_matrix_uniform = glGetUniformLocation(drawable->shader_id, "mv_mat");
-    GLuint projection_matrix_uniform = glGetUniformLocation(drawable->shader_id, "proj_mat");
-    GLuint normal_matrix_uniform = glGetUniformLocation(drawable->shader_id, "norm_mat");
-
-    mat4 model_mat = drawable->transform;
-    mat4 modelview_mat = view_mat * model_mat;
-    mat3 normal_mat = mat3(model_mat);
-    glUniformMatrix3fv(normal_matrix_uniform, 1, false, (GLfloat*)&normal_mat);
-
-    GLuint texture_uniform = glGetUniformLocation(drawable->shader_id, "texture_id");
-    glUniform1i(texture_uniform, 0);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, drawable->texture_id);
-
-    glBindBuffer(GL_ARRAY_BUFFER, drawable->vert_vbo);
-    switch(drawable->vbo_layout){
-    case kSimple_4V:
-        glUniformMatrix4fv(modelview_matrix_uniform, 1, false, (GLfloat*)&modelview_mat);
-        glUniformMatrix4fv(projection_matrix_uniform, 1, false, (GLfloat*)&proj_mat);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable->index_vbo);
-        glDrawElements(GL_TRIANGLES, drawable->num_indices, GL_UNSIGNED_INT, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glDisableVertexAttribArray(0);
-        break;
-    case kInterleave_3V2T3N:
-        glUniformMatrix4fv(modelview_matrix_uniform, 1, false, (GLfloat*)&modelview_mat);
-        glUniformMatrix4fv(projection_matrix_uniform, 1, false, (GLfloat*)&proj_mat);
-        glEnableVertexAttribArray(0);
-        glEnableVertexAttribArray(1);
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), 0);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(5*sizeof(GLfloat)));
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable->index_vbo);
-        glDrawElements(GL_TRIANGLES, drawable->num_indices, GL_UNSIGNED_INT, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glDisableVertexAttribArray(2);
-        glDisableVertexAttribArray(1);
-        glDisableVertexAttribArray(0);
-        break;
-    case kInterleave_3V2T3N4I4W: {
+// Levels share a vertex buffer but can't be instanced together, so the 
+// level goes in with the buffer to keep each level's instances adjacent
+static uint64_t GetDrawableSortKey(const Drawable& drawable, int lod, const mat4& view_mat) {
+    vec4 view_pos = view_mat * drawable.transform[3];
+    return MakeSortKey(kOpaquePass, drawable.shader_id, drawable.texture_id, 
+                       drawable.vert_vbo * MeshAsset::kMaxLods + lod, -view_pos[2] / kFarPlane);
+}
+
+// Picks the coarsest level of each visible static drawable whose error 
+// would cover at most kMaxLodPixelError pixels on screen
+static void SelectDrawableLods(GameState* game_state, const mat4& view_mat, 
+                               float fov_y, int screen_height) 
+{
+    float pixels_per_unit = screen_height / (2.0f * tanf(fov_y * 0.5f));
+    for(int i=0; i<game_state->num_drawables; ++i){
+        const Drawable& drawable = game_state->drawables[i];
+        game_state->drawable_lod[i] = 0;
+        if(drawable.num_lods <= 1 || !game_state->drawable_visible[i]){
+            continue;
+        }
+        vec3 center, extent;
+        TransformAABB(drawable.transform, drawable.bounding_box, &center, &extent);
+        float distance = length(vec3(view_mat * vec4(center, 1.0f))) - length(extent);
+        float scale = max(length(vec3(drawable.transform[0])), 
+                      max(length(vec3(drawable.transform[1])), length(vec3(drawable.transform[2]))));
+        float pixels_per_error = pixels_per_unit * scale / max(kNearPlane, distance);
+        for(int lod=drawable.num_lods-1; lod>0; --lod){
+            if(drawable.lods[lod].error * pixels_per_error <= kMaxLodPixelError){
+                game_state->drawable_lod[i] = lod;
+                break;
+            }
+        }
+    }
+}
+
+// Asks the streamer for enough texture detail to cover each visible 
+// drawable's projected bounds, assuming its UVs span the texture once
+static void RequestTextureDetail(GameState* game_state, const mat4& view_mat, 
+                                 float fov_y, int screen_height) 
+{
+    float pixels_per_unit = screen_height / (2.0f * tanf(fov_y * 0.5f));
+    for(int i=0; i<game_state->num_drawables; ++i){
+        const Drawable& drawable = game_state->drawables[i];
+        if(!game_state->drawable_visible[i]){
+            continue;
+        }
+        vec3 center, extent;
+        if(drawable.vbo_layout == kInterleave_3V2T3N4I4W){
+            vec3 bounds[2];
+            GetDrawableWorldBounds(game_state, drawable, bounds);
+            center = (bounds[0] + bounds[1]) * 0.5f;
+            extent = (bounds[1] - bounds[0]) * 0.5f;
+        } else {
+            TransformAABB(drawable.transform, drawable.bounding_box, &center, &extent);
+        }
+        float radius = length(extent);
+        float distance = length(vec3(view_mat * vec4(center, 1.0f))) - radius;
+        float pixels = pixels_per_unit * 2.0f * radius / max(kNearPlane, distance);
+        game_state->texture_streamer.RequestSize(drawable.texture_id, pixels);
+    }
+}
+
+static void BuildLightGridJob(void* data) {
+    GameState* game_state = (GameState*)data;
+    game_state->light_grid.Build(game_state->lights, game_state->num_lights, 
+                                 game_state->light_view_mat, game_state->light_proj_mat,
+                                 kNearPlane, kFarPlane);
+}
+
+// Waits for BuildLightGridJob and binds its output to the units the lit
+// shaders read it from (see kSamplerUnits)
+static void BindLightGrid(GameState* game_state) {
+    game_state->thread_pool->Wait(&game_state->light_job_counter);
+    const LightGrid& grid = game_state->light_grid;
+    UpdateTextureBuffer(game_state->light_buffer, 0, grid.light_texels, 
+                        grid.num_lights * 2 * sizeof(vec4));
+    UpdateTextureBuffer(game_state->light_cluster_buffer, 0, grid.cluster_texels, 
+                        sizeof(grid.cluster_texels));
+    // Whole texels, kMaxIndices is a multiple of four
+    UpdateTextureBuffer(game_state->light_index_buffer, 0, grid.indices, 
+                        (grid.num_indices + 3) / 4 * sizeof(vec4));
+    BindTexture(2, kCommandTextureBuffer, game_state->light_buffer.texture);
+    BindTexture(3, kCommandTextureBuffer, game_state->light_cluster_buffer.texture);
+    BindTexture(4, kCommandTextureBuffer, game_state->light_index_buffer.texture);
+}
+
+static void UnbindLightGrid() {
+    for(int unit=2; unit<=4; ++unit){
+        BindTexture(unit, kCommandTextureBuffer, 0);
+    }
+}
+
+static void RasterizeOccludersJob(void* data) {
+    GameState* game_state = (GameState*)data;
+    OcclusionBuffer& buffer = game_state->occlusion_buffer;
+    buffer.Clear();
+    for(int i=0; i<game_state->num_occluders; ++i){
+        buffer.RasterizeBox(game_state->occlusion_proj_view_mat, game_state->occluder_bounds[i]);
+    }
+    buffer.BuildHiZ();
+}
+
+// Fills drawable_visible. The scene tree rejects whole regions outside the 
+// frustum, then the remaining static drawables are tested by their 
+// transformed bounding boxes and characters by bounding spheres. Whatever
+// survives is tested against the occlusion buffer, which a worker fills in
+// the meantime. That is skipped while the map is flat and has no occluders.
+static void CullDrawables(GameState* game_state, const mat4& proj_view_mat) {
+    bool occlusion_culling = kOcclusionCulling && game_state->num_occluders > 0;
+    if(occlusion_culling){
+        game_state->occlusion_proj_view_mat = proj_view_mat;
+        game_state->thread_pool->AddJob(RasterizeOccludersJob, game_state, 
+                                        &game_state->occlusion_job_counter);
+    }
+    Frustum frustum;
+    ExtractFrustum(proj_view_mat, &frustum);
+    float (*bounds)[GameState::kMaxDrawables] = game_state->cull_bounds;
+    int* candidates = game_state->cull_candidates;
+    int* cull_indices = game_state->cull_indices;
+    bool* cull_visible = game_state->cull_visible;
+    DrawStats& stats = game_state->draw_stats;
+
+    memset(game_state->drawable_visible, 0, sizeof(bool) * game_state->num_drawables);
+    int num_candidates = game_state->scene_tree.QueryFrustum(frustum, candidates, 
+                                                             GameState::kMaxDrawables);
+    int num_boxes = 0;
+    for(int i=0; i<num_candidates; ++i){
+        const Drawable& drawable = game_state->drawables[candidates[i]];
+        if(drawable.vbo_layout == kInterleave_3V2T3N4I4W || drawable.num_indices == 0){
+            continue;
+        }
+        vec3 center, extent;
+        TransformAABB(drawable.transform, drawable.bounding_box, &center, &extent);
+        for(int k=0; k<3; ++k){
+            bounds[k][num_boxes] = center[k];
+            bounds[3+k][num_boxes] = extent[k];
+        }
+        cull_indices[num_boxes++] = candidates[i];
+    }
+    CullAABBs boxes = {{bounds[0], bounds[1], bounds[2]}, {bounds[3], bounds[4], bounds[5]}};
+    int num_visible = CullAABBsAgainstFrustum(frustum, boxes, num_boxes, cull_visible);
+    for(int i=0; i<num_boxes; ++i){
+        game_state->drawable_visible[cull_indices[i]] = cull_visible[i];
+    }
+
+    int num_spheres = 0;
+    for(int i=0; i<num_candidates; ++i){
+        const Drawable& drawable = game_state->drawables[candidates[i]];
+        if(drawable.vbo_layout != kInterleave_3V2T3N4I4W){
+            continue;
+        }
+        const CharacterAsset* character_asset = drawable.character->character_asset;
+        SeparableTransform transform = GetCharacterFrame(game_state, drawable).transform;
+        vec3 center = vec3(transform.GetCombination() * 
+                           vec4(character_asset->bounding_sphere_center, 1.0f));
+        for(int k=0; k<3; ++k){
+            bounds[k][num_spheres] = center[k];
+        }
+        bounds[3][num_spheres] = character_asset->bounding_sphere_radius;
+        cull_indices[num_spheres++] = candidates[i];
+    }
+    CullSpheres spheres = {{bounds[0], bounds[1], bounds[2]}, bounds[3]};
+    num_visible += CullSpheresAgainstFrustum(frustum, spheres, num_spheres, cull_visible);
+    for(int i=0; i<num_spheres; ++i){
+        game_state->drawable_visible[cull_indices[i]] = cull_visible[i];
+    }
+
+    if(occlusion_culling){
+        game_state->thread_pool->Wait(&game_state->occlusion_job_counter);
+        for(int i=0; i<num_candidates; ++i){
+            int index = candidates[i];
+            if(!game_state->drawable_visible[index]){
+                continue;
+            }
+            vec3 bounds[2];
+            GetDrawableWorldBounds(game_state, game_state->drawables[index], bounds);
+            if(!game_state->occlusion_buffer.IsAABBVisible(proj_view_mat, bounds)){
+                game_state->drawable_visible[index] = false;
+                --num_visible;
+                ++stats.occluded_drawables;
+            }
+        }
+    }
+    // Empty tile and chunk drawables were never going to be drawn, so they
+    // don't count as culled whether or not the scene tree returned them
+    int num_drawn_candidates = 0;
+    for(int i=0; i<game_state->num_drawables; ++i){
+        if(game_state->drawables[i].num_indices != 0){
+            ++num_drawn_candidates;
+        }
+    }
+    stats.visible_drawables += num_visible;
+    stats.culled_drawables += num_drawn_candidates - num_visible;
+}
+
+// Returns the closest drawable whose bounds the ray from the camera through
+// the given point hits, or -1
+static int PickDrawable(GameState* game_state, const mat4& proj_view_mat, const vec2& ndc) {
+    mat4 inv_proj_view_mat = inverse(proj_view_mat);
+    vec4 near_point = inv_proj_view_mat * vec4(ndc, -1.0f, 1.0f);
+    vec4 far_point = inv_proj_view_mat * vec4(ndc, 1.0f, 1.0f);
+    vec3 origin = vec3(near_point) / near_point[3];
+    vec3 dir = vec3(far_point) / far_point[3] - origin;
+    float max_t = length(dir);
+    dir /= max_t;
+    int* candidates = game_state->cull_candidates;
+    int num_candidates = game_state->scene_tree.QueryRay(origin, dir, max_t, candidates, 
+                                                         GameState::kMaxDrawables);
+    int picked = -1;
+    float closest = max_t;
+    for(int i=0; i<num_candidates; ++i){
+        const Drawable& drawable = game_state->drawables[candidates[i]];
+        if(drawable.num_indices == 0){
+            continue;
+        }
+        vec3 bounds[2];
+        GetDrawableWorldBounds(game_state, drawable, bounds);
+        float t = RayIntersectAABB(origin, dir, closest, bounds);
+        if(t >= 0.0f && t < closest){
+            closest = t;
+            picked = candidates[i];
+        }
+    }
+    return picked;
+}
+
+static bool CanInstanceTogether(const Drawable& a, const Drawable& b) {
+    return a.shader_id == b.shader_id && a.texture_id == b.texture_id &&
+           a.vert_vbo == b.vert_vbo && a.index_vbo == b.index_vbo;
+}
+
+// True if render queue item i can't be drawn as part of item i-1's run
+static bool IsRunStart(const GameState* game_state, int i) {
+    if(i == 0){
+        return true;
+    }
+    const RenderQueue& render_queue = game_state->render_queue;
+    int index = render_queue.items[i].index;
+    int prev_index = render_queue.items[i-1].index;
+    return !CanInstanceTogether(game_state->drawables[prev_index], game_state->drawables[index]) ||
+           game_state->drawable_lod[prev_index] != game_state->drawable_lod[index];
+}
+
+struct RecordJob {
+    GameState* game_state;
+    int begin, end; // Render queue items, moved forward to run boundaries
+    CommandList* command_list;
+    DrawStats* stats;
+};
+
+// Records the runs that start in [begin, end) and copies their model 
+// matrices into static_instances. Each list starts with no state bound, 
+// so only changes within one list are skipped.
+static void RecordStaticDrawablesJob(void* data) {
+    RecordJob* job = (RecordJob*)data;
+    GameState* game_state = job->game_state;
+    const RenderQueue& render_queue = game_state->render_queue;
+    CommandList* command_list = job->command_list;
+    DrawStats& stats = *job->stats;
+    command_list->Clear();
+    stats.Clear();
+    int begin = job->begin, end = job->end;
+    while(begin < end && !IsRunStart(game_state, begin)){
+        ++begin;
+    }
+    while(end < render_queue.num_items && !IsRunStart(game_state, end)){
+        ++end;
+    }
+    for(int i=begin; i<end; ++i){
+        const Drawable& drawable = game_state->drawables[render_queue.items[i].index];
+        mat4& record = game_state->static_instances[i];
+        record = drawable.transform;
+        if(drawable.texture_layer != -1){
+            record[3][3] = (float)drawable.texture_layer;
+        }
+    }
+    int program = -1, texture = -1, vao = -1;
+    const ShaderProgram* shader_program = NULL;
+    for(int first=begin, run_end; first<end; first=run_end){
+        const Drawable* drawable = &game_state->drawables[render_queue.items[first].index];
+        int lod = game_state->drawable_lod[render_queue.items[first].index];
+        run_end = first + 1;
+        while(run_end < end && !IsRunStart(game_state, run_end)){
+            ++run_end;
+        }
+        if(drawable->shader_id != program){
+            program = drawable->shader_id;
+            shader_program = &game_state->shader_programs[program];
+            command_list->UseProgram(shader_program->program);
+            ++stats.program_binds;
+        } else {
+            ++stats.redundant_binds_skipped;
+        }
+        if(drawable->texture_id != texture){
+            texture = drawable->texture_id;
+            command_list->BindTexture(0, drawable->texture_layer == -1 ? 
+                kCommandTexture2D : kCommandTexture2DArray, texture);
+            ++stats.texture_binds;
+        } else {
+            ++stats.redundant_binds_skipped;
+        }
+        if(drawable->vao != vao){
+            vao = drawable->vao;
+            command_list->BindVertexArray(vao);
+            ++stats.vertex_array_binds;
+        } else {
+            ++stats.redundant_binds_skipped;
+        }
+        int first_index = 0, num_indices = drawable->num_indices;
+        if(drawable->num_lods > 0){
+            first_index = drawable->lods[lod].first_index;
+            num_indices = drawable->lods[lod].num_indices;
+        }
+        command_list->SetUniformInt(shader_program->uniforms[kUniformInstanceBase], first * 4);
+        command_list->DrawIndexedInstanced(num_indices, first_index, run_end - first);
+        ++stats.draw_calls;
+        stats.triangles += num_indices / 3 * (run_end - first);
+    }
+}
+
+// Draws the sorted static drawables. Runs of drawables that share a mesh, 
+// texture and shader are sorted next to each other, and each run is one 
+// instanced draw, with the model matrices read from static_instance_buffer.
+// The queue is split between the thread pool to record, and the lists are
+// replayed here in queue order.
+static void SubmitRenderQueue(GameState* game_state) {
+    const RenderQueue& render_queue = game_state->render_queue;
+    int num_jobs = min(GameState::kMaxRecordJobs, game_state->thread_pool->num_threads + 1);
+    RecordJob jobs[GameState::kMaxRecordJobs];
+    JobCounter counter;
+    InitJobCounter(&counter);
+    for(int i=0; i<num_jobs; ++i){
+        RecordJob& job = jobs[i];
+        job.game_state = game_state;
+        job.begin = render_queue.num_items * i / num_jobs;
+        job.end = render_queue.num_items * (i+1) / num_jobs;
+        job.command_list = &game_state->command_lists[i];
+        job.stats = &game_state->record_stats[i];
+        game_state->thread_pool->AddJob(RecordStaticDrawablesJob, &job, &counter);
+    }
+    game_state->thread_pool->Wait(&counter);
+
+    const TextureBuffer& buffer = game_state->static_instance_buffer;
+    UpdateTextureBuffer(buffer, 0, game_state->static_instances, 
+                        render_queue.num_items * sizeof(mat4));
+    BindTexture(1, kCommandTextureBuffer, buffer.texture);
+    for(int i=0; i<num_jobs; ++i){
+        ExecuteCommandList(game_state->command_lists[i]);
+        game_state->draw_stats.Add(game_state->record_stats[i]);
+    }
+    BindTexture(1, kCommandTextureBuffer, 0);
+    UseProgram(0);
+}
+
+struct SkinnedBatch {
+    Drawable* drawable; // First drawable in batch, has the shared state
+    int first_instance;
+    int num_instances;
+};
+
+// Draws all skinned drawables that share a mesh, texture and shader with a 
+// single instanced draw call. Each instance is a record of four texels in
+// skinning_buffer: the model matrix columns, with column 3's w replaced by 
+// the texel offset of that instance's pose palette (w is always 1 anyway).
+// Palettes are matrices or dual quaternions depending on the asset.
+static void DrawSkinnedDrawables(GameState* game_state) 
+{
+    PoseCache& pose_cache = game_state->pose_cache;
+    static const int kMaxBatches = GameState::kMaxCharacters;
+    SkinnedBatch batches[kMaxBatches];
+    int num_batches = 0;
+    int drawable_batch[GameState::kMaxDrawables];
+    int num_instances = 0;
+    for(int i=0; i<game_state->num_drawables; ++i){
+        Drawable* drawable = &game_state->drawables[i];
+        drawable_batch[i] = -1;
+        if(drawable->vbo_layout != kInterleave_3V2T3N4I4W || !game_state->drawable_visible[i]){
+            continue;
+        }
+        int batch = 0;
+        for(; batch<num_batches; ++batch){
+            const Drawable* other = batches[batch].drawable;
+            if(other->vert_vbo == drawable->vert_vbo &&
+               other->texture_id == drawable->texture_id &&
+               other->shader_id == drawable->shader_id &&
+               other->character->character_asset->skinning_mode == 
+                   drawable->character->character_asset->skinning_mode)
+            {
+                break;
+            }
+        }
+        if(batch == num_batches){
+            batches[batch].drawable = drawable;
+            batches[batch].num_instances = 0;
+            ++num_batches;
+        }
+        drawable_batch[i] = batch;
+        ++batches[batch].num_instances;
+        ++num_instances;
+    }
+    if(num_instances == 0){
+        return;
+    }
+    for(int batch=0, first=0; batch<num_batches; ++batch){
+        batches[batch].first_instance = first;
+        first += batches[batch].num_instances;
+        batches[batch].num_instances = 0;
+    }
+    SDL_assert(num_instances <= GameState::kMaxCharacters);
+    for(int i=0; i<game_state->num_drawables; ++i){
+        if(drawable_batch[i] == -1){
+            continue;
+        }
+        Drawable* drawable = &game_state->drawables[i];
+        SkinnedBatch& batch = batches[drawable_batch[i]];
         SDL_assert(drawable->character != NULL);
-        Character* character = drawable->character;
-        drawable->transform = character->transform.GetCombination();
-        ParseMesh* parse_mesh = &character->character_asset->parse_mesh;
-        int animation = 1;//1;
-        int frame = (int)character->walk_cycle_frame;
-        int start_anim_transform = 
-            parse_mesh->animations[animation].anim_transform_start +
-            parse_mesh->num_bones * frame;
-        mat4 bone_transforms[128];
-        for(int bone_index=0; bone_index<parse_mesh->num_bones; ++bone_index){
-            mat4 temp = parse_mesh->anim_transforms[start_anim_transform + bone_index];
-            bone_transforms[bone_index] = temp * 
-                inverse(parse_mesh->rest_mats[bone_index]);
-        }
-        for(int i=0; i<128; ++i){
-            bone_transforms[i] = drawable->transform * bone_transforms[i];
-        }
-        glUniformMatrix4fv(projection_matrix_uniform, 1, false, (GLfloat*)&proj_mat);
-        glUniformMatrix4fv(modelview_matrix_uniform, 1, false, (GLfloat*)&view_mat);
-        GLuint bone_transforms_uniform = glGetUniformLocation(drawable->shader_id, "bone_matrices");
-        glUniformMatrix4fv(bone_transforms_uniform, 128, false, (GLfloat*)bone_transforms);
-        glEnableVertexAttribArray(0);
-        glEnableVertexAttribArray(1);
-        glEnableVertexAttribArray(2);
-        glEnableVertexAttribArray(3);
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), 0);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (void*)(5*sizeof(GLfloat)));
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (void*)(8*sizeof(GLfloat)));
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (void*)(12*sizeof(GLfloat)));
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable->index_vbo);
-        glDrawElements(GL_TRIANGLES, drawable->num_indices, GL_UNSIGNED_INT, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glDisableVertexAttribArray(4);
-        glDisableVertexAttribArray(3);
-        glDisableVertexAttribArray(2);
-        glDisableVertexAttribArray(1);
-        glDisableVertexAttribArray(0);
-        } break;
-    }
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glUseProgram(0);
-}
-
-void GameState::Draw(GraphicsContext* context, int ticks) {
+        const CharacterFrame& character = GetCharacterFrame(game_state, *drawable);
+        SeparableTransform transform = character.transform;
+        drawable->transform = transform.GetCombination();
+        const CharacterAsset* character_asset = drawable->character->character_asset;
+        int pose = pose_cache.GetPose(character_asset->animation_set, 
+            character_asset->skinning_mode,
+            Character::kIdleAnimation, 0.0f,
+            Character::kWalkAnimation, character.walk_cycle_frame, 
+            character.walk_weight);
+        mat4& record = game_state->skinned_instances[batch.first_instance + batch.num_instances];
+        record = drawable->transform;
+        record[3][3] = (float)pose_cache.palette_start[pose];
+        ++batch.num_instances;
+    }
+
+    const TextureBuffer& buffer = game_state->skinning_buffer;
+    int palette_bytes = pose_cache.num_palette_texels * sizeof(vec4);
+    UpdateTextureBuffer(buffer, 0, pose_cache.palettes, palette_bytes);
+    UpdateTextureBuffer(buffer, palette_bytes, game_state->skinned_instances, 
+                        num_instances * sizeof(mat4));
+
+    CommandList& command_list = game_state->skinned_command_list;
+    command_list.Clear();
+    command_list.BindTexture(1, kCommandTextureBuffer, buffer.texture);
+    DrawStats& stats = game_state->draw_stats;
+    for(int batch_index=0; batch_index<num_batches; ++batch_index){
+        const SkinnedBatch& batch = batches[batch_index];
+        const Drawable* drawable = batch.drawable;
+        const ShaderProgram& shader_program = game_state->shader_programs[drawable->shader_id];
+        command_list.UseProgram(shader_program.program);
+        command_list.SetUniformInt(shader_program.uniforms[kUniformInstanceBase], 
+                                   pose_cache.num_palette_texels + batch.first_instance * 4);
+        command_list.SetUniformInt(shader_program.uniforms[kUniformDualQuaternionSkinning], 
+            drawable->character->character_asset->skinning_mode == kDualQuaternionSkinning);
+        command_list.BindTexture(0, kCommandTexture2D, drawable->texture_id);
+        command_list.BindVertexArray(drawable->vao);
+        command_list.DrawIndexedInstanced(drawable->num_indices, 0, batch.num_instances);
+        ++stats.draw_calls;
+        stats.triangles += drawable->num_indices / 3 * batch.num_instances;
+        ++stats.program_binds;
+        ++stats.texture_binds;
+        ++stats.vertex_array_binds;
+    }
+    ExecuteCommandList(command_list);
+    BindTexture(1, kCommandTextureBuffer, 0);
+    UseProgram(0);
+}
+
+// Runs on the render thread, so everything the simulation changes is read
+// from draw_frame rather than the live state
+void GameState::Draw(GraphicsContext* context) {
     CHECK_GL_ERROR();
+    StreamBufferBeginFrame(&stream_buffer);
+    const FrameSnapshot& frame = *draw_frame;
+    Camera draw_camera = frame.camera; // GetMatrix isn't const
 
-    glViewport(0, 0, context->screen_dims[0], context->screen_dims[1]);
-    glClearColor(0.5,0.5,0.5,1);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
+    ClearFrame(context, vec4(0.5f, 0.5f, 0.5f, 1.0f));
 
     float aspect_ratio = context->screen_dims[0] / (float)context->screen_dims[1];
-    mat4 proj_mat = glm::perspective(camera_fov, aspect_ratio, 0.1f, 100.0f);
-    mat4 view_mat = inverse(camera.GetMatrix());
+    mat4 proj_mat = glm::perspective(frame.camera_fov, aspect_ratio, kNearPlane, kFarPlane);
+    mat4 view_mat = inverse(draw_camera.GetMatrix());
+
+    PerFrameUniforms per_frame;
+    per_frame.proj_mat = proj_mat;
+    per_frame.view_mat = view_mat;
+    per_frame.proj_view_mat = proj_mat * view_mat;
+    per_frame.screen_ortho_mat = glm::ortho(0.0f, (float)context->screen_dims[0], 
+        (float)context->screen_dims[1], 0.0f, -1.0f, 1.0f);
+    per_frame.light_cluster_params = LightGrid::GetClusterParams(
+        context->screen_dims[0], context->screen_dims[1], kNearPlane, kFarPlane);
+    UpdateVBO(kUniformVBO, kStreamVBO, per_frame_ubo, &per_frame, sizeof(PerFrameUniforms));
+    BindUniformBuffer(kPerFrameUniformBinding, per_frame_ubo);
 
+    for(int i=0; i<frame.num_tile_edits; ++i){
+        const TileEdit& tile_edit = frame.tile_edits[i];
+        int height = tile_height[tile_edit.z*kMapSize+tile_edit.x] + tile_edit.height_change;
+        SetTileHeight(tile_edit.x, tile_edit.z, max(0, min(kMaxTileHeight, height)));
+    }
+    UpdateTileGeometry();
     for(int i=0; i<num_drawables; ++i){
-        Drawable* drawable = &drawables[i];
-        DrawDrawable(proj_mat, view_mat, drawable);
+        if(drawables[i].vbo_layout == kInterleave_3V2T3N4I4W){
+            UpdateDrawableProxy(i);
+        }
+    }
+
+    light_view_mat = view_mat;
+    light_proj_mat = proj_mat;
+    thread_pool->AddJob(BuildLightGridJob, this, &light_job_counter);
+
+    draw_stats.Clear();
+    CullDrawables(this, per_frame.proj_view_mat);
+    SelectDrawableLods(this, view_mat, frame.camera_fov, context->screen_dims[1]);
+    if(kStreamTextures){
+        RequestTextureDetail(this, view_mat, frame.camera_fov, context->screen_dims[1]);
+        texture_streamer.Update();
+    }
+    render_queue.Clear();
+    for(int i=0; i<num_drawables; ++i){
+        const Drawable& drawable = drawables[i];
+        if(drawable.vbo_layout != kInterleave_3V2T3N4I4W && drawable.num_indices > 0 && 
+           drawable_visible[i])
+        {
+            render_queue.Add(GetDrawableSortKey(drawable, drawable_lod[i], view_mat), i);
+        }
+    }
+    render_queue.Sort();
+    BindLightGrid(this);
+    SubmitRenderQueue(this);
+    pose_cache.Clear();
+    DrawSkinnedDrawables(this);
+    UnbindLightGrid();
+    BindVertexArray(context->default_vao);
+    if(frame.editor_mode){
+        if(frame.mouse_right_down){
+            vec2 ndc(frame.mouse_pos[0] * 2.0f / context->screen_dims[0] - 1.0f,
+                     1.0f - frame.mouse_pos[1] * 2.0f / context->screen_dims[1]);
+            selected_drawable = PickDrawable(this, per_frame.proj_view_mat, ndc);
+        }
+        if(selected_drawable != -1){
+            Drawable& drawable = drawables[selected_drawable];
+            if(drawable.vbo_layout == kInterleave_3V2T3N4I4W){
+                vec3 bounds[2];
+                GetDrawableWorldBounds(this, drawable, bounds);
+                DrawBoundingBox(&lines, mat4(), bounds, kDraw, 1);
+            } else {
+                DrawBoundingBox(&lines, drawable.transform, drawable.bounding_box, kDraw, 1);
+            }
+        }
+        debug_text.UpdateDebugText(draw_stats_text, frame.ticks/1000.0f + 0.5f, 
+            "Draw calls: %d  Binds: %d program, %d texture, %d vao  Skipped: %d  "
+            "Visible: %d  Culled: %d (%d occluded)  Tris: %d  "
+            "Textures: %d KB (%d streaming)  Lights: %d (%d entries, %d dropped)",
+            draw_stats.draw_calls, draw_stats.program_binds, draw_stats.texture_binds,
+            draw_stats.vertex_array_binds, draw_stats.redundant_binds_skipped,
+            draw_stats.visible_drawables, draw_stats.culled_drawables,
+            draw_stats.occluded_drawables, draw_stats.triangles,
+            texture_streamer.resident_bytes / 1024, texture_streamer.num_pending,
+            light_grid.num_lights, light_grid.num_indices, light_grid.num_dropped);
     }
 
     static const bool draw_coordinate_grid = false;
@@ -855,11 +1892,12 @@ void GameState::Draw(GraphicsContext* context, int ticks) {
         DrawCoordinateGrid(this);
     }
     if(kDrawNavMesh){
-        nav_mesh.Draw(proj_mat * view_mat);
+        nav_mesh.Draw();
         CHECK_GL_ERROR();
     }
-    lines.Draw(proj_mat * view_mat);
+    lines.Draw();
     CHECK_GL_ERROR();
-    debug_text.Draw(context, ticks/1000.0f);
+    debug_text.Draw(frame.ticks/1000.0f);
     CHECK_GL_ERROR();
+    StreamBufferEndFrame(&stream_buffer);
 }
@@ -3,11 +3,22 @@
 #define GAME_GAME_STATE_H
 
 #include "glm/glm.hpp"
+#include "game/animation.h"
 #include "game/nav_mesh.h"
+#include "game/pose_cache.h"
+#include "game/render_queue.h"
+#include "game/tile_map.h"
+#include "internal/aabb_tree.h"
+#include "internal/command_list.h"
+#include "internal/light_grid.h"
+#include "internal/occlusion.h"
 #include "internal/separable_transform.h"
 #include "platform_sdl/blender_file_io.h"
 #include "platform_sdl/debug_draw.h"
 #include "platform_sdl/debug_text.h"
+#include "platform_sdl/graphics.h"
+#include "platform_sdl/texture_streamer.h"
+#include "platform_sdl/thread_pool.h"
 
 #ifdef WIN32
 #define ASSET_PATH "../assets/"
@@ -24,8 +35,13 @@ struct CharacterAsset {
     static const int kMaxBones = 128;
     ParseMesh parse_mesh;
     glm::mat4 bind_transforms[128];
+    AnimationSet animation_set;
+    SkinningMode skinning_mode;
     int vert_vbo;
     int index_vbo;
+    int vao;
+    glm::vec3 bounding_sphere_center;
+    float bounding_sphere_radius;
 };
 
 struct Character {
@@ -34,7 +50,10 @@ struct Character {
     NavMeshWalker nav_mesh_walker;
     static const int kWalkCycleStart = 31;
     static const int kWalkCycleEnd = 58;
+    static const int kIdleAnimation = 0;
+    static const int kWalkAnimation = 1;
     float walk_cycle_frame;
+    float walk_weight; // Cross-fade from idle to walk
     CharacterAsset* character_asset;
 };
 
@@ -46,27 +65,87 @@ struct Camera {
     glm::mat4 GetMatrix();
 };
 
-enum VBO_Setup {
-    kSimple_4V, // 4 vert
-    kInterleave_3V2T3N, // 3 vert, 2 tex coord, 3 normal
-    kInterleave_3V2T3N4I4W // 3 vert, 2 tex coord, 3 normal, 4 bone index, 4 bone weight
+// The parts of a character that drawing needs
+struct CharacterFrame {
+    SeparableTransform transform;
+    float walk_cycle_frame;
+    float walk_weight;
+};
+
+// Range of the mesh's index buffer to draw at one level of detail
+struct MeshLod {
+    int first_index;
+    int num_indices;
+    float error; // Model space distance from the full mesh, 0 for level 0
+};
+
+struct MeshAsset {
+    static const int kMaxLods = 4;
+    int vert_vbo;
+    int index_vbo;
+    int vao;
+    int num_index; // Level 0 only
+    glm::vec3 bounding_box[2];
+    float* verts; // Interleaved 3v 2t 3n per index, NULL unless asked for
+    int num_lods;
+    MeshLod lods[kMaxLods]; // Simplified levels follow level 0 in the buffers
 };
 
 struct Drawable {
     int texture_id;
+    int texture_layer; // -1 unless texture_id is a 2D array
     int vert_vbo;
     int index_vbo;
+    int vao; // Binds both buffers with vbo_layout
     int num_indices;
-    int shader_id;
+    int shader_id; // Index into GameState::shader_programs
     Character* character;
     VBO_Setup vbo_layout;
     glm::mat4 transform;
+    glm::vec3 bounding_box[2]; // Model space, characters use their asset's sphere
+    int num_lods; // 0 if num_indices is all there is
+    MeshLod lods[MeshAsset::kMaxLods];
+};
+
+enum ShaderProgramID {
+    kProgram3DModel,
+    kProgram3DModelSkinned,
+    kProgram3DModelArray, // Static, with a texture array layer per instance
+    kProgramDebugDraw,
+    kProgramDebugDrawText,
+    kProgramNavMesh,
+    kNumShaderPrograms
+};
+
+// Raises or lowers one tile, made in Update and applied in Draw
+struct TileEdit {
+    int x, z;
+    int height_change;
 };
 
 class GameState {
 public:
-    static const int kMaxDrawables = 1000;
+    // Characters, one per tile unless kMergeTileChunks, and the lamps
+    static const int kMaxDrawables = 1100;
     static const int kMaxCharacters = 100;
+    // Everything Draw reads that Update changes, copied once per update so
+    // the render thread can draw one frame while the next is simulated
+    struct FrameSnapshot {
+        Camera camera;
+        float camera_fov;
+        bool editor_mode;
+        int ticks;
+        int mouse_pos[2];
+        bool mouse_right_down; // Picks a drawable in editor mode
+        static const int kMaxTileEdits = 8;
+        TileEdit tile_edits[kMaxTileEdits];
+        int num_tile_edits;
+        int num_characters;
+        CharacterFrame characters[kMaxCharacters];
+    };
+    FrameSnapshot frames[2];
+    int update_frame; // Written by PublishFrame
+    const FrameSnapshot* draw_frame; // Read by Draw, the other one
     static const int kMaxCharacterAssets = 4;
     int num_character_assets;
     CharacterAsset character_assets[kMaxCharacterAssets];
@@ -74,6 +153,53 @@ public:
     int num_drawables;
     DebugDrawLines lines;
     DebugText debug_text;
+    ShaderProgram shader_programs[kNumShaderPrograms];
+    int per_frame_ubo;
+    StreamBuffer stream_buffer; // Per-frame vertex data
+    TextureStreamer texture_streamer; // Finer mips are uploaded as Draw asks
+    // Fat world bounds of every drawable, for culling and picking. Owned by
+    // the drawing side, characters are moved in it from draw_frame.
+    AABBTree scene_tree;
+    int drawable_proxies[kMaxDrawables];
+    int selected_drawable; // Picked with right click in editor mode, or -1
+    bool drawable_visible[kMaxDrawables]; // Result of this frame's frustum culling
+    int drawable_lod[kMaxDrawables]; // Chosen this frame for visible drawables
+    // Culling scratch: bounds as structure of arrays, and the drawable for each
+    float cull_bounds[6][kMaxDrawables];
+    int cull_candidates[kMaxDrawables];
+    int cull_indices[kMaxDrawables];
+    bool cull_visible[kMaxDrawables];
+    // Occluders are rasterized on a worker while the frustum tests run
+    ThreadPool* thread_pool;
+    OcclusionBuffer occlusion_buffer;
+    JobCounter occlusion_job_counter;
+    glm::mat4 occlusion_proj_view_mat;
+    RenderQueue render_queue;
+    // Static draws are recorded on the thread pool, one list per job
+    static const int kMaxRecordJobs = 4;
+    CommandList command_lists[kMaxRecordJobs];
+    DrawStats record_stats[kMaxRecordJobs];
+    CommandList skinned_command_list;
+    DrawStats draw_stats;
+    int draw_stats_text; // Debug text handle, shown in editor mode
+    // Model matrices of static drawables, in render queue order. Column 3's
+    // w holds the texture layer for drawables with one.
+    TextureBuffer static_instance_buffer;
+    glm::mat4 static_instances[kMaxDrawables];
+    PoseCache pose_cache;
+    // Lamp lights, binned into clusters on a worker while culling runs
+    PointLight lights[LightGrid::kMaxLights];
+    int num_lights;
+    LightGrid light_grid;
+    JobCounter light_job_counter;
+    glm::mat4 light_view_mat;
+    glm::mat4 light_proj_mat;
+    TextureBuffer light_buffer; // The three LightGrid texel arrays
+    TextureBuffer light_cluster_buffer;
+    TextureBuffer light_index_buffer;
+    // Packed pose palettes followed by one record per skinned instance
+    TextureBuffer skinning_buffer;
+    glm::mat4 skinned_instances[kMaxCharacters];
     float camera_fov;
     int num_characters;
     Character characters[kMaxCharacters];
@@ -84,11 +210,38 @@ public:
     NavMesh nav_mesh;
 
     static const int kMapSize = 30;
+    static const int kTileChunkSize = 6; // Must divide kMapSize
+    static const int kTileChunksPerSide = kMapSize / kTileChunkSize;
+    static const int kNumTileChunks = kTileChunksPerSide * kTileChunksPerSide;
     int tile_height[kMapSize * kMapSize];
+    MeshAsset tile_meshes[kNumTilePieceTypes];
+    int tile_textures[kNumTilePieceTypes]; // All the same array, or one each
+    int tile_texture_layers[kNumTilePieceTypes]; // -1 for separate textures
+    int tile_drawables[kMapSize * kMapSize]; // When not merging chunks
+    TileChunk tile_chunks[kNumTileChunks];
+    // Solid ground under raised tiles, one box per run of equal height
+    glm::vec3 occluder_bounds[kMapSize * kMapSize][2];
+    int num_occluders;
+    // Made since the last PublishFrame
+    TileEdit pending_tile_edits[FrameSnapshot::kMaxTileEdits];
+    int num_pending_tile_edits;
+
+    // Geometry for changed tiles is rebuilt by chunk in UpdateTileGeometry
+    void SetTileHeight(int x, int z, int height);
+    // Call after changing a drawable's transform or bounds
+    void UpdateDrawableProxy(int drawable_index);
+    void UpdateTileGeometry();
 
     void Update(const glm::vec2& mouse_rel, float time_step);
-    void Init(Profiler* profiler, FileLoadThreadData* file_load_thread_data, StackAllocator* stack_allocator);
-    void Draw(GraphicsContext* context, int ticks);
+    // write_dir is where caches go, NULL to not keep any
+    void Init(Profiler* profiler, FileLoadThreadData* file_load_thread_data, 
+              StackAllocator* stack_allocator, ThreadPool* thread_pool, 
+              const char* write_dir);
+    // Copies the simulation into update_frame. Safe while Draw is running.
+    void PublishFrame(int ticks);
+    // Makes the published frame the one to draw. Not while Draw is running.
+    void SwapFrames();
+    void Draw(GraphicsContext* context);
 };
 
 #endif
\ No newline at end of file
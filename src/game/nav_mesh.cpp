@@ -2,9 +2,8 @@
 #include "internal/memory.h"
 #include "internal/common.h"
 #include "platform_sdl/error.h"
+#include "platform_sdl/graphics.h"
 #include "glm/glm.hpp"
-#include "GL/glew.h"
-#include "GL/gl.h"
 
 using namespace glm;
 
@@ -44,19 +43,9 @@ vec3 NavMeshWalker::GetBaryPos(NavMesh* nav_mesh, vec3 pos) {
     return bary;
 }
 
-void NavMesh::Draw(const mat4& proj_view_mat) {
-    glBindBuffer(GL_ARRAY_BUFFER, vert_vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
-    glUseProgram(shader);
-    GLuint modelview_matrix_uniform = glGetUniformLocation(shader, "mv_mat");
-    glUniformMatrix4fv(modelview_matrix_uniform, 1, false, (GLfloat*)&proj_view_mat);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
-    glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_INT, 0);
-    glDisableVertexAttribArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glUseProgram(0);
+// Transform comes from the PerFrame uniform block
+void NavMesh::Draw() {
+    DrawUnbatched(shader, kSimple_3V, vert_vbo, 0, index_vbo, kDrawTriangles, num_indices);
 }
 
 struct Vec3EdgeHash {
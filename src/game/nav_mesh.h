@@ -21,7 +21,7 @@ public:
     int tri_neighbors[kMaxNavMeshTris*3];
 
     void CalcNeighbors(StackAllocator* stack_allocator);
-    void Draw(const glm::mat4& proj_view_mat);
+    void Draw();
 };
 
 class NavMeshWalker {
@@ -0,0 +1,95 @@
+#include "game/pose_cache.h"
+#include "game/animation.h"
+#include "internal/common.h"
+#include "glm/glm.hpp"
+#include "SDL.h"
+#include <cstring>
+
+using namespace glm;
+
+int PoseCache::AllocMemory(void* mem) {
+    int palettes_size = kMaxPaletteTexels * sizeof(vec4);
+    if(mem){
+        palettes = (vec4*)mem;
+    }
+    return palettes_size;
+}
+
+void PoseCache::Clear() {
+    num_poses = 0;
+    num_requests = 0;
+    num_palette_texels = 0;
+    for(int i=0; i<kHashTableSize; ++i){
+        hash_table[i] = -1;
+    }
+}
+
+static int FrameBucket(float frame) {
+    return (int)(frame * PoseCache::kFrameBuckets + 0.5f);
+}
+
+int PoseCache::GetPose(const AnimationSet& animation_set, SkinningMode skinning_mode,
+                       int clip_a, float frame_a, int clip_b, float frame_b, float weight)
+{
+    ++num_requests;
+    PoseCacheKey key;
+    memset(&key, 0, sizeof(key)); // Padding is hashed too
+    key.animation_set = &animation_set;
+    key.skinning_mode = skinning_mode;
+    key.clip[0] = clip_a;
+    key.clip[1] = clip_b;
+    key.frame_bucket[0] = FrameBucket(frame_a);
+    key.frame_bucket[1] = FrameBucket(frame_b);
+    key.weight_bucket = (int)(max(0.0f, min(1.0f, weight)) * kWeightBuckets + 0.5f);
+
+    unsigned hash = (unsigned)djb2_hash_len((unsigned char*)&key, sizeof(key));
+    int slot = hash % kHashTableSize;
+    while(hash_table[slot] != -1){
+        int pose = hash_table[slot];
+        if(memcmp(&keys[pose], &key, sizeof(key)) == 0){
+            return pose;
+        }
+        slot = (slot + 1) % kHashTableSize;
+    }
+
+    SDL_assert(animation_set.num_bones <= kMaxBones);
+    int num_texels = animation_set.num_bones * GetPaletteTexelsPerBone(skinning_mode);
+    if(num_poses == kMaxPoses || 
+       num_palette_texels + num_texels > kMaxPaletteTexels)
+    {
+        SDL_assert(false); // More distinct poses than we have room for
+        return num_poses - 1;
+    }
+
+    // Sample at the bucket values rather than the requested ones, so every
+    // character sharing this pose gets an identical result
+    int pose = num_poses++;
+    keys[pose] = key;
+    palette_start[pose] = num_palette_texels;
+    num_palette_texels += num_texels;
+    hash_table[slot] = pose;
+    SeparableTransform pose_a[kMaxBones];
+    SeparableTransform pose_b[kMaxBones];
+    SeparableTransform blended[kMaxBones];
+    SampleAnimation(animation_set, clip_a, key.frame_bucket[0] / (float)kFrameBuckets, pose_a);
+    SampleAnimation(animation_set, clip_b, key.frame_bucket[1] / (float)kFrameBuckets, pose_b);
+    BlendPoses(pose_a, pose_b, key.weight_bucket / (float)kWeightBuckets,
+               animation_set.num_bones, blended);
+    vec4* palette = &palettes[palette_start[pose]];
+    switch(skinning_mode){
+    case kMatrixSkinning:
+        GetSkinningMatrices(animation_set, blended, (mat4*)palette);
+        break;
+    case kDualQuaternionSkinning: {
+        mat4 bone_mats[kMaxBones];
+        GetSkinningMatrices(animation_set, blended, bone_mats);
+        GetSkinningDualQuaternions(bone_mats, animation_set.num_bones, palette);
+        } break;
+    }
+    return pose;
+}
+
+const vec4* PoseCache::GetPalette(int pose) const {
+    SDL_assert(pose >= 0 && pose < num_poses);
+    return &palettes[palette_start[pose]];
+}
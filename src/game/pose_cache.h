@@ -0,0 +1,46 @@
+#pragma once
+#ifndef GAME_POSE_CACHE_H
+#define GAME_POSE_CACHE_H
+
+#include "glm/fwd.hpp"
+#include "game/animation.h"
+
+struct PoseCacheKey {
+    const AnimationSet* animation_set;
+    SkinningMode skinning_mode;
+    int clip[2];
+    int frame_bucket[2];
+    int weight_bucket;
+};
+
+// Skinning palettes for this frame, shared between every character whose
+// sample times fall in the same bucket. Palettes are in model space, so the
+// instance transform still needs to be applied on top. They are packed
+// back to back as vec4 texels so the whole set can be uploaded in one go.
+class PoseCache {
+public:
+    static const int kMaxPoses = 128;
+    static const int kMaxBones = 128;
+    static const int kMaxPaletteTexels = kMaxPoses * kMaxBones * 4;
+    static const int kFrameBuckets = 4; // Buckets per source frame
+    static const int kWeightBuckets = 8;
+    int num_poses;
+    int num_requests;
+    PoseCacheKey keys[kMaxPoses];
+    int palette_start[kMaxPoses]; // Texel index into palettes
+    int num_palette_texels;
+    glm::vec4* palettes;
+
+    int AllocMemory(void* memory);
+    void Clear();
+    // Returns index of the palette for this blend of two clips
+    int GetPose(const AnimationSet& animation_set, SkinningMode skinning_mode,
+                int clip_a, float frame_a, int clip_b, float frame_b, float weight);
+    const glm::vec4* GetPalette(int pose) const;
+
+private:
+    static const int kHashTableSize = kMaxPoses * 2;
+    int hash_table[kHashTableSize];
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "game/render_queue.h"
+#include "internal/common.h"
+#include "SDL.h"
+#include <cstring>
+
+uint64_t MakeSortKey(RenderPass pass, int shader, int texture, int vbo, float depth_01) {
+    uint64_t depth_bits = (uint64_t)(max(0.0f, min(1.0f, depth_01)) * 65535.0f);
+    return ((uint64_t)(pass & 0xF) << 60) |
+           ((uint64_t)(shader & 0xFFF) << 48) |
+           ((uint64_t)(texture & 0xFFFF) << 32) |
+           ((uint64_t)(vbo & 0xFFFF) << 16) |
+           depth_bits;
+}
+
+void RenderQueue::Clear() {
+    num_items = 0;
+}
+
+void RenderQueue::Add(uint64_t key, int index) {
+    if(num_items < kMaxItems){
+        items[num_items].key = key;
+        items[num_items].index = index;
+        ++num_items;
+    } else {
+        SDL_assert(false);
+    }
+}
+
+void RenderQueue::Sort() {
+    static const int kNumPasses = 8; // One per byte of key
+    static const int kRadix = 256;
+    int histograms[kNumPasses][kRadix];
+    memset(histograms, 0, sizeof(histograms));
+    for(int i=0; i<num_items; ++i){
+        uint64_t key = items[i].key;
+        for(int pass=0; pass<kNumPasses; ++pass){
+            ++histograms[pass][(key >> (pass*8)) & 0xFF];
+        }
+    }
+    RenderQueueItem* src = items;
+    RenderQueueItem* dst = temp_items;
+    for(int pass=0; pass<kNumPasses; ++pass){
+        int* histogram = histograms[pass];
+        // Skip bytes that are the same for every item, which is most of them
+        if(num_items == 0 || histogram[(src[0].key >> (pass*8)) & 0xFF] == num_items){
+            continue;
+        }
+        int offset = 0;
+        for(int i=0; i<kRadix; ++i){
+            int count = histogram[i];
+            histogram[i] = offset;
+            offset += count;
+        }
+        for(int i=0; i<num_items; ++i){
+            int bucket = (src[i].key >> (pass*8)) & 0xFF;
+            dst[histogram[bucket]++] = src[i];
+        }
+        RenderQueueItem* temp = src;
+        src = dst;
+        dst = temp;
+    }
+    if(src != items){
+        memcpy(items, src, sizeof(RenderQueueItem) * num_items);
+    }
+}
+
+void DrawStats::Clear() {
+    draw_calls = 0;
+    program_binds = 0;
+    texture_binds = 0;
+    vertex_array_binds = 0;
+    redundant_binds_skipped = 0;
+    visible_drawables = 0;
+    culled_drawables = 0;
+    occluded_drawables = 0;
+    triangles = 0;
+}
+
+void DrawStats::Add(const DrawStats& other) {
+    draw_calls += other.draw_calls;
+    program_binds += other.program_binds;
+    texture_binds += other.texture_binds;
+    vertex_array_binds += other.vertex_array_binds;
+    redundant_binds_skipped += other.redundant_binds_skipped;
+    visible_drawables += other.visible_drawables;
+    culled_drawables += other.culled_drawables;
+    occluded_drawables += other.occluded_drawables;
+    triangles += other.triangles;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#ifndef GAME_RENDER_QUEUE_H
+#define GAME_RENDER_QUEUE_H
+
+#include <stdint.h>
+
+enum RenderPass {
+    kOpaquePass = 0,
+    kNumRenderPasses
+};
+
+// Sort key layout, most significant first:
+// 4 bits pass | 12 bits shader | 16 bits texture | 16 bits vbo | 16 bits depth
+// Ids are masked to fit, so a collision only affects ordering, not
+// correctness; submission still compares the real state.
+uint64_t MakeSortKey(RenderPass pass, int shader, int texture, int vbo, float depth_01);
+
+struct RenderQueueItem {
+    uint64_t key;
+    int index;
+};
+
+class RenderQueue {
+public:
+    static const int kMaxItems = 2048;
+    int num_items;
+    RenderQueueItem items[kMaxItems];
+
+    void Clear();
+    void Add(uint64_t key, int index);
+    void Sort(); // LSD radix sort, stable
+
+private:
+    RenderQueueItem temp_items[kMaxItems];
+};
+
+// Per-frame counters to see how much state changing the queue saves
+struct DrawStats {
+    int draw_calls;
+    int program_binds;
+    int texture_binds;
+    int vertex_array_binds;
+    int redundant_binds_skipped;
+    int visible_drawables;
+    int culled_drawables;
+    int occluded_drawables; // Also counted in culled_drawables
+    int triangles;
+    void Clear();
+    void Add(const DrawStats& other);
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "game/tile_map.h"
+#include "game/game_state.h"
+#include "internal/separable_transform.h"
+#include "glm/gtc/quaternion.hpp"
+#include "glm/gtc/constants.hpp"
+#include "SDL.h"
+#include <cfloat>
+#include <cstdlib>
+
+using namespace glm;
+
+enum TileRotation {
+    kRotate0,
+    kRotate90,
+    kRotate180,
+    kRotate270
+};
+
+// Pieces pivot on a tile corner, so rotating also has to shift them back 
+// into the tile
+static mat4 GetTileTransform(vec3 translation, TileRotation rotation) {
+    SeparableTransform transform;
+    switch(rotation){
+    case kRotate0:
+        transform.translation = translation;
+        break;
+    case kRotate90:
+        transform.translation = translation + vec3(-2,0,0);
+        transform.rotation = angleAxis(half_pi<float>(), vec3(0,1,0));
+        break;
+    case kRotate180:
+        transform.translation = translation + vec3(-2,0,2);
+        transform.rotation = angleAxis(pi<float>(), vec3(0,1,0));
+        break;
+    case kRotate270:
+        transform.translation = translation + vec3(0,0,2);
+        transform.rotation = angleAxis(-half_pi<float>(), vec3(0,1,0));
+        break;
+    }
+    return transform.GetCombination();
+}
+
+TilePiece GetTilePiece(const int* tile_height, int map_size, int x, int z) {
+    const int* row = &tile_height[z*map_size];
+    int height = row[x];
+    bool has_left = x>0, has_right = x<map_size-1;
+    bool has_back = z>0, has_front = z<map_size-1;
+    vec3 translation(x*2,height*2,z*2);
+    TilePiece piece;
+    // Check nooks
+    if(has_right && has_front && height < row[x+1] && height < row[x+map_size]){
+        piece.type = kTileNook;
+        piece.transform = GetTileTransform(translation, kRotate270);
+    } else if(has_left && has_back && height < row[x-1] && height < row[x-map_size]){
+        piece.type = kTileNook;
+        piece.transform = GetTileTransform(translation, kRotate90);
+    } else if(has_left && has_front && height < row[x-1] && height < row[x+map_size]){
+        piece.type = kTileNook;
+        piece.transform = GetTileTransform(translation, kRotate180);
+    } else if(has_right && has_back && height < row[x+1] && height < row[x-map_size]){
+        piece.type = kTileNook;
+        piece.transform = GetTileTransform(translation, kRotate0);
+    } 
+    // Check walls
+    else if(has_right && height < row[x+1]){
+        piece.type = kTileWall;
+        piece.transform = GetTileTransform(translation, kRotate0);
+    } else if(has_left && height < row[x-1]){
+        piece.type = kTileWall;
+        piece.transform = GetTileTransform(translation, kRotate180);
+    } else if(has_back && height < row[x-map_size]){
+        piece.type = kTileWall;
+        piece.transform = GetTileTransform(translation, kRotate90);
+    } else if(has_front && height < row[x+map_size]){
+        piece.type = kTileWall;
+        piece.transform = GetTileTransform(translation, kRotate270);
+    }
+    // Check corners 
+    else if(has_right && has_front && height < row[x+map_size+1]){
+        piece.type = kTileCorner;
+        piece.transform = GetTileTransform(translation, kRotate270);
+    } else if(has_left && has_back && height < row[x-map_size-1]){
+        piece.type = kTileCorner;
+        piece.transform = GetTileTransform(translation, kRotate90);
+    } else if(has_left && has_front && height < row[x+map_size-1]){
+        piece.type = kTileCorner;
+        piece.transform = GetTileTransform(translation, kRotate180);
+    } else if(has_right && has_back && height < row[x-map_size+1]){
+        piece.type = kTileCorner;
+        piece.transform = GetTileTransform(translation, kRotate0);
+    } // Basic floor
+    else {
+        piece.type = kTileFloor;
+        piece.transform = GetTileTransform(translation, kRotate0);
+    }
+    return piece;
+}
+
+void BuildTileChunk(TileChunk* chunk, int chunk_x, int chunk_z, int chunk_size, 
+                    const int* tile_height, int map_size, const MeshAsset* piece_meshes,
+                    const int* piece_layers)
+{
+    static const int kFloatsPerVert = 8; // 3v 2t 3n
+    // Plus the layer when every type shares a batch
+    int out_floats_per_vert = piece_layers ? kFloatsPerVert + 1 : kFloatsPerVert;
+    SDL_assert(chunk->num_batches == (piece_layers ? 1 : kNumTilePieceTypes));
+    int start_x = chunk_x * chunk_size;
+    int start_z = chunk_z * chunk_size;
+    int num_verts[kNumTilePieceTypes] = {0};
+    for(int z=start_z; z<start_z+chunk_size; ++z){
+        for(int x=start_x; x<start_x+chunk_size; ++x){
+            TilePieceType type = GetTilePiece(tile_height, map_size, x, z).type;
+            SDL_assert(piece_meshes[type].verts);
+            num_verts[piece_layers ? 0 : type] += piece_meshes[type].num_index;
+        }
+    }
+    float* verts[kNumTilePieceTypes];
+    int vert_count[kNumTilePieceTypes] = {0};
+    for(int batch=0; batch<chunk->num_batches; ++batch){
+        verts[batch] = (float*)malloc(sizeof(float) * out_floats_per_vert * num_verts[batch]);
+    }
+    vec3 bb_min(FLT_MAX), bb_max(-FLT_MAX);
+    for(int z=start_z; z<start_z+chunk_size; ++z){
+        for(int x=start_x; x<start_x+chunk_size; ++x){
+            TilePiece piece = GetTilePiece(tile_height, map_size, x, z);
+            const MeshAsset& mesh = piece_meshes[piece.type];
+            int batch = piece_layers ? 0 : piece.type;
+            mat3 normal_mat = mat3(piece.transform);
+            for(int i=0; i<mesh.num_index; ++i){
+                const float* src = &mesh.verts[i*kFloatsPerVert];
+                float* dst = &verts[batch][vert_count[batch]++ * out_floats_per_vert];
+                vec3 pos = vec3(piece.transform * vec4(src[0], src[1], src[2], 1.0f));
+                vec3 normal = normal_mat * vec3(src[5], src[6], src[7]);
+                bb_min = min(bb_min, pos);
+                bb_max = max(bb_max, pos);
+                dst[0] = pos[0]; dst[1] = pos[1]; dst[2] = pos[2];
+                dst[3] = src[3]; dst[4] = src[4];
+                dst[5] = normal[0]; dst[6] = normal[1]; dst[7] = normal[2];
+                if(piece_layers){
+                    dst[8] = (float)piece_layers[piece.type];
+                }
+            }
+        }
+    }
+    chunk->bounding_box[0] = bb_min;
+    chunk->bounding_box[1] = bb_max;
+    for(int batch_index=0; batch_index<chunk->num_batches; ++batch_index){
+        TileChunkBatch& batch = chunk->batches[batch_index];
+        int count = num_verts[batch_index];
+        // Verts are unshared, so indices are just consecutive
+        Uint32* indices = (Uint32*)malloc(sizeof(Uint32) * count);
+        for(int i=0; i<count; ++i){
+            indices[i] = i;
+        }
+        UpdateVBO(kArrayVBO, kStaticVBO, batch.vert_vbo, verts[batch_index], 
+                  sizeof(float) * out_floats_per_vert * count);
+        UpdateVBO(kElementVBO, kStaticVBO, batch.index_vbo, indices, 
+                  sizeof(Uint32) * count);
+        batch.num_indices = count;
+        free(indices);
+        free(verts[batch_index]);
+    }
+    chunk->dirty = false;
+}
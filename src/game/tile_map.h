@@ -0,0 +1,51 @@
+#pragma once
+#ifndef GAME_TILE_MAP_H
+#define GAME_TILE_MAP_H
+
+#include "glm/glm.hpp"
+
+struct MeshAsset;
+
+enum TilePieceType {
+    kTileFloor,
+    kTileWall,
+    kTileNook,
+    kTileCorner,
+    kNumTilePieceTypes
+};
+
+struct TilePiece {
+    TilePieceType type;
+    glm::mat4 transform;
+};
+
+// Picks the mesh and orientation for a cell from the heights around it
+TilePiece GetTilePiece(const int* tile_height, int map_size, int x, int z);
+
+// One merged vertex/index buffer, drawn in one call
+struct TileChunkBatch {
+    int vert_vbo;
+    int index_vbo;
+    int num_indices;
+    int drawable;
+};
+
+// With the piece textures in an array, every piece type shares the first
+// batch and each vert carries its layer (kInterleave_3V2T3N1L). Otherwise
+// there is a batch per piece type, so one texture each (kInterleave_3V2T3N).
+struct TileChunk {
+    TileChunkBatch batches[kNumTilePieceTypes];
+    int num_batches;
+    glm::vec3 bounding_box[2];
+    bool dirty;
+};
+
+// Transforms every piece in the chunk into world space and uploads the 
+// result to the chunk's buffers, which must already exist. Piece meshes
+// need their CPU vertex copy (MeshAsset::verts). piece_layers gives the
+// texture array layer of each piece type, or is NULL for separate textures.
+void BuildTileChunk(TileChunk* chunk, int chunk_x, int chunk_z, int chunk_size, 
+                    const int* tile_height, int map_size, const MeshAsset* piece_meshes,
+                    const int* piece_layers);
+
+#endif
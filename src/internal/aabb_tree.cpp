@@ -0,0 +1,365 @@
+#include "internal/aabb_tree.h"
+#include "internal/frustum.h"
+#include "platform_sdl/error.h"
+#include "SDL.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+using namespace glm;
+
+const float AABBTree::kFatMargin = 0.5f;
+// Fat bounds bigger than this past the tight bounds are refit on move, 
+// so objects that shrink don't keep stale huge boxes
+static const float kMaxFatSlack = AABBTree::kFatMargin * 4.0f;
+
+static float SurfaceArea(const vec3* bounds) {
+    vec3 size = bounds[1] - bounds[0];
+    return 2.0f * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+static void Combine(const vec3* a, const vec3* b, vec3* combined) {
+    combined[0] = min(a[0], b[0]);
+    combined[1] = max(a[1], b[1]);
+}
+
+static bool Overlaps(const vec3* a, const vec3* b) {
+    for(int k=0; k<3; ++k){
+        if(a[1][k] < b[0][k] || b[1][k] < a[0][k]){
+            return false;
+        }
+    }
+    return true;
+}
+
+void AABBTree::Init() {
+    node_capacity = 16;
+    nodes = (Node*)malloc(sizeof(Node) * node_capacity);
+    for(int i=0; i<node_capacity; ++i){
+        nodes[i].parent = (i == node_capacity-1)?kNullNode:i+1;
+        nodes[i].height = -1;
+    }
+    free_list = 0;
+    root = kNullNode;
+}
+
+void AABBTree::Dispose() {
+    free(nodes);
+    nodes = NULL;
+}
+
+AABBTree::~AABBTree() {
+    SDL_assert(nodes == NULL);
+}
+
+int AABBTree::AllocNode() {
+    if(free_list == kNullNode){
+        int old_capacity = node_capacity;
+        node_capacity *= 2;
+        nodes = (Node*)realloc(nodes, sizeof(Node) * node_capacity);
+        if(!nodes){
+            FormattedError("Out of memory", "Could not grow AABB tree to %d nodes", node_capacity);
+            exit(1);
+        }
+        for(int i=old_capacity; i<node_capacity; ++i){
+            nodes[i].parent = (i == node_capacity-1)?kNullNode:i+1;
+            nodes[i].height = -1;
+        }
+        free_list = old_capacity;
+    }
+    int node = free_list;
+    free_list = nodes[node].parent;
+    nodes[node].parent = kNullNode;
+    nodes[node].child[0] = kNullNode;
+    nodes[node].child[1] = kNullNode;
+    nodes[node].height = 0;
+    nodes[node].user_data = -1;
+    return node;
+}
+
+void AABBTree::FreeNode(int node) {
+    nodes[node].parent = free_list;
+    nodes[node].height = -1;
+    free_list = node;
+}
+
+void AABBTree::UpdateNode(int node) {
+    Node& n = nodes[node];
+    const Node& child_0 = nodes[n.child[0]];
+    const Node& child_1 = nodes[n.child[1]];
+    n.height = 1 + max(child_0.height, child_1.height);
+    Combine(child_0.bounds, child_1.bounds, n.bounds);
+}
+
+// Cost of making leaf a sibling of node, ignoring what is paid higher up
+static float GetSiblingCost(const vec3* leaf_bounds, const vec3* node_bounds, bool node_is_leaf) {
+    vec3 combined[2];
+    Combine(leaf_bounds, node_bounds, combined);
+    float cost = SurfaceArea(combined);
+    if(!node_is_leaf){
+        cost -= SurfaceArea(node_bounds);
+    }
+    return cost;
+}
+
+void AABBTree::InsertLeaf(int leaf) {
+    if(root == kNullNode){
+        root = leaf;
+        nodes[root].parent = kNullNode;
+        return;
+    }
+    // Walk down picking the child that grows the least, by surface area
+    vec3 leaf_bounds[2] = {nodes[leaf].bounds[0], nodes[leaf].bounds[1]};
+    int index = root;
+    while(!nodes[index].IsLeaf()){
+        const Node& node = nodes[index];
+        vec3 combined[2];
+        Combine(node.bounds, leaf_bounds, combined);
+        float combined_area = SurfaceArea(combined);
+        // Cost of a new parent for this node and the leaf
+        float cost = 2.0f * combined_area;
+        // Minimum cost of pushing the leaf further down
+        float inheritance_cost = 2.0f * (combined_area - SurfaceArea(node.bounds));
+        const Node& child_0 = nodes[node.child[0]];
+        const Node& child_1 = nodes[node.child[1]];
+        float cost_0 = GetSiblingCost(leaf_bounds, child_0.bounds, child_0.IsLeaf()) + inheritance_cost;
+        float cost_1 = GetSiblingCost(leaf_bounds, child_1.bounds, child_1.IsLeaf()) + inheritance_cost;
+        if(cost < cost_0 && cost < cost_1){
+            break;
+        }
+        index = (cost_0 < cost_1)?node.child[0]:node.child[1];
+    }
+    int sibling = index;
+    int old_parent = nodes[sibling].parent;
+    int new_parent = AllocNode(); // Can move nodes, so no references held across this
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].child[0] = sibling;
+    nodes[new_parent].child[1] = leaf;
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+    if(old_parent != kNullNode){
+        Node& parent = nodes[old_parent];
+        parent.child[(parent.child[0] == sibling)?0:1] = new_parent;
+    } else {
+        root = new_parent;
+    }
+    for(index = new_parent; index != kNullNode; index = nodes[index].parent){
+        index = Balance(index);
+        UpdateNode(index);
+    }
+}
+
+void AABBTree::RemoveLeaf(int leaf) {
+    if(leaf == root){
+        root = kNullNode;
+        return;
+    }
+    int parent = nodes[leaf].parent;
+    int grand_parent = nodes[parent].parent;
+    int sibling = (nodes[parent].child[0] == leaf)?nodes[parent].child[1]:nodes[parent].child[0];
+    FreeNode(parent);
+    nodes[sibling].parent = grand_parent;
+    if(grand_parent == kNullNode){
+        root = sibling;
+        return;
+    }
+    Node& grand_parent_node = nodes[grand_parent];
+    grand_parent_node.child[(grand_parent_node.child[0] == parent)?0:1] = sibling;
+    for(int index = grand_parent; index != kNullNode; index = nodes[index].parent){
+        index = Balance(index);
+        UpdateNode(index);
+    }
+}
+
+// If one child of node_a is more than one level taller than the other, 
+// rotates its taller grandchild up in place of node_a. Returns the node 
+// now in node_a's place.
+int AABBTree::Balance(int node_a) {
+    Node& a = nodes[node_a];
+    if(a.IsLeaf() || a.height < 2){
+        return node_a;
+    }
+    int balance = nodes[a.child[1]].height - nodes[a.child[0]].height;
+    if(balance >= -1 && balance <= 1){
+        return node_a;
+    }
+    // Child that gets rotated up, and the one that stays under a
+    int up_side = (balance > 1)?1:0;
+    int node_up = a.child[up_side];
+    Node& up = nodes[node_up];
+    up.parent = a.parent;
+    a.parent = node_up;
+    if(up.parent != kNullNode){
+        Node& parent = nodes[up.parent];
+        parent.child[(parent.child[0] == node_a)?0:1] = node_up;
+    } else {
+        root = node_up;
+    }
+    // Taller grandchild stays with up, shorter one moves under a
+    int tall = up.child[0], small = up.child[1];
+    if(nodes[tall].height < nodes[small].height){
+        tall = up.child[1];
+        small = up.child[0];
+    }
+    up.child[0] = node_a;
+    up.child[1] = tall;
+    a.child[up_side] = small;
+    nodes[small].parent = node_a;
+    UpdateNode(node_a);
+    UpdateNode(node_up);
+    return node_up;
+}
+
+int AABBTree::CreateProxy(const vec3* bounds, int user_data) {
+    int proxy = AllocNode();
+    Node& node = nodes[proxy];
+    node.bounds[0] = bounds[0] - vec3(kFatMargin);
+    node.bounds[1] = bounds[1] + vec3(kFatMargin);
+    node.user_data = user_data;
+    InsertLeaf(proxy);
+    return proxy;
+}
+
+void AABBTree::DestroyProxy(int proxy) {
+    SDL_assert(proxy >= 0 && proxy < node_capacity && nodes[proxy].IsLeaf());
+    RemoveLeaf(proxy);
+    FreeNode(proxy);
+}
+
+bool AABBTree::MoveProxy(int proxy, const vec3* bounds) {
+    SDL_assert(proxy >= 0 && proxy < node_capacity && nodes[proxy].IsLeaf());
+    Node& node = nodes[proxy];
+    bool contained = true, too_loose = false;
+    for(int k=0; k<3; ++k){
+        contained = contained && node.bounds[0][k] <= bounds[0][k] && bounds[1][k] <= node.bounds[1][k];
+        too_loose = too_loose || bounds[0][k] - node.bounds[0][k] > kMaxFatSlack ||
+                                 node.bounds[1][k] - bounds[1][k] > kMaxFatSlack;
+    }
+    if(contained && !too_loose){
+        return false;
+    }
+    RemoveLeaf(proxy);
+    nodes[proxy].bounds[0] = bounds[0] - vec3(kFatMargin);
+    nodes[proxy].bounds[1] = bounds[1] + vec3(kFatMargin);
+    InsertLeaf(proxy);
+    return true;
+}
+
+int AABBTree::GetUserData(int proxy) const {
+    return nodes[proxy].user_data;
+}
+
+const vec3* AABBTree::GetFatBounds(int proxy) const {
+    return nodes[proxy].bounds;
+}
+
+int AABBTree::QueryFrustum(const Frustum& frustum, int* results, int max_results) const {
+    int num_results = 0;
+    int stack[kMaxQueryStack];
+    bool stack_inside[kMaxQueryStack]; // Parent was entirely inside, no need to test
+    int stack_size = 0;
+    if(root != kNullNode){
+        stack[stack_size] = root;
+        stack_inside[stack_size++] = false;
+    }
+    while(stack_size > 0 && num_results < max_results){
+        --stack_size;
+        const Node& node = nodes[stack[stack_size]];
+        bool inside = stack_inside[stack_size];
+        if(!inside){
+            vec3 center = (node.bounds[0] + node.bounds[1]) * 0.5f;
+            vec3 extent = (node.bounds[1] - node.bounds[0]) * 0.5f;
+            FrustumTestResult result = TestAABBAgainstFrustum(frustum, center, extent);
+            if(result == kOutsideFrustum){
+                continue;
+            }
+            inside = (result == kInsideFrustum);
+        }
+        if(node.IsLeaf()){
+            results[num_results++] = node.user_data;
+        } else {
+            SDL_assert(stack_size + 2 <= kMaxQueryStack);
+            for(int i=0; i<2; ++i){
+                stack[stack_size] = node.child[i];
+                stack_inside[stack_size++] = inside;
+            }
+        }
+    }
+    return num_results;
+}
+
+int AABBTree::QueryBox(const vec3* bounds, int* results, int max_results) const {
+    int num_results = 0;
+    int stack[kMaxQueryStack];
+    int stack_size = 0;
+    if(root != kNullNode){
+        stack[stack_size++] = root;
+    }
+    while(stack_size > 0 && num_results < max_results){
+        const Node& node = nodes[stack[--stack_size]];
+        if(!Overlaps(node.bounds, bounds)){
+            continue;
+        }
+        if(node.IsLeaf()){
+            results[num_results++] = node.user_data;
+        } else {
+            SDL_assert(stack_size + 2 <= kMaxQueryStack);
+            stack[stack_size++] = node.child[0];
+            stack[stack_size++] = node.child[1];
+        }
+    }
+    return num_results;
+}
+
+// Slab test
+static bool RayHitsAABB(const vec3& origin, const vec3& inv_dir, float max_t, const vec3* bounds) {
+    float t_min = 0.0f, t_max = max_t;
+    for(int k=0; k<3; ++k){
+        float t_0 = (bounds[0][k] - origin[k]) * inv_dir[k];
+        float t_1 = (bounds[1][k] - origin[k]) * inv_dir[k];
+        t_min = max(t_min, min(t_0, t_1));
+        t_max = min(t_max, max(t_0, t_1));
+    }
+    return t_min <= t_max;
+}
+
+float RayIntersectAABB(const vec3& origin, const vec3& dir, float max_t, const vec3* bounds) {
+    float t_min = 0.0f, t_max = max_t;
+    for(int k=0; k<3; ++k){
+        float inv_dir = (dir[k] != 0.0f)?1.0f/dir[k]:FLT_MAX;
+        float t_0 = (bounds[0][k] - origin[k]) * inv_dir;
+        float t_1 = (bounds[1][k] - origin[k]) * inv_dir;
+        t_min = max(t_min, min(t_0, t_1));
+        t_max = min(t_max, max(t_0, t_1));
+    }
+    return (t_min <= t_max)?t_min:-1.0f;
+}
+
+int AABBTree::QueryRay(const vec3& origin, const vec3& dir, float max_t, 
+                       int* results, int max_results) const 
+{
+    vec3 inv_dir;
+    for(int k=0; k<3; ++k){
+        inv_dir[k] = (dir[k] != 0.0f)?1.0f/dir[k]:FLT_MAX;
+    }
+    int num_results = 0;
+    int stack[kMaxQueryStack];
+    int stack_size = 0;
+    if(root != kNullNode){
+        stack[stack_size++] = root;
+    }
+    while(stack_size > 0 && num_results < max_results){
+        const Node& node = nodes[stack[--stack_size]];
+        if(!RayHitsAABB(origin, inv_dir, max_t, node.bounds)){
+            continue;
+        }
+        if(node.IsLeaf()){
+            results[num_results++] = node.user_data;
+        } else {
+            SDL_assert(stack_size + 2 <= kMaxQueryStack);
+            stack[stack_size++] = node.child[0];
+            stack[stack_size++] = node.child[1];
+        }
+    }
+    return num_results;
+}
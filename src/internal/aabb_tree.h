@@ -0,0 +1,65 @@
+#pragma once
+#ifndef INTERNAL_AABB_TREE_H
+#define INTERNAL_AABB_TREE_H
+
+#include "glm/glm.hpp"
+
+struct Frustum;
+
+// Dynamic bounding volume hierarchy. Leaves (proxies) store bounds grown
+// by kFatMargin, so objects can move a little without touching the tree.
+// Queries test fat bounds, so results are candidates to be checked
+// against tight bounds by the caller. Nodes live in a pool that grows as
+// needed, so proxy ids stay valid until destroyed.
+class AABBTree {
+public:
+    static const int kNullNode = -1;
+    static const float kFatMargin;
+
+    void Init();
+    void Dispose();
+    ~AABBTree();
+
+    // bounds are min and max. Returns proxy id.
+    int CreateProxy(const glm::vec3* bounds, int user_data);
+    void DestroyProxy(int proxy);
+    // Returns true if the proxy had to be reinserted
+    bool MoveProxy(int proxy, const glm::vec3* bounds);
+    int GetUserData(int proxy) const;
+    const glm::vec3* GetFatBounds(int proxy) const;
+
+    // Write up to max_results user data values, return number written
+    int QueryFrustum(const Frustum& frustum, int* results, int max_results) const;
+    int QueryBox(const glm::vec3* bounds, int* results, int max_results) const;
+    // Ray is origin + dir * t for t in [0, max_t]
+    int QueryRay(const glm::vec3& origin, const glm::vec3& dir, float max_t, 
+                 int* results, int max_results) const;
+
+private:
+    struct Node {
+        glm::vec3 bounds[2];
+        int parent; // Next free node when on free list
+        int child[2];
+        int height; // Leaves are 0, free nodes -1
+        int user_data;
+        bool IsLeaf() const { return child[0] == kNullNode; }
+    };
+    static const int kMaxQueryStack = 256;
+    Node* nodes;
+    int node_capacity;
+    int root;
+    int free_list;
+
+    int AllocNode();
+    void FreeNode(int node);
+    void InsertLeaf(int leaf);
+    void RemoveLeaf(int leaf);
+    int Balance(int node);
+    void UpdateNode(int node);
+};
+
+// Returns entry distance along the ray, or -1 if it misses within max_t
+float RayIntersectAABB(const glm::vec3& origin, const glm::vec3& dir, float max_t, 
+                       const glm::vec3* bounds);
+
+#endif
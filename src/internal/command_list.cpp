@@ -0,0 +1,44 @@
+#include "internal/command_list.h"
+#include "SDL.h"
+
+void CommandList::Clear() {
+    num_commands = 0;
+}
+
+Command* CommandList::Add(CommandType type) {
+    if(num_commands >= kMaxCommands){
+        SDL_assert(false);
+        return &overflow;
+    }
+    Command* command = &commands[num_commands++];
+    command->type = type;
+    return command;
+}
+
+void CommandList::UseProgram(int program) {
+    Add(kCommandUseProgram)->args[0] = program;
+}
+
+void CommandList::BindTexture(int unit, CommandTextureTarget target, int texture) {
+    Command* command = Add(kCommandBindTexture);
+    command->args[0] = unit;
+    command->args[1] = target;
+    command->args[2] = texture;
+}
+
+void CommandList::BindVertexArray(int vao) {
+    Add(kCommandBindVertexArray)->args[0] = vao;
+}
+
+void CommandList::SetUniformInt(int location, int value) {
+    Command* command = Add(kCommandSetUniformInt);
+    command->args[0] = location;
+    command->args[1] = value;
+}
+
+void CommandList::DrawIndexedInstanced(int num_indices, int first_index, int num_instances) {
+    Command* command = Add(kCommandDrawIndexedInstanced);
+    command->args[0] = num_indices;
+    command->args[1] = first_index;
+    command->args[2] = num_instances;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef INTERNAL_COMMAND_LIST_H
+#define INTERNAL_COMMAND_LIST_H
+
+// Draw commands recorded without touching the graphics API, so lists can
+// be filled on worker threads and replayed in order on the GL thread with
+// ExecuteCommandList. Ids are whatever the backend handed out.
+enum CommandType {
+    kCommandUseProgram,
+    kCommandBindTexture,
+    kCommandBindVertexArray,
+    kCommandSetUniformInt,
+    kCommandDrawIndexedInstanced
+};
+
+enum CommandTextureTarget {
+    kCommandTexture2D,
+    kCommandTexture2DArray,
+    kCommandTextureBuffer
+};
+
+struct Command {
+    CommandType type;
+    int args[4];
+};
+
+class CommandList {
+public:
+    static const int kMaxCommands = 4096;
+    int num_commands;
+    Command commands[kMaxCommands];
+
+    void Clear();
+    void UseProgram(int program);
+    void BindTexture(int unit, CommandTextureTarget target, int texture);
+    void BindVertexArray(int vao);
+    void SetUniformInt(int location, int value);
+    // Triangles from the bound vertex array, first_index counts indices
+    void DrawIndexedInstanced(int num_indices, int first_index, int num_instances);
+
+private:
+    Command overflow; // Written to and ignored when the list is full
+    Command* Add(CommandType type);
+};
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef INTERNAL_DDS_H
+#define INTERNAL_DDS_H
+
+#include <stdint.h>
+
+// The subset of DirectDraw Surface files we write with texture_compressor
+// and read in LoadImage: one 2D texture, DXT1 or DXT5, with mips stored
+// largest first straight after the header.
+
+#define DDS_FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+static const uint32_t kDDSMagic = DDS_FOURCC('D', 'D', 'S', ' ');
+static const uint32_t kDDSFourCCDXT1 = DDS_FOURCC('D', 'X', 'T', '1');
+static const uint32_t kDDSFourCCDXT5 = DDS_FOURCC('D', 'X', 'T', '5');
+
+enum DDSFlags {
+    kDDSFlagCaps = 0x1,
+    kDDSFlagHeight = 0x2,
+    kDDSFlagWidth = 0x4,
+    kDDSFlagPixelFormat = 0x1000,
+    kDDSFlagMipMapCount = 0x20000,
+    kDDSFlagLinearSize = 0x80000
+};
+
+enum DDSPixelFormatFlags {
+    kDDSPixelFormatFourCC = 0x4
+};
+
+enum DDSCaps {
+    kDDSCapsComplex = 0x8,
+    kDDSCapsTexture = 0x1000,
+    kDDSCapsMipMap = 0x400000
+};
+
+struct DDSPixelFormat {
+    uint32_t size; // 32
+    uint32_t flags;
+    uint32_t four_cc;
+    uint32_t rgb_bit_count;
+    uint32_t r_mask, g_mask, b_mask, a_mask;
+};
+
+// Follows the magic number
+struct DDSHeader {
+    uint32_t size; // 124
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitch_or_linear_size; // Bytes in the top level
+    uint32_t depth;
+    uint32_t mip_map_count;
+    uint32_t reserved1[11];
+    DDSPixelFormat pixel_format;
+    uint32_t caps, caps2, caps3, caps4;
+    uint32_t reserved2;
+};
+
+// Bytes in one level, in 4x4 blocks of 8 (DXT1) or 16 (DXT5) bytes
+inline int GetDXTLevelSize(int width, int height, int block_bytes) {
+    return ((width + 3) / 4) * ((height + 3) / 4) * block_bytes;
+}
+
+#endif
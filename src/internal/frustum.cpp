@@ -0,0 +1,163 @@
+#include "internal/frustum.h"
+#include "SDL.h"
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+using namespace glm;
+
+void ExtractFrustum(const mat4& proj_view_mat, Frustum* frustum) {
+    // Gribb/Hartmann: planes are sums and differences of the matrix rows
+    vec4 row[4];
+    for(int i=0; i<4; ++i){
+        row[i] = vec4(proj_view_mat[0][i], proj_view_mat[1][i], 
+                      proj_view_mat[2][i], proj_view_mat[3][i]);
+    }
+    frustum->planes[Frustum::kLeft] = row[3] + row[0];
+    frustum->planes[Frustum::kRight] = row[3] - row[0];
+    frustum->planes[Frustum::kBottom] = row[3] + row[1];
+    frustum->planes[Frustum::kTop] = row[3] - row[1];
+    frustum->planes[Frustum::kNear] = row[3] + row[2];
+    frustum->planes[Frustum::kFar] = row[3] - row[2];
+    for(int i=0; i<Frustum::kNumPlanes; ++i){
+        frustum->planes[i] /= length(vec3(frustum->planes[i]));
+    }
+}
+
+// Distance to the plane along its normal, plus how far the volume reaches
+// towards it. The volume is outside if that is still negative.
+static bool IsAABBVisible(const Frustum& frustum, const CullAABBs& boxes, int i) {
+    for(int p=0; p<Frustum::kNumPlanes; ++p){
+        const vec4& plane = frustum.planes[p];
+        float dist = plane[3];
+        float reach = 0.0f;
+        for(int k=0; k<3; ++k){
+            dist += plane[k] * boxes.center[k][i];
+            reach += fabsf(plane[k]) * boxes.extent[k][i];
+        }
+        if(dist + reach < 0.0f){
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool IsSphereVisible(const Frustum& frustum, const CullSpheres& spheres, int i) {
+    for(int p=0; p<Frustum::kNumPlanes; ++p){
+        const vec4& plane = frustum.planes[p];
+        float dist = plane[3];
+        for(int k=0; k<3; ++k){
+            dist += plane[k] * spheres.center[k][i];
+        }
+        if(dist + spheres.radius[i] < 0.0f){
+            return false;
+        }
+    }
+    return true;
+}
+
+int CullAABBsAgainstFrustum(const Frustum& frustum, const CullAABBs& boxes, 
+                            int num_boxes, bool* visible)
+{
+    int num_visible = 0;
+    int i = 0;
+#ifdef FRUSTUM_SSE
+    for(; i+4<=num_boxes; i+=4){
+        __m128 center[3], extent[3];
+        for(int k=0; k<3; ++k){
+            center[k] = _mm_loadu_ps(&boxes.center[k][i]);
+            extent[k] = _mm_loadu_ps(&boxes.extent[k][i]);
+        }
+        __m128 outside = _mm_setzero_ps();
+        for(int p=0; p<Frustum::kNumPlanes; ++p){
+            const vec4& plane = frustum.planes[p];
+            __m128 dist = _mm_set1_ps(plane[3]);
+            __m128 reach = _mm_setzero_ps();
+            for(int k=0; k<3; ++k){
+                dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(plane[k]), center[k]));
+                reach = _mm_add_ps(reach, _mm_mul_ps(_mm_set1_ps(fabsf(plane[k])), extent[k]));
+            }
+            outside = _mm_or_ps(outside, 
+                _mm_cmplt_ps(_mm_add_ps(dist, reach), _mm_setzero_ps()));
+        }
+        int outside_bits = _mm_movemask_ps(outside);
+        for(int j=0; j<4; ++j){
+            visible[i+j] = (outside_bits & (1<<j)) == 0;
+            num_visible += visible[i+j];
+        }
+    }
+#endif
+    for(; i<num_boxes; ++i){
+        visible[i] = IsAABBVisible(frustum, boxes, i);
+        num_visible += visible[i];
+    }
+    return num_visible;
+}
+
+int CullSpheresAgainstFrustum(const Frustum& frustum, const CullSpheres& spheres, 
+                              int num_spheres, bool* visible)
+{
+    int num_visible = 0;
+    int i = 0;
+#ifdef FRUSTUM_SSE
+    for(; i+4<=num_spheres; i+=4){
+        __m128 center[3];
+        for(int k=0; k<3; ++k){
+            center[k] = _mm_loadu_ps(&spheres.center[k][i]);
+        }
+        __m128 radius = _mm_loadu_ps(&spheres.radius[i]);
+        __m128 outside = _mm_setzero_ps();
+        for(int p=0; p<Frustum::kNumPlanes; ++p){
+            const vec4& plane = frustum.planes[p];
+            __m128 dist = _mm_add_ps(_mm_set1_ps(plane[3]), radius);
+            for(int k=0; k<3; ++k){
+                dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(plane[k]), center[k]));
+            }
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, _mm_setzero_ps()));
+        }
+        int outside_bits = _mm_movemask_ps(outside);
+        for(int j=0; j<4; ++j){
+            visible[i+j] = (outside_bits & (1<<j)) == 0;
+            num_visible += visible[i+j];
+        }
+    }
+#endif
+    for(; i<num_spheres; ++i){
+        visible[i] = IsSphereVisible(frustum, spheres, i);
+        num_visible += visible[i];
+    }
+    return num_visible;
+}
+
+FrustumTestResult TestAABBAgainstFrustum(const Frustum& frustum, const vec3& center, 
+                                         const vec3& extent)
+{
+    FrustumTestResult result = kInsideFrustum;
+    for(int p=0; p<Frustum::kNumPlanes; ++p){
+        const vec4& plane = frustum.planes[p];
+        float dist = plane[3] + plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2];
+        float reach = fabsf(plane[0]) * extent[0] + fabsf(plane[1]) * extent[1] + 
+                      fabsf(plane[2]) * extent[2];
+        if(dist + reach < 0.0f){
+            return kOutsideFrustum;
+        }
+        if(dist - reach < 0.0f){
+            result = kIntersectsFrustum;
+        }
+    }
+    return result;
+}
+
+void TransformAABB(const mat4& mat, const vec3* bounding_box, vec3* center, vec3* extent) {
+    vec3 local_center = (bounding_box[0] + bounding_box[1]) * 0.5f;
+    vec3 local_extent = (bounding_box[1] - bounding_box[0]) * 0.5f;
+    *center = vec3(mat * vec4(local_center, 1.0f));
+    for(int k=0; k<3; ++k){
+        (*extent)[k] = fabsf(mat[0][k]) * local_extent[0] + 
+                       fabsf(mat[1][k]) * local_extent[1] + 
+                       fabsf(mat[2][k]) * local_extent[2];
+    }
+}
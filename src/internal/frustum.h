@@ -0,0 +1,48 @@
+#pragma once
+#ifndef INTERNAL_FRUSTUM_H
+#define INTERNAL_FRUSTUM_H
+
+#include "glm/glm.hpp"
+
+// Planes point inwards: dot(plane, vec4(p, 1)) >= 0 for points inside
+struct Frustum {
+    enum {kLeft, kRight, kBottom, kTop, kNear, kFar, kNumPlanes};
+    glm::vec4 planes[kNumPlanes];
+};
+
+void ExtractFrustum(const glm::mat4& proj_view_mat, Frustum* frustum);
+
+// Bounds in structure-of-arrays form so four can be tested per SSE op
+struct CullAABBs {
+    float* center[3];
+    float* extent[3]; // Half size
+};
+
+struct CullSpheres {
+    float* center[3];
+    float* radius;
+};
+
+// Writes whether each volume may be visible, returns number visible. 
+// Tests are conservative, volumes near frustum corners can pass.
+int CullAABBsAgainstFrustum(const Frustum& frustum, const CullAABBs& boxes, 
+                            int num_boxes, bool* visible);
+int CullSpheresAgainstFrustum(const Frustum& frustum, const CullSpheres& spheres, 
+                              int num_spheres, bool* visible);
+
+enum FrustumTestResult {
+    kOutsideFrustum,
+    kIntersectsFrustum,
+    kInsideFrustum
+};
+
+// Single box test for hierarchies, which can skip children that are
+// entirely inside
+FrustumTestResult TestAABBAgainstFrustum(const Frustum& frustum, const glm::vec3& center, 
+                                         const glm::vec3& extent);
+
+// World space AABB of a transformed local AABB, as center and half size
+void TransformAABB(const glm::mat4& mat, const glm::vec3* bounding_box, 
+                   glm::vec3* center, glm::vec3* extent);
+
+#endif
@@ -0,0 +1,119 @@
+#include "internal/light_grid.h"
+#include "internal/common.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace glm;
+
+int LightGrid::GetSlice(float depth) const {
+    float t = logf(depth / near_plane) / logf(far_plane / near_plane);
+    return max(0, min(kSlices - 1, (int)floorf(t * kSlices)));
+}
+
+vec4 LightGrid::GetClusterParams(int screen_width, int screen_height, 
+                                 float near_plane, float far_plane) 
+{
+    float scale = kSlices / logf(far_plane / near_plane);
+    return vec4(kTilesX / (float)screen_width, kTilesY / (float)screen_height, 
+                scale, -logf(near_plane) * scale);
+}
+
+// Screen tiles covered by a view space box in front of the near plane,
+// from the projections of its corners. Returns false if it is off screen.
+static bool GetTileRange(const mat4& proj_mat, const vec3& box_min, const vec3& box_max, 
+                         int* range) 
+{
+    vec2 ndc_min(FLT_MAX), ndc_max(-FLT_MAX);
+    for(int i=0; i<8; ++i){
+        vec3 corner((i&1) ? box_max[0] : box_min[0], 
+                    (i&2) ? box_max[1] : box_min[1], 
+                    (i&4) ? box_max[2] : box_min[2]);
+        vec4 clip = proj_mat * vec4(corner, 1.0f);
+        vec2 ndc = vec2(clip) / clip[3];
+        ndc_min = min(ndc_min, ndc);
+        ndc_max = max(ndc_max, ndc);
+    }
+    if(ndc_max[0] < -1.0f || ndc_min[0] > 1.0f || ndc_max[1] < -1.0f || ndc_min[1] > 1.0f){
+        return false;
+    }
+    static const int kTiles[] = {LightGrid::kTilesX, LightGrid::kTilesY};
+    for(int axis=0; axis<2; ++axis){
+        float tile_min = (ndc_min[axis] * 0.5f + 0.5f) * kTiles[axis];
+        float tile_max = (ndc_max[axis] * 0.5f + 0.5f) * kTiles[axis];
+        range[axis*2+0] = max(0, (int)floorf(tile_min));
+        range[axis*2+1] = min(kTiles[axis] - 1, (int)floorf(tile_max));
+    }
+    return true;
+}
+
+void LightGrid::Build(const PointLight* lights, int num_lights, const mat4& view_mat, 
+                      const mat4& proj_mat, float near_plane, float far_plane) 
+{
+    this->near_plane = near_plane;
+    this->far_plane = far_plane;
+    this->num_lights = min(num_lights, kMaxLights);
+    memset(cluster_counts, 0, sizeof(cluster_counts));
+
+    // Find the clusters each light touches and count them
+    for(int i=0; i<this->num_lights; ++i){
+        const PointLight& light = lights[i];
+        vec3 view_pos = vec3(view_mat * vec4(light.position, 1.0f));
+        light_texels[i*2+0] = vec4(view_pos, light.radius);
+        light_texels[i*2+1] = vec4(light.color, 0.0f);
+        int* range = light_ranges[i];
+        range[0] = 0;
+        range[1] = -1;
+        float depth = -view_pos[2];
+        if(depth + light.radius < near_plane || depth - light.radius > far_plane){
+            continue;
+        }
+        // Clamp to the near plane so the projection stays in front of the eye
+        vec3 box_min = view_pos - vec3(light.radius);
+        vec3 box_max = view_pos + vec3(light.radius);
+        box_max[2] = min(box_max[2], -near_plane);
+        if(!GetTileRange(proj_mat, box_min, box_max, range)){
+            continue;
+        }
+        range[4] = GetSlice(max(near_plane, depth - light.radius));
+        range[5] = GetSlice(min(far_plane, depth + light.radius));
+        for(int slice=range[4]; slice<=range[5]; ++slice){
+            for(int y=range[2]; y<=range[3]; ++y){
+                for(int x=range[0]; x<=range[1]; ++x){
+                    ++cluster_counts[(slice * kTilesY + y) * kTilesX + x];
+                }
+            }
+        }
+    }
+
+    // Lay the clusters out back to back, cutting off whatever doesn't fit
+    num_indices = 0;
+    num_dropped = 0;
+    for(int i=0; i<kNumClusters; ++i){
+        int count = min(cluster_counts[i], kMaxIndices - num_indices);
+        num_dropped += cluster_counts[i] - count;
+        cluster_texels[i] = vec4((float)num_indices, 0.0f, 0.0f, 0.0f);
+        cluster_counts[i] = count;
+        num_indices += count;
+    }
+
+    // Fill them in light order, using the count as the write cursor
+    for(int i=0; i<this->num_lights; ++i){
+        const int* range = light_ranges[i];
+        if(range[0] > range[1]){
+            continue;
+        }
+        for(int slice=range[4]; slice<=range[5]; ++slice){
+            for(int y=range[2]; y<=range[3]; ++y){
+                for(int x=range[0]; x<=range[1]; ++x){
+                    int cluster = (slice * kTilesY + y) * kTilesX + x;
+                    vec4& texel = cluster_texels[cluster];
+                    if((int)texel[1] < cluster_counts[cluster]){
+                        indices[(int)texel[0] + (int)texel[1]] = (float)i;
+                        texel[1] += 1.0f;
+                    }
+                }
+            }
+        }
+    }
+}
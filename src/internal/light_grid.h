@@ -0,0 +1,53 @@
+#pragma once
+#ifndef INTERNAL_LIGHT_GRID_H
+#define INTERNAL_LIGHT_GRID_H
+
+#include "glm/glm.hpp"
+
+struct PointLight {
+    glm::vec3 position;
+    float radius; // Falls off to nothing here
+    glm::vec3 color;
+};
+
+// Lights binned into clusters for forward shading. The view frustum is
+// split into screen tiles, and each tile into slices spaced evenly in log
+// depth, so fragments only loop over the lights near them. Lights are 
+// binned by the view space box around their sphere, which is conservative.
+// Everything is laid out as RGBA32F texels ready for texture buffers.
+// Pure CPU, so it can be built on any thread.
+class LightGrid {
+public:
+    static const int kTilesX = 16;
+    static const int kTilesY = 9;
+    static const int kSlices = 24;
+    static const int kNumClusters = kTilesX * kTilesY * kSlices;
+    static const int kMaxLights = 256;
+    static const int kMaxIndices = 16384; // Light entries over all clusters
+
+    glm::vec4 light_texels[kMaxLights * 2]; // View space position and radius, then color
+    glm::vec4 cluster_texels[kNumClusters]; // First index and count, as floats
+    float indices[kMaxIndices]; // Four to a texel
+    int num_lights;
+    int num_indices;
+    int num_dropped; // Entries that didn't fit in kMaxIndices
+
+    // Lights past kMaxLights are ignored
+    void Build(const PointLight* lights, int num_lights, const glm::mat4& view_mat, 
+               const glm::mat4& proj_mat, float near_plane, float far_plane);
+    // For the shaders: tiles per pixel in xy, and the scale and bias that
+    // turn log view depth into a slice in zw
+    static glm::vec4 GetClusterParams(int screen_width, int screen_height, 
+                                      float near_plane, float far_plane);
+
+private:
+    float near_plane;
+    float far_plane;
+    // Scratch for the counting pass
+    int cluster_counts[kNumClusters];
+    int light_ranges[kMaxLights][6]; // Min and max tile x, y and slice; empty if min > max
+
+    int GetSlice(float depth) const;
+};
+
+#endif
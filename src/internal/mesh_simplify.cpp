@@ -0,0 +1,466 @@
+#include "internal/mesh_simplify.h"
+#include "internal/common.h"
+#include "glm/glm.hpp"
+#include "SDL.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace glm;
+
+// Boundary and seam planes count this much more than surface planes
+static const double kBoundaryWeight = 100.0;
+// Collapses may not turn a neighboring triangle further than this
+static const float kMinNormalDot = 0.2f;
+static const float kSeamUVEpsilon = 0.0001f;
+
+// Symmetric 4x4 matrix, upper triangle
+struct Quadric {
+    double m[10];
+};
+
+static void AddPlane(Quadric* q, const dvec3& normal, double d, double weight) {
+    double a = normal[0], b = normal[1], c = normal[2];
+    q->m[0] += weight*a*a; q->m[1] += weight*a*b; q->m[2] += weight*a*c; q->m[3] += weight*a*d;
+    q->m[4] += weight*b*b; q->m[5] += weight*b*c; q->m[6] += weight*b*d;
+    q->m[7] += weight*c*c; q->m[8] += weight*c*d;
+    q->m[9] += weight*d*d;
+}
+
+static void AddQuadric(Quadric* q, const Quadric& other) {
+    for(int i=0; i<10; ++i){
+        q->m[i] += other.m[i];
+    }
+}
+
+static double EvaluateQuadric(const Quadric& q, const Quadric& other, const vec3& pos) {
+    double m[10];
+    for(int i=0; i<10; ++i){
+        m[i] = q.m[i] + other.m[i];
+    }
+    double x = pos[0], y = pos[1], z = pos[2];
+    return m[0]*x*x + 2*m[1]*x*y + 2*m[2]*x*z + 2*m[3]*x +
+           m[4]*y*y + 2*m[5]*y*z + 2*m[6]*y +
+           m[7]*z*z + 2*m[8]*z + m[9];
+}
+
+struct Edge {
+    unsigned verts[2]; // Sorted
+    int tri;
+};
+
+static int EdgeSort(const void* a_ptr, const void* b_ptr) {
+    const Edge* a = (const Edge*)a_ptr;
+    const Edge* b = (const Edge*)b_ptr;
+    if(a->verts[0] != b->verts[0]){
+        return a->verts[0] < b->verts[0] ? -1 : 1;
+    }
+    if(a->verts[1] != b->verts[1]){
+        return a->verts[1] < b->verts[1] ? -1 : 1;
+    }
+    return 0;
+}
+
+static int FindCorner(const unsigned* tri_verts, unsigned vert) {
+    return (tri_verts[0] == vert) ? 0 : (tri_verts[1] == vert) ? 1 : 2;
+}
+
+struct Collapse {
+    double cost;
+    int from, to; // Vert from moves onto vert to
+    int from_version, to_version;
+};
+
+// Binary min heap on cost. Stale entries are left in and skipped when
+// popped by comparing vert versions.
+struct CollapseHeap {
+    Collapse* items;
+    int num_items;
+    int capacity;
+
+    void Push(const Collapse& collapse) {
+        if(num_items == capacity){
+            capacity *= 2;
+            items = (Collapse*)realloc(items, sizeof(Collapse) * capacity);
+        }
+        int index = num_items++;
+        while(index > 0){
+            int parent = (index-1)/2;
+            if(items[parent].cost <= collapse.cost){
+                break;
+            }
+            items[index] = items[parent];
+            index = parent;
+        }
+        items[index] = collapse;
+    }
+
+    Collapse Pop() {
+        Collapse top = items[0];
+        Collapse last = items[--num_items];
+        int index = 0;
+        while(true){
+            int child = index*2+1;
+            if(child >= num_items){
+                break;
+            }
+            if(child+1 < num_items && items[child+1].cost < items[child].cost){
+                ++child;
+            }
+            if(last.cost <= items[child].cost){
+                break;
+            }
+            items[index] = items[child];
+            index = child;
+        }
+        if(num_items > 0){
+            items[index] = last;
+        }
+        return top;
+    }
+};
+
+struct SimplifyState {
+    const float* vert_coords;
+    const float* tri_uvs; // 2 per source corner
+    unsigned* tris; // 3 per tri, updated as verts collapse
+    int* source_corners; // 3 per tri, where each corner's uvs come from
+    bool* tri_alive;
+    Quadric* quadrics; // Orders the collapses
+    // The same planes without kBoundaryWeight, so the error reported for a
+    // level is a real distance
+    Quadric* error_quadrics;
+    int* vert_version; // -1 once collapsed away
+    // Each vert has a linked list of triangle refs; collapsing a vert
+    // appends its list to the target's. Refs to dead triangles are skipped.
+    int* ref_tri;
+    int* ref_next;
+    int* vert_ref_head;
+    int* vert_ref_tail;
+    CollapseHeap heap;
+};
+
+static vec3 GetVert(const SimplifyState& state, int vert) {
+    return vec3(state.vert_coords[vert*3+0], state.vert_coords[vert*3+1], state.vert_coords[vert*3+2]);
+}
+
+static void PushCollapse(SimplifyState* state, int from, int to) {
+    Collapse collapse;
+    collapse.cost = max(0.0, EvaluateQuadric(state->quadrics[from], state->quadrics[to], GetVert(*state, to)));
+    collapse.from = from;
+    collapse.to = to;
+    collapse.from_version = state->vert_version[from];
+    collapse.to_version = state->vert_version[to];
+    state->heap.Push(collapse);
+}
+
+// Checks that moving from onto to does not fold any remaining triangle over
+static bool IsCollapseValid(const SimplifyState& state, int from, int to) {
+    vec3 to_pos = GetVert(state, to);
+    for(int ref=state.vert_ref_head[from]; ref!=-1; ref=state.ref_next[ref]){
+        int tri = state.ref_tri[ref];
+        const unsigned* verts = &state.tris[tri*3];
+        if(!state.tri_alive[tri] || verts[0] == (unsigned)to ||
+           verts[1] == (unsigned)to || verts[2] == (unsigned)to)
+        {
+            continue;
+        }
+        vec3 old_pos[3], new_pos[3];
+        for(int i=0; i<3; ++i){
+            old_pos[i] = GetVert(state, verts[i]);
+            new_pos[i] = (verts[i] == (unsigned)from) ? to_pos : old_pos[i];
+        }
+        vec3 old_normal = cross(old_pos[1] - old_pos[0], old_pos[2] - old_pos[0]);
+        vec3 new_normal = cross(new_pos[1] - new_pos[0], new_pos[2] - new_pos[0]);
+        float old_len = length(old_normal), new_len = length(new_normal);
+        if(new_len <= old_len * 0.0001f ||
+           dot(old_normal, new_normal) < kMinNormalDot * old_len * new_len)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool SameUVs(const float* tri_uvs, int corner_a, int corner_b) {
+    return fabsf(tri_uvs[corner_a*2+0] - tri_uvs[corner_b*2+0]) <= kSeamUVEpsilon &&
+           fabsf(tri_uvs[corner_a*2+1] - tri_uvs[corner_b*2+1]) <= kSeamUVEpsilon;
+}
+
+// Returns number of triangles removed
+static int ApplyCollapse(SimplifyState* state, int from, int to) {
+    // The triangles along the collapsed edge go away. Each one maps the uvs
+    // from had there to the uvs to had there, which is what surviving 
+    // corners on the same side of any seam should switch to.
+    static const int kMaxEdgeTris = 8;
+    int edge_from_corners[kMaxEdgeTris], edge_to_corners[kMaxEdgeTris];
+    int num_edge_tris = 0;
+    int removed = 0;
+    for(int ref=state->vert_ref_head[from]; ref!=-1; ref=state->ref_next[ref]){
+        int tri = state->ref_tri[ref];
+        const unsigned* verts = &state->tris[tri*3];
+        if(!state->tri_alive[tri] || (verts[0] != (unsigned)to && 
+           verts[1] != (unsigned)to && verts[2] != (unsigned)to))
+        {
+            continue;
+        }
+        if(num_edge_tris < kMaxEdgeTris){
+            const int* source_corners = &state->source_corners[tri*3];
+            edge_from_corners[num_edge_tris] = source_corners[FindCorner(verts, from)];
+            edge_to_corners[num_edge_tris] = source_corners[FindCorner(verts, to)];
+            ++num_edge_tris;
+        }
+        state->tri_alive[tri] = false;
+        ++removed;
+    }
+    for(int ref=state->vert_ref_head[from]; ref!=-1; ref=state->ref_next[ref]){
+        int tri = state->ref_tri[ref];
+        if(!state->tri_alive[tri]){
+            continue;
+        }
+        unsigned* verts = &state->tris[tri*3];
+        for(int i=0; i<3; ++i){
+            if(verts[i] != (unsigned)from){
+                continue;
+            }
+            verts[i] = to;
+            int* source_corner = &state->source_corners[tri*3+i];
+            for(int j=0; j<num_edge_tris; ++j){
+                if(j == num_edge_tris-1 || 
+                   SameUVs(state->tri_uvs, *source_corner, edge_from_corners[j]))
+                {
+                    *source_corner = edge_to_corners[j];
+                    break;
+                }
+            }
+        }
+    }
+    if(state->vert_ref_head[from] != -1){
+        if(state->vert_ref_head[to] == -1){
+            state->vert_ref_head[to] = state->vert_ref_head[from];
+        } else {
+            state->ref_next[state->vert_ref_tail[to]] = state->vert_ref_head[from];
+        }
+        state->vert_ref_tail[to] = state->vert_ref_tail[from];
+    }
+    AddQuadric(&state->quadrics[to], state->quadrics[from]);
+    AddQuadric(&state->error_quadrics[to], state->error_quadrics[from]);
+    state->vert_version[from] = -1;
+    ++state->vert_version[to];
+    // Edges around the merged vert all have new costs. Also drop refs to
+    // dead triangles here so lists don't keep growing.
+    int prev = -1;
+    for(int ref=state->vert_ref_head[to]; ref!=-1; ref=state->ref_next[ref]){
+        int tri = state->ref_tri[ref];
+        if(!state->tri_alive[tri]){
+            if(prev == -1){
+                state->vert_ref_head[to] = state->ref_next[ref];
+            } else {
+                state->ref_next[prev] = state->ref_next[ref];
+            }
+            continue;
+        }
+        prev = ref;
+        for(int i=0; i<3; ++i){
+            int other = state->tris[tri*3+i];
+            if(other != to){
+                PushCollapse(state, other, to);
+                PushCollapse(state, to, other);
+            }
+        }
+    }
+    state->vert_ref_tail[to] = prev;
+    return removed;
+}
+
+static void StoreLevel(const SimplifyState& state, int num_tris, int num_alive,
+                       double max_error, SimplifiedMesh* level)
+{
+    level->num_tris = num_alive;
+    level->source_corners = (int*)malloc(sizeof(int) * num_alive * 3);
+    level->indices = (unsigned*)malloc(sizeof(unsigned) * num_alive * 3);
+    level->error = (float)sqrt(max_error);
+    int index = 0;
+    for(int tri=0; tri<num_tris; ++tri){
+        if(state.tri_alive[tri]){
+            for(int i=0; i<3; ++i){
+                level->source_corners[index*3+i] = state.source_corners[tri*3+i];
+                level->indices[index*3+i] = state.tris[tri*3+i];
+            }
+            ++index;
+        }
+    }
+}
+
+int SimplifyMesh(const float* vert_coords, int num_verts, const unsigned* tri_indices,
+                 const float* tri_uvs, int num_tris, const int* target_tris,
+                 int num_targets, SimplifiedMesh* levels)
+{
+    SimplifyState state;
+    state.vert_coords = vert_coords;
+    state.tri_uvs = tri_uvs;
+    state.tris = (unsigned*)malloc(sizeof(unsigned) * num_tris * 3);
+    memcpy(state.tris, tri_indices, sizeof(unsigned) * num_tris * 3);
+    state.source_corners = (int*)malloc(sizeof(int) * num_tris * 3);
+    for(int corner=0; corner<num_tris*3; ++corner){
+        state.source_corners[corner] = corner;
+    }
+    state.tri_alive = (bool*)malloc(sizeof(bool) * num_tris);
+    state.quadrics = (Quadric*)calloc(num_verts, sizeof(Quadric));
+    state.error_quadrics = (Quadric*)calloc(num_verts, sizeof(Quadric));
+    state.vert_version = (int*)calloc(num_verts, sizeof(int));
+    state.ref_tri = (int*)malloc(sizeof(int) * num_tris * 3);
+    state.ref_next = (int*)malloc(sizeof(int) * num_tris * 3);
+    state.vert_ref_head = (int*)malloc(sizeof(int) * num_verts);
+    state.vert_ref_tail = (int*)malloc(sizeof(int) * num_verts);
+    for(int vert=0; vert<num_verts; ++vert){
+        state.vert_ref_head[vert] = -1;
+        state.vert_ref_tail[vert] = -1;
+    }
+
+    Edge* edges = (Edge*)malloc(sizeof(Edge) * num_tris * 3);
+    vec3* tri_normals = (vec3*)malloc(sizeof(vec3) * num_tris);
+    int num_alive = 0;
+    for(int tri=0; tri<num_tris; ++tri){
+        const unsigned* verts = &tri_indices[tri*3];
+        vec3 pos[3];
+        for(int i=0; i<3; ++i){
+            pos[i] = GetVert(state, verts[i]);
+        }
+        vec3 normal = cross(pos[1] - pos[0], pos[2] - pos[0]);
+        float len = length(normal);
+        tri_normals[tri] = (len > 0.0f) ? normal / len : vec3(0.0f);
+        state.tri_alive[tri] = len > 0.0f &&
+            verts[0] != verts[1] && verts[1] != verts[2] && verts[2] != verts[0];
+        if(state.tri_alive[tri]){
+            ++num_alive;
+            dvec3 plane_normal = dvec3(tri_normals[tri]);
+            double d = -dot(plane_normal, dvec3(pos[0]));
+            for(int i=0; i<3; ++i){
+                AddPlane(&state.quadrics[verts[i]], plane_normal, d, 1.0);
+                AddPlane(&state.error_quadrics[verts[i]], plane_normal, d, 1.0);
+            }
+        }
+        for(int i=0; i<3; ++i){
+            int ref = tri*3+i;
+            state.ref_tri[ref] = tri;
+            state.ref_next[ref] = -1;
+            int vert = verts[i];
+            if(state.vert_ref_head[vert] == -1){
+                state.vert_ref_head[vert] = ref;
+            } else {
+                state.ref_next[state.vert_ref_tail[vert]] = ref;
+            }
+            state.vert_ref_tail[vert] = ref;
+
+            Edge& edge = edges[ref];
+            unsigned a = verts[i], b = verts[(i+1)%3];
+            edge.verts[0] = min(a, b);
+            edge.verts[1] = max(a, b);
+            edge.tri = tri;
+        }
+    }
+
+    // Find boundary and seam edges, and queue every edge in both directions
+    qsort(edges, num_tris*3, sizeof(Edge), EdgeSort);
+    state.heap.capacity = max(16, num_tris * 6);
+    state.heap.items = (Collapse*)malloc(sizeof(Collapse) * state.heap.capacity);
+    state.heap.num_items = 0;
+    for(int first=0, end; first<num_tris*3; first=end){
+        end = first+1;
+        while(end < num_tris*3 && EdgeSort(&edges[first], &edges[end]) == 0){
+            ++end;
+        }
+        const Edge& edge = edges[first];
+        if(edge.verts[0] == edge.verts[1]){
+            continue;
+        }
+        bool keep_sharp = (end - first) != 2;
+        if(!keep_sharp){
+            // Compare uvs at both ends of the edge on both sides
+            int tri_a = edges[first].tri, tri_b = edges[first+1].tri;
+            for(int i=0; i<2; ++i){
+                int corner_a = tri_a*3 + FindCorner(&tri_indices[tri_a*3], edge.verts[i]);
+                int corner_b = tri_b*3 + FindCorner(&tri_indices[tri_b*3], edge.verts[i]);
+                for(int k=0; k<2; ++k){
+                    if(fabsf(tri_uvs[corner_a*2+k] - tri_uvs[corner_b*2+k]) > kSeamUVEpsilon){
+                        keep_sharp = true;
+                    }
+                }
+            }
+        }
+        if(keep_sharp){
+            // Plane through the edge, perpendicular to each adjacent face
+            vec3 a = GetVert(state, edge.verts[0]), b = GetVert(state, edge.verts[1]);
+            for(int i=first; i<end; ++i){
+                vec3 normal = cross(b - a, tri_normals[edges[i].tri]);
+                float len = length(normal);
+                if(len > 0.0f){
+                    dvec3 plane_normal = dvec3(normal / len);
+                    double d = -dot(plane_normal, dvec3(a));
+                    AddPlane(&state.quadrics[edge.verts[0]], plane_normal, d, kBoundaryWeight);
+                    AddPlane(&state.quadrics[edge.verts[1]], plane_normal, d, kBoundaryWeight);
+                    AddPlane(&state.error_quadrics[edge.verts[0]], plane_normal, d, 1.0);
+                    AddPlane(&state.error_quadrics[edge.verts[1]], plane_normal, d, 1.0);
+                }
+            }
+        }
+    }
+    for(int first=0, end; first<num_tris*3; first=end){
+        end = first+1;
+        while(end < num_tris*3 && EdgeSort(&edges[first], &edges[end]) == 0){
+            ++end;
+        }
+        const Edge& edge = edges[first];
+        if(edge.verts[0] != edge.verts[1]){
+            PushCollapse(&state, edge.verts[0], edge.verts[1]);
+            PushCollapse(&state, edge.verts[1], edge.verts[0]);
+        }
+    }
+    free(edges);
+    free(tri_normals);
+
+    int num_levels = 0;
+    double max_error = 0.0;
+    while(num_levels < num_targets){
+        SDL_assert(num_levels == 0 || target_tris[num_levels] < target_tris[num_levels-1]);
+        if(num_alive <= target_tris[num_levels] || state.heap.num_items == 0){
+            if(num_levels > 0 && num_alive == levels[num_levels-1].num_tris){
+                break; // Ran out of collapses, no point in another copy
+            }
+            StoreLevel(state, num_tris, num_alive, max_error, &levels[num_levels++]);
+            if(state.heap.num_items == 0){
+                break;
+            }
+            continue;
+        }
+        Collapse collapse = state.heap.Pop();
+        if(state.vert_version[collapse.from] != collapse.from_version ||
+           state.vert_version[collapse.to] != collapse.to_version ||
+           !IsCollapseValid(state, collapse.from, collapse.to))
+        {
+            continue;
+        }
+        max_error = max(max_error, EvaluateQuadric(state.error_quadrics[collapse.from], 
+            state.error_quadrics[collapse.to], GetVert(state, collapse.to)));
+        num_alive -= ApplyCollapse(&state, collapse.from, collapse.to);
+    }
+
+    free(state.tris);
+    free(state.source_corners);
+    free(state.tri_alive);
+    free(state.quadrics);
+    free(state.error_quadrics);
+    free(state.vert_version);
+    free(state.ref_tri);
+    free(state.ref_next);
+    free(state.vert_ref_head);
+    free(state.vert_ref_tail);
+    free(state.heap.items);
+    return num_levels;
+}
+
+void SimplifiedMesh::Dispose() {
+    free(source_corners); source_corners = NULL;
+    free(indices); indices = NULL;
+}
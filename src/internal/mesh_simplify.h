@@ -0,0 +1,26 @@
+#pragma once
+#ifndef INTERNAL_MESH_SIMPLIFY_H
+#define INTERNAL_MESH_SIMPLIFY_H
+
+// One level of detail from SimplifyMesh. Each output corner names the
+// source corner to take per-corner attributes like uvs from: one where its
+// vert had the same uvs, carried across each collapse.
+struct SimplifiedMesh {
+    int num_tris;
+    int* source_corners; // 3 per tri, into the source tri corners
+    unsigned* indices; // 3 per tri, into the source vert coords
+    float error; // Estimated largest distance from the source surface
+    void Dispose();
+};
+
+// Quadric error metric edge collapse (Garland and Heckbert), with verts
+// only moving onto their neighbors so no new positions are made. Edges on
+// mesh boundaries and uv seams are penalized so outlines and texturing
+// hold up. Writes one level per target triangle count, which must be
+// decreasing, and returns how many levels were written; it stops early
+// if nothing more can be collapsed without folding the surface over.
+int SimplifyMesh(const float* vert_coords, int num_verts, const unsigned* tri_indices,
+                 const float* tri_uvs, int num_tris, const int* target_tris,
+                 int num_targets, SimplifiedMesh* levels);
+
+#endif
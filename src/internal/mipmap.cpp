@@ -0,0 +1,327 @@
+#include "internal/mipmap.h"
+#include "internal/common.h"
+#include "platform_sdl/error.h"
+#include "platform_sdl/profiler.h"
+#include "platform_sdl/thread_pool.h"
+#include "SDL.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAP_SSE
+#endif
+
+// Levels smaller than this are done in one piece, waking workers costs more
+static const int kMinTexelsPerJob = 128*128;
+static const int kMaxMipJobs = ThreadPool::kMaxThreads + 1;
+
+int CalcMipChainLevels(int width, int height, int channels, unsigned char* storage,
+                       MipLevel* levels, int* storage_bytes)
+{
+    SDL_assert(width > 0 && height > 0);
+    levels[0].width = width;
+    levels[0].height = height;
+    int num_levels = 1;
+    int offset = 0;
+    while((width > 1 || height > 1) && num_levels < kMaxMipLevels){
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+        MipLevel& level = levels[num_levels++];
+        level.width = width;
+        level.height = height;
+        level.data = storage ? storage + offset : NULL;
+        offset += width * height * channels;
+    }
+    *storage_bytes = offset;
+    return num_levels;
+}
+
+static inline bool IsAlphaChannel(int channels, int index) {
+    return (channels == 2 || channels == 4) && index % channels == channels - 1;
+}
+
+// Pairs up the texels of a row of vertical sums, leaving dst.width sums of
+// four texels at the start of scratch. A one texel wide source is paired
+// with itself.
+static void SumColumnPairsScalar(float* scratch, int src_width, int dst_width, int channels) {
+    if(src_width == 1){
+        for(int c=0; c<channels; ++c){
+            scratch[channels+c] = scratch[c];
+        }
+    }
+    for(int x=0; x<dst_width; ++x){
+        for(int c=0; c<channels; ++c){
+            scratch[x*channels+c] = scratch[x*2*channels+c] + scratch[(x*2+1)*channels+c];
+        }
+    }
+}
+
+static inline unsigned char EncodeTexel(float sum, bool alpha) {
+    float val = sum * 0.25f;
+    if(!alpha){
+        val = sqrtf(val);
+    }
+    return (unsigned char)min(255.0f, val + 0.5f);
+}
+
+void DownsampleMipRowsScalar(const MipLevel& src, const MipLevel& dst, int channels,
+                             int first_row, int end_row, float* scratch)
+{
+    int src_len = src.width * channels;
+    int dst_len = dst.width * channels;
+    for(int y=first_row; y<end_row; ++y){
+        const unsigned char* row_0 = &src.data[min(y*2, src.height-1) * src_len];
+        const unsigned char* row_1 = &src.data[min(y*2+1, src.height-1) * src_len];
+        for(int i=0; i<src_len; ++i){
+            float a = row_0[i], b = row_1[i];
+            scratch[i] = IsAlphaChannel(channels, i) ? a + b : a*a + b*b;
+        }
+        SumColumnPairsScalar(scratch, src.width, dst.width, channels);
+        unsigned char* dst_row = &dst.data[y * dst_len];
+        for(int i=0; i<dst_len; ++i){
+            dst_row[i] = EncodeTexel(scratch[i], IsAlphaChannel(channels, i));
+        }
+    }
+}
+
+#ifdef MIPMAP_SSE
+// All ones in the lanes holding alpha, which holds for any run of four
+// values starting on a texel boundary when there are 2 or 4 channels
+static inline __m128 GetAlphaMask(int channels) {
+    __m128i mask = _mm_setzero_si128();
+    if(channels == 4){
+        mask = _mm_set_epi32(-1, 0, 0, 0);
+    } else if(channels == 2){
+        mask = _mm_set_epi32(-1, 0, -1, 0);
+    }
+    return _mm_castsi128_ps(mask);
+}
+
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 DecodeSum(__m128i a, __m128i b, __m128 alpha_mask) {
+    __m128 a_f = _mm_cvtepi32_ps(a);
+    __m128 b_f = _mm_cvtepi32_ps(b);
+    __m128 linear = _mm_add_ps(a_f, b_f);
+    __m128 squared = _mm_add_ps(_mm_mul_ps(a_f, a_f), _mm_mul_ps(b_f, b_f));
+    return Select(alpha_mask, linear, squared);
+}
+
+static void SumRowPairSSE(const unsigned char* row_0, const unsigned char* row_1, int len,
+                          int channels, __m128 alpha_mask, float* scratch)
+{
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for(; i+16<=len; i+=16){
+        __m128i a = _mm_loadu_si128((const __m128i*)&row_0[i]);
+        __m128i b = _mm_loadu_si128((const __m128i*)&row_1[i]);
+        __m128i a_lo = _mm_unpacklo_epi8(a, zero), a_hi = _mm_unpackhi_epi8(a, zero);
+        __m128i b_lo = _mm_unpacklo_epi8(b, zero), b_hi = _mm_unpackhi_epi8(b, zero);
+        _mm_storeu_ps(&scratch[i+0], DecodeSum(_mm_unpacklo_epi16(a_lo, zero),
+                                               _mm_unpacklo_epi16(b_lo, zero), alpha_mask));
+        _mm_storeu_ps(&scratch[i+4], DecodeSum(_mm_unpackhi_epi16(a_lo, zero),
+                                               _mm_unpackhi_epi16(b_lo, zero), alpha_mask));
+        _mm_storeu_ps(&scratch[i+8], DecodeSum(_mm_unpacklo_epi16(a_hi, zero),
+                                               _mm_unpacklo_epi16(b_hi, zero), alpha_mask));
+        _mm_storeu_ps(&scratch[i+12], DecodeSum(_mm_unpackhi_epi16(a_hi, zero),
+                                                _mm_unpackhi_epi16(b_hi, zero), alpha_mask));
+    }
+    for(; i<len; ++i){
+        float a = row_0[i], b = row_1[i];
+        scratch[i] = IsAlphaChannel(channels, i) ? a + b : a*a + b*b;
+    }
+}
+
+// Four channel texels fill a register and one channel texels shuffle
+// apart evenly; anything else goes through the scalar path
+static void SumColumnPairsSSE(float* scratch, int src_width, int dst_width, int channels) {
+    if(src_width == 1 || (channels != 4 && channels != 1)){
+        SumColumnPairsScalar(scratch, src_width, dst_width, channels);
+        return;
+    }
+    int x = 0;
+    if(channels == 4){
+        for(; x<dst_width; ++x){
+            __m128 a = _mm_loadu_ps(&scratch[x*8]);
+            __m128 b = _mm_loadu_ps(&scratch[x*8+4]);
+            _mm_storeu_ps(&scratch[x*4], _mm_add_ps(a, b));
+        }
+    } else {
+        for(; x+4<=dst_width; x+=4){
+            __m128 a = _mm_loadu_ps(&scratch[x*2]);
+            __m128 b = _mm_loadu_ps(&scratch[x*2+4]);
+            __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+            __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+            _mm_storeu_ps(&scratch[x], _mm_add_ps(even, odd));
+        }
+        for(; x<dst_width; ++x){
+            scratch[x] = scratch[x*2] + scratch[x*2+1];
+        }
+    }
+}
+
+static inline __m128i EncodeTexels(__m128 sum, __m128 alpha_mask) {
+    __m128 val = _mm_mul_ps(sum, _mm_set1_ps(0.25f));
+    val = Select(alpha_mask, val, _mm_sqrt_ps(val));
+    return _mm_cvttps_epi32(_mm_add_ps(val, _mm_set1_ps(0.5f)));
+}
+
+static void EncodeRowSSE(const float* scratch, int len, int channels, __m128 alpha_mask,
+                         unsigned char* dst_row)
+{
+    int i = 0;
+    for(; i+16<=len; i+=16){
+        __m128i v0 = EncodeTexels(_mm_loadu_ps(&scratch[i+0]), alpha_mask);
+        __m128i v1 = EncodeTexels(_mm_loadu_ps(&scratch[i+4]), alpha_mask);
+        __m128i v2 = EncodeTexels(_mm_loadu_ps(&scratch[i+8]), alpha_mask);
+        __m128i v3 = EncodeTexels(_mm_loadu_ps(&scratch[i+12]), alpha_mask);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+        _mm_storeu_si128((__m128i*)&dst_row[i], packed);
+    }
+    for(; i<len; ++i){
+        dst_row[i] = EncodeTexel(scratch[i], IsAlphaChannel(channels, i));
+    }
+}
+#endif
+
+void DownsampleMipRowsSIMD(const MipLevel& src, const MipLevel& dst, int channels,
+                           int first_row, int end_row, float* scratch)
+{
+#ifdef MIPMAP_SSE
+    int src_len = src.width * channels;
+    int dst_len = dst.width * channels;
+    __m128 alpha_mask = GetAlphaMask(channels);
+    for(int y=first_row; y<end_row; ++y){
+        const unsigned char* row_0 = &src.data[min(y*2, src.height-1) * src_len];
+        const unsigned char* row_1 = &src.data[min(y*2+1, src.height-1) * src_len];
+        SumRowPairSSE(row_0, row_1, src_len, channels, alpha_mask, scratch);
+        SumColumnPairsSSE(scratch, src.width, dst.width, channels);
+        EncodeRowSSE(scratch, dst_len, channels, alpha_mask, &dst.data[y * dst_len]);
+    }
+#else
+    DownsampleMipRowsScalar(src, dst, channels, first_row, end_row, scratch);
+#endif
+}
+
+const char* GetMipmapSIMDName() {
+#ifdef MIPMAP_SSE
+    return "SSE2";
+#else
+    return "scalar fallback";
+#endif
+}
+
+struct MipRowsJob {
+    const MipLevel* src;
+    const MipLevel* dst;
+    int channels;
+    int first_row, end_row;
+    float* scratch;
+};
+
+static void DownsampleMipRowsJob(void* data) {
+    MipRowsJob* job = (MipRowsJob*)data;
+    DownsampleMipRowsSIMD(*job->src, *job->dst, job->channels,
+                          job->first_row, job->end_row, job->scratch);
+}
+
+void GenerateMipChain(const MipLevel* levels, int num_levels, int channels,
+                      ThreadPool* thread_pool)
+{
+    int max_jobs = thread_pool ? min(kMaxMipJobs, thread_pool->num_threads + 1) : 1;
+    int scratch_floats = levels[0].width * channels + 4;
+    float* scratch = (float*)malloc(max_jobs * scratch_floats * sizeof(float));
+    if(!scratch){
+        FormattedError("Malloc failed", "Could not allocate mipmap scratch (%d floats)",
+                       max_jobs * scratch_floats);
+        exit(1);
+    }
+    MipRowsJob jobs[kMaxMipJobs];
+    JobCounter counter;
+    InitJobCounter(&counter);
+    for(int i=1; i<num_levels; ++i){
+        const MipLevel& dst = levels[i];
+        int num_jobs = min(max_jobs, dst.height);
+        num_jobs = min(num_jobs, max(1, dst.width * dst.height / kMinTexelsPerJob));
+        if(num_jobs == 1){
+            DownsampleMipRowsSIMD(levels[i-1], dst, channels, 0, dst.height, scratch);
+            continue;
+        }
+        for(int j=0; j<num_jobs; ++j){
+            MipRowsJob& job = jobs[j];
+            job.src = &levels[i-1];
+            job.dst = &dst;
+            job.channels = channels;
+            job.first_row = dst.height * j / num_jobs;
+            job.end_row = dst.height * (j+1) / num_jobs;
+            job.scratch = &scratch[j * scratch_floats];
+            thread_pool->AddJob(DownsampleMipRowsJob, &job, &counter);
+        }
+        thread_pool->Wait(&counter);
+    }
+    free(scratch);
+}
+
+void BenchmarkMipChain(const unsigned char* image, int width, int height, int channels,
+                       int iterations, ThreadPool* thread_pool, Profiler* profiler)
+{
+    MipLevel ref_levels[kMaxMipLevels], levels[kMaxMipLevels];
+    int storage_bytes;
+    int num_levels = CalcMipChainLevels(width, height, channels, NULL, levels, &storage_bytes);
+    unsigned char* ref_storage = (unsigned char*)malloc(storage_bytes);
+    unsigned char* storage = (unsigned char*)malloc(storage_bytes);
+    float* scratch = (float*)malloc((width * channels + 4) * sizeof(float));
+    CalcMipChainLevels(width, height, channels, ref_storage, ref_levels, &storage_bytes);
+    CalcMipChainLevels(width, height, channels, storage, levels, &storage_bytes);
+    ref_levels[0].data = (unsigned char*)image;
+    levels[0].data = (unsigned char*)image;
+
+    profiler->StartEvent("Mipmap benchmark: scalar");
+    Uint64 start = SDL_GetPerformanceCounter();
+    for(int iter=0; iter<iterations; ++iter){
+        for(int i=1; i<num_levels; ++i){
+            DownsampleMipRowsScalar(ref_levels[i-1], ref_levels[i], channels,
+                                    0, ref_levels[i].height, scratch);
+        }
+    }
+    Uint64 scalar_time = SDL_GetPerformanceCounter() - start;
+    profiler->EndEvent();
+
+    profiler->StartEvent("Mipmap benchmark: SIMD");
+    start = SDL_GetPerformanceCounter();
+    for(int iter=0; iter<iterations; ++iter){
+        GenerateMipChain(levels, num_levels, channels, NULL);
+    }
+    Uint64 simd_time = SDL_GetPerformanceCounter() - start;
+    profiler->EndEvent();
+
+    profiler->StartEvent("Mipmap benchmark: SIMD threaded");
+    start = SDL_GetPerformanceCounter();
+    for(int iter=0; iter<iterations; ++iter){
+        GenerateMipChain(levels, num_levels, channels, thread_pool);
+    }
+    Uint64 threaded_time = SDL_GetPerformanceCounter() - start;
+    profiler->EndEvent();
+
+    int max_error = 0;
+    for(int i=0; i<storage_bytes; ++i){
+        max_error = max(max_error, abs(storage[i] - ref_storage[i]));
+    }
+    double freq = (double)SDL_GetPerformanceFrequency();
+    double scalar_us = scalar_time / freq * 1000000.0 / iterations;
+    double simd_us = simd_time / freq * 1000000.0 / iterations;
+    double threaded_us = threaded_time / freq * 1000000.0 / iterations;
+    SDL_Log("Mipmaps %dx%dx%d: scalar %.1f us, %s %.1f us (%.2fx), "
+            "%d threads %.1f us (%.2fx), max error %d\n",
+            width, height, channels, scalar_us, GetMipmapSIMDName(), simd_us,
+            scalar_us / max(simd_us, 0.001), thread_pool ? thread_pool->num_threads + 1 : 1, threaded_us,
+            scalar_us / max(threaded_us, 0.001), max_error);
+
+    free(ref_storage);
+    free(storage);
+    free(scratch);
+}
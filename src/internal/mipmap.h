@@ -0,0 +1,41 @@
+#pragma once
+#ifndef INTERNAL_MIPMAP_H
+#define INTERNAL_MIPMAP_H
+
+class Profiler;
+class ThreadPool;
+
+struct MipLevel {
+    int width;
+    int height;
+    unsigned char* data; // Tightly packed rows
+};
+
+static const int kMaxMipLevels = 16;
+
+// Lays out the chain below level 0 down to 1x1, halving each axis on its
+// own so non-square and non-power-of-two sizes work. Returns the number of
+// levels including level 0, and the bytes needed for the rest. Pass NULL
+// storage to get the size, then call again with that much memory; level
+// 0's data is left for the caller to point at the source image.
+int CalcMipChainLevels(int width, int height, int channels, unsigned char* storage,
+                       MipLevel* levels, int* storage_bytes);
+
+// Writes rows [first_row, end_row) of dst from the level above it with a
+// 2x2 box filter. Color is averaged in an approximate linear space (gamma
+// 2), alpha as is. scratch needs src.width*channels + 4 floats.
+void DownsampleMipRowsScalar(const MipLevel& src, const MipLevel& dst, int channels,
+                             int first_row, int end_row, float* scratch);
+void DownsampleMipRowsSIMD(const MipLevel& src, const MipLevel& dst, int channels,
+                           int first_row, int end_row, float* scratch);
+const char* GetMipmapSIMDName();
+
+// Fills every level after 0, splitting the rows of large levels across the
+// pool. thread_pool can be NULL to do it all on the calling thread.
+void GenerateMipChain(const MipLevel* levels, int num_levels, int channels,
+                      ThreadPool* thread_pool);
+
+void BenchmarkMipChain(const unsigned char* image, int width, int height, int channels,
+                       int iterations, ThreadPool* thread_pool, Profiler* profiler);
+
+#endif
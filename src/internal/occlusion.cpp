@@ -0,0 +1,188 @@
+#include "internal/occlusion.h"
+#include "internal/common.h"
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+using namespace glm;
+
+// Vertices closer than this in w are treated as crossing the near plane
+static const float kMinW = 0.001f;
+
+void OcclusionBuffer::Clear() {
+    for(int i=0; i<kWidth*kHeight; ++i){
+        depth[i] = 1.0f;
+    }
+}
+
+static void GetBoxCorners(const vec3* bounds, vec3* corners) {
+    for(int i=0; i<8; ++i){
+        corners[i] = vec3(bounds[(i>>0)&1][0], bounds[(i>>1)&1][1], bounds[(i>>2)&1][2]);
+    }
+}
+
+// Screen x and y in pixels, z in [0,1]. Returns false if behind the near plane.
+static bool ProjectPoint(const mat4& proj_view_mat, const vec3& point, vec3* screen) {
+    vec4 clip = proj_view_mat * vec4(point, 1.0f);
+    if(clip[3] < kMinW){
+        return false;
+    }
+    float inv_w = 1.0f / clip[3];
+    (*screen)[0] = (clip[0] * inv_w * 0.5f + 0.5f) * OcclusionBuffer::kWidth;
+    (*screen)[1] = (clip[1] * inv_w * 0.5f + 0.5f) * OcclusionBuffer::kHeight;
+    (*screen)[2] = clip[2] * inv_w * 0.5f + 0.5f;
+    return true;
+}
+
+// Edge function, positive on the left of a->b
+static inline float Edge(const vec3& a, const vec3& b, float x, float y) {
+    return (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+}
+
+static void RasterizeTriangle(float* depth_buffer, vec3 v0, vec3 v1, vec3 v2) {
+    float area = Edge(v0, v1, v2[0], v2[1]);
+    if(area == 0.0f){
+        return;
+    }
+    if(area < 0.0f){
+        vec3 temp = v1; v1 = v2; v2 = temp;
+        area = -area;
+    }
+    int min_x = max(0, (int)floorf(min(v0[0], min(v1[0], v2[0]))));
+    int max_x = min(OcclusionBuffer::kWidth - 1, (int)ceilf(max(v0[0], max(v1[0], v2[0]))));
+    int min_y = max(0, (int)floorf(min(v0[1], min(v1[1], v2[1]))));
+    int max_y = min(OcclusionBuffer::kHeight - 1, (int)ceilf(max(v0[1], max(v1[1], v2[1]))));
+    if(min_x > max_x || min_y > max_y){
+        return;
+    }
+    min_x &= ~3; // Rows are processed four pixels at a time
+    float inv_area = 1.0f / area;
+    float dz1 = (v1[2] - v0[2]) * inv_area;
+    float dz2 = (v2[2] - v0[2]) * inv_area;
+    // Per pixel step of each edge function in x
+    float step_12 = -(v2[1] - v1[1]);
+    float step_20 = -(v0[1] - v2[1]);
+    float step_01 = -(v1[1] - v0[1]);
+    for(int y=min_y; y<=max_y; ++y){
+        float py = y + 0.5f;
+        float px = min_x + 0.5f;
+        float e_12 = Edge(v1, v2, px, py);
+        float e_20 = Edge(v2, v0, px, py);
+        float e_01 = Edge(v0, v1, px, py);
+        float* row = &depth_buffer[y * OcclusionBuffer::kWidth];
+#ifdef OCCLUSION_SSE
+        __m128 offsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        __m128 w_12 = _mm_add_ps(_mm_set1_ps(e_12), _mm_mul_ps(offsets, _mm_set1_ps(step_12)));
+        __m128 w_20 = _mm_add_ps(_mm_set1_ps(e_20), _mm_mul_ps(offsets, _mm_set1_ps(step_20)));
+        __m128 w_01 = _mm_add_ps(_mm_set1_ps(e_01), _mm_mul_ps(offsets, _mm_set1_ps(step_01)));
+        __m128 step4_12 = _mm_set1_ps(step_12 * 4.0f);
+        __m128 step4_20 = _mm_set1_ps(step_20 * 4.0f);
+        __m128 step4_01 = _mm_set1_ps(step_01 * 4.0f);
+        __m128 z0 = _mm_set1_ps(v0[2]);
+        __m128 dz1_sse = _mm_set1_ps(dz1);
+        __m128 dz2_sse = _mm_set1_ps(dz2);
+        __m128 zero = _mm_setzero_ps();
+        for(int x=min_x; x<=max_x; x+=4){
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(w_12, zero), 
+                            _mm_and_ps(_mm_cmpge_ps(w_20, zero), _mm_cmpge_ps(w_01, zero)));
+            if(_mm_movemask_ps(inside)){
+                // w_20 weights v1 and w_01 weights v2
+                __m128 z = _mm_add_ps(z0, _mm_add_ps(_mm_mul_ps(w_20, dz1_sse), 
+                                                     _mm_mul_ps(w_01, dz2_sse)));
+                __m128 old_z = _mm_loadu_ps(&row[x]);
+                __m128 new_z = _mm_min_ps(old_z, z);
+                _mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, new_z), 
+                                                 _mm_andnot_ps(inside, old_z)));
+            }
+            w_12 = _mm_add_ps(w_12, step4_12);
+            w_20 = _mm_add_ps(w_20, step4_20);
+            w_01 = _mm_add_ps(w_01, step4_01);
+        }
+#else
+        for(int x=min_x; x<=max_x; ++x){
+            if(e_12 >= 0.0f && e_20 >= 0.0f && e_01 >= 0.0f){
+                float z = v0[2] + e_20 * dz1 + e_01 * dz2;
+                row[x] = min(row[x], z);
+            }
+            e_12 += step_12;
+            e_20 += step_20;
+            e_01 += step_01;
+        }
+#endif
+    }
+}
+
+void OcclusionBuffer::RasterizeBox(const mat4& proj_view_mat, const vec3* bounds) {
+    static const int kFaces[6][4] = {
+        {0,2,6,4}, {1,5,7,3}, // -x, +x
+        {0,4,5,1}, {2,3,7,6}, // -y, +y
+        {0,1,3,2}, {4,6,7,5}  // -z, +z
+    };
+    vec3 corners[8];
+    GetBoxCorners(bounds, corners);
+    vec3 screen[8];
+    bool valid[8];
+    for(int i=0; i<8; ++i){
+        valid[i] = ProjectPoint(proj_view_mat, corners[i], &screen[i]);
+    }
+    for(int face=0; face<6; ++face){
+        const int* quad = kFaces[face];
+        // Occluders only need to be conservative, so just drop faces
+        // that cross the near plane instead of clipping them
+        if(!valid[quad[0]] || !valid[quad[1]] || !valid[quad[2]] || !valid[quad[3]]){
+            continue;
+        }
+        RasterizeTriangle(depth, screen[quad[0]], screen[quad[1]], screen[quad[2]]);
+        RasterizeTriangle(depth, screen[quad[0]], screen[quad[2]], screen[quad[3]]);
+    }
+}
+
+void OcclusionBuffer::BuildHiZ() {
+    for(int tile_y=0; tile_y<kTilesY; ++tile_y){
+        for(int tile_x=0; tile_x<kTilesX; ++tile_x){
+            float farthest = 0.0f;
+            for(int y=tile_y*kTileSize; y<(tile_y+1)*kTileSize; ++y){
+                const float* row = &depth[y*kWidth + tile_x*kTileSize];
+                for(int x=0; x<kTileSize; ++x){
+                    farthest = max(farthest, row[x]);
+                }
+            }
+            hiz[tile_y*kTilesX+tile_x] = farthest;
+        }
+    }
+}
+
+bool OcclusionBuffer::IsAABBVisible(const mat4& proj_view_mat, const vec3* bounds) const {
+    vec3 corners[8];
+    GetBoxCorners(bounds, corners);
+    vec3 screen_min(FLT_MAX), screen_max(-FLT_MAX);
+    for(int i=0; i<8; ++i){
+        vec3 screen;
+        if(!ProjectPoint(proj_view_mat, corners[i], &screen)){
+            return true;
+        }
+        screen_min = min(screen_min, screen);
+        screen_max = max(screen_max, screen);
+    }
+    int tile_min_x = max(0, (int)floorf(screen_min[0]) / kTileSize);
+    int tile_max_x = min(kTilesX - 1, (int)floorf(screen_max[0]) / kTileSize);
+    int tile_min_y = max(0, (int)floorf(screen_min[1]) / kTileSize);
+    int tile_max_y = min(kTilesY - 1, (int)floorf(screen_max[1]) / kTileSize);
+    if(screen_max[0] < 0.0f || screen_max[1] < 0.0f || 
+       tile_min_x > tile_max_x || tile_min_y > tile_max_y)
+    {
+        return true; // Off screen, leave it to frustum culling
+    }
+    for(int tile_y=tile_min_y; tile_y<=tile_max_y; ++tile_y){
+        for(int tile_x=tile_min_x; tile_x<=tile_max_x; ++tile_x){
+            if(screen_min[2] <= hiz[tile_y*kTilesX+tile_x]){
+                return true;
+            }
+        }
+    }
+    return false;
+}
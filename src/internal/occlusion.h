@@ -0,0 +1,29 @@
+#pragma once
+#ifndef INTERNAL_OCCLUSION_H
+#define INTERNAL_OCCLUSION_H
+
+#include "glm/glm.hpp"
+
+// Low resolution software depth buffer for occlusion culling. Occluders 
+// are boxes that must lie inside real geometry; occludees are tested by
+// the nearest depth of their bounds against the farthest depth of each
+// HiZ tile they cover. Depth is NDC z mapped to [0,1], 1 is far. 
+// Pure CPU, so it can be built on any thread.
+class OcclusionBuffer {
+public:
+    static const int kWidth = 256;
+    static const int kHeight = 128;
+    static const int kTileSize = 8;
+    static const int kTilesX = kWidth / kTileSize;
+    static const int kTilesY = kHeight / kTileSize;
+    float depth[kWidth * kHeight];
+    float hiz[kTilesX * kTilesY]; // Farthest depth in each tile
+
+    void Clear();
+    void RasterizeBox(const glm::mat4& proj_view_mat, const glm::vec3* bounds);
+    void BuildHiZ();
+    // Conservative: true unless the whole box is known to be hidden
+    bool IsAABBVisible(const glm::mat4& proj_view_mat, const glm::vec3* bounds) const;
+};
+
+#endif
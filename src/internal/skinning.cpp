@@ -0,0 +1,210 @@
+#include "internal/skinning.h"
+#include "internal/common.h"
+#include "platform_sdl/blender_file_io.h"
+#include "platform_sdl/profiler.h"
+#include "glm/glm.hpp"
+#include "SDL.h"
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SKINNING_AVX
+#define SKINNING_SSE
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SKINNING_SSE
+#endif
+
+using namespace glm;
+
+// Offsets into ParseMesh::vert, 3v 2uv 3n 4bone_index 4bone_weight
+static const int kPosOffset = 0;
+static const int kNormalOffset = 5;
+static const int kBoneIndexOffset = 8;
+static const int kBoneWeightOffset = 12;
+
+void SkinVertsScalar(const ParseMesh& mesh, const mat4* palette,
+                     int first_vert, int num_verts, float* positions, float* normals)
+{
+    SDL_assert(first_vert >= 0 && first_vert + num_verts <= mesh.num_vert);
+    for(int vert_index=first_vert, end=first_vert+num_verts; vert_index<end; ++vert_index){
+        const float* vert = &mesh.vert[vert_index * ParseMesh::kFloatsPerVert];
+        mat4 skin_mat(0.0f);
+        for(int i=0; i<4; ++i){
+            float weight = vert[kBoneWeightOffset+i];
+            if(weight != 0.0f){
+                skin_mat += palette[(int)vert[kBoneIndexOffset+i]] * weight;
+            }
+        }
+        vec3 pos = vec3(skin_mat * vec4(vert[kPosOffset+0], vert[kPosOffset+1], vert[kPosOffset+2], 1.0f));
+        vec3 normal = normalize(mat3(skin_mat) *
+            vec3(vert[kNormalOffset+0], vert[kNormalOffset+1], vert[kNormalOffset+2]));
+        for(int k=0; k<3; ++k){
+            positions[vert_index*3+k] = pos[k];
+            normals[vert_index*3+k] = normal[k];
+        }
+    }
+}
+
+#ifdef SKINNING_SSE
+static inline void Store3(float* dst, __m128 val) {
+    _mm_storel_pi((__m64*)dst, val);
+    _mm_store_ss(dst+2, _mm_movehl_ps(val, val));
+}
+
+static inline __m128 Normalize3(__m128 val) {
+    __m128 sq = _mm_mul_ps(val, val);
+    __m128 len_sq = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1,1,1,1))),
+                               _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2,2,2,2)));
+    __m128 len = _mm_sqrt_ss(len_sq);
+    return _mm_div_ps(val, _mm_shuffle_ps(len, len, _MM_SHUFFLE(0,0,0,0)));
+}
+
+// Applies the blended matrix columns to one vert and stores the result
+static inline void TransformAndStore(const float* vert, __m128 col0, __m128 col1,
+                                     __m128 col2, __m128 col3, float* pos_out, float* normal_out)
+{
+    __m128 pos = _mm_add_ps(col3, _mm_add_ps(
+        _mm_mul_ps(col0, _mm_set1_ps(vert[kPosOffset+0])), _mm_add_ps(
+        _mm_mul_ps(col1, _mm_set1_ps(vert[kPosOffset+1])),
+        _mm_mul_ps(col2, _mm_set1_ps(vert[kPosOffset+2])))));
+    __m128 normal = _mm_add_ps(
+        _mm_mul_ps(col0, _mm_set1_ps(vert[kNormalOffset+0])), _mm_add_ps(
+        _mm_mul_ps(col1, _mm_set1_ps(vert[kNormalOffset+1])),
+        _mm_mul_ps(col2, _mm_set1_ps(vert[kNormalOffset+2]))));
+    Store3(pos_out, pos);
+    Store3(normal_out, Normalize3(normal));
+}
+
+static inline void SkinVertSSE(const float* vert, const mat4* palette,
+                               float* pos_out, float* normal_out)
+{
+    __m128 col[4];
+    for(int c=0; c<4; ++c){
+        col[c] = _mm_setzero_ps();
+    }
+    for(int i=0; i<4; ++i){
+        float weight = vert[kBoneWeightOffset+i];
+        if(weight != 0.0f){
+            __m128 weight_sse = _mm_set1_ps(weight);
+            const float* mat = (const float*)&palette[(int)vert[kBoneIndexOffset+i]];
+            for(int c=0; c<4; ++c){
+                col[c] = _mm_add_ps(col[c], _mm_mul_ps(weight_sse, _mm_loadu_ps(mat+c*4)));
+            }
+        }
+    }
+    TransformAndStore(vert, col[0], col[1], col[2], col[3], pos_out, normal_out);
+}
+#endif
+
+#ifdef SKINNING_AVX
+// Blends matrices for two verts at once, one per 128-bit lane
+static inline void SkinVertPairAVX(const float* vert_a, const float* vert_b, const mat4* palette,
+                                   float* pos_out, float* normal_out)
+{
+    __m256 col[4];
+    for(int c=0; c<4; ++c){
+        col[c] = _mm256_setzero_ps();
+    }
+    for(int i=0; i<4; ++i){
+        float weight_a = vert_a[kBoneWeightOffset+i];
+        float weight_b = vert_b[kBoneWeightOffset+i];
+        if(weight_a != 0.0f || weight_b != 0.0f){
+            __m256 weight = _mm256_insertf128_ps(
+                _mm256_castps128_ps256(_mm_set1_ps(weight_a)), _mm_set1_ps(weight_b), 1);
+            const float* mat_a = (const float*)&palette[(int)vert_a[kBoneIndexOffset+i]];
+            const float* mat_b = (const float*)&palette[(int)vert_b[kBoneIndexOffset+i]];
+            for(int c=0; c<4; ++c){
+                __m256 mats = _mm256_insertf128_ps(
+                    _mm256_castps128_ps256(_mm_loadu_ps(mat_a+c*4)), _mm_loadu_ps(mat_b+c*4), 1);
+                col[c] = _mm256_add_ps(col[c], _mm256_mul_ps(weight, mats));
+            }
+        }
+    }
+    TransformAndStore(vert_a,
+        _mm256_castps256_ps128(col[0]), _mm256_castps256_ps128(col[1]),
+        _mm256_castps256_ps128(col[2]), _mm256_castps256_ps128(col[3]),
+        pos_out, normal_out);
+    TransformAndStore(vert_b,
+        _mm256_extractf128_ps(col[0], 1), _mm256_extractf128_ps(col[1], 1),
+        _mm256_extractf128_ps(col[2], 1), _mm256_extractf128_ps(col[3], 1),
+        pos_out+3, normal_out+3);
+}
+#endif
+
+void SkinVertsSIMD(const ParseMesh& mesh, const mat4* palette,
+                   int first_vert, int num_verts, float* positions, float* normals)
+{
+#ifdef SKINNING_SSE
+    SDL_assert(first_vert >= 0 && first_vert + num_verts <= mesh.num_vert);
+    int vert_index = first_vert;
+    int end = first_vert + num_verts;
+    static const int kStride = ParseMesh::kFloatsPerVert;
+#ifdef SKINNING_AVX
+    for(; vert_index+1<end; vert_index+=2){
+        SkinVertPairAVX(&mesh.vert[vert_index*kStride], &mesh.vert[(vert_index+1)*kStride],
+                        palette, &positions[vert_index*3], &normals[vert_index*3]);
+    }
+#endif
+    for(; vert_index<end; ++vert_index){
+        SkinVertSSE(&mesh.vert[vert_index*kStride], palette,
+                    &positions[vert_index*3], &normals[vert_index*3]);
+    }
+#else
+    SkinVertsScalar(mesh, palette, first_vert, num_verts, positions, normals);
+#endif
+}
+
+const char* GetSkinningSIMDName() {
+#if defined(SKINNING_AVX)
+    return "AVX";
+#elif defined(SKINNING_SSE)
+    return "SSE2";
+#else
+    return "scalar fallback";
+#endif
+}
+
+void BenchmarkSkinning(const ParseMesh& mesh, const mat4* palette,
+                       int iterations, Profiler* profiler)
+{
+    int buf_size = mesh.num_vert * 3 * sizeof(float);
+    float* ref_positions = (float*)malloc(buf_size);
+    float* ref_normals = (float*)malloc(buf_size);
+    float* positions = (float*)malloc(buf_size);
+    float* normals = (float*)malloc(buf_size);
+
+    profiler->StartEvent("Skinning benchmark: scalar");
+    Uint64 start = SDL_GetPerformanceCounter();
+    for(int i=0; i<iterations; ++i){
+        SkinVertsScalar(mesh, palette, 0, mesh.num_vert, ref_positions, ref_normals);
+    }
+    Uint64 scalar_time = SDL_GetPerformanceCounter() - start;
+    profiler->EndEvent();
+
+    profiler->StartEvent("Skinning benchmark: SIMD");
+    start = SDL_GetPerformanceCounter();
+    for(int i=0; i<iterations; ++i){
+        SkinVertsSIMD(mesh, palette, 0, mesh.num_vert, positions, normals);
+    }
+    Uint64 simd_time = SDL_GetPerformanceCounter() - start;
+    profiler->EndEvent();
+
+    float max_error = 0.0f;
+    for(int i=0, len=mesh.num_vert*3; i<len; ++i){
+        max_error = max(max_error, fabsf(positions[i] - ref_positions[i]));
+        max_error = max(max_error, fabsf(normals[i] - ref_normals[i]));
+    }
+    double freq = (double)SDL_GetPerformanceFrequency();
+    double scalar_us = scalar_time / freq * 1000000.0 / iterations;
+    double simd_us = simd_time / freq * 1000000.0 / iterations;
+    SDL_Log("Skinning %d verts: scalar %.1f us, %s %.1f us (%.2fx), max error %g\n",
+            mesh.num_vert, scalar_us, GetSkinningSIMDName(), simd_us,
+            scalar_us / max(simd_us, 0.001), max_error);
+
+    free(ref_positions);
+    free(ref_normals);
+    free(positions);
+    free(normals);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#ifndef INTERNAL_SKINNING_H
+#define INTERNAL_SKINNING_H
+
+#include "glm/fwd.hpp"
+
+class ParseMesh;
+class Profiler;
+
+// CPU skinning of a ParseMesh vertex stream. Skins verts in the range
+// [first_vert, first_vert+num_verts), writing 3 floats per vert into
+// positions and normals at the same vertex index as the source, so
+// separate ranges can be handed to separate jobs with the same buffers.
+void SkinVertsScalar(const ParseMesh& mesh, const glm::mat4* palette,
+                     int first_vert, int num_verts, float* positions, float* normals);
+void SkinVertsSIMD(const ParseMesh& mesh, const glm::mat4* palette,
+                   int first_vert, int num_verts, float* positions, float* normals);
+const char* GetSkinningSIMDName();
+
+void BenchmarkSkinning(const ParseMesh& mesh, const glm::mat4* palette,
+                       int iterations, Profiler* profiler);
+
+#endif
@@ -6,6 +6,8 @@
 #include "platform_sdl/file_io.h"
 #include "platform_sdl/graphics.h"
 #include "platform_sdl/profiler.h"
+#include "platform_sdl/render_thread.h"
+#include "platform_sdl/thread_pool.h"
 #include "internal/common.h"
 #include "internal/memory.h"
 #include "game/game_state.h"
@@ -14,20 +16,61 @@
 #include <sys/stat.h>
 #include <new>
 
+// Draw frame N on its own thread while frame N+1 is simulated
+static const bool kRenderThread = true;
+// With -headless, frames run on the null graphics backend at a fixed time
+// step and the average cost of each is logged at the end
+static const int kHeadlessFrames = 600; // Unless given after -headless
+static const float kHeadlessTimeStep = 1.0f / 60.0f;
+static const int kHeadlessScreenDims[] = {1280, 720};
+
+struct DrawGameData {
+    GameState* game_state;
+    GraphicsContext* graphics_context;
+};
+
+static void DrawGame(void* data) {
+    DrawGameData* draw_game_data = (DrawGameData*)data;
+    draw_game_data->game_state->Draw(draw_game_data->graphics_context);
+}
+
+static void LogHeadlessResults(int num_frames, Uint64 perf_count) {
+    const GraphicsStats& stats = GetGraphicsStats();
+    double ms = perf_count * 1000.0 / SDL_GetPerformanceFrequency();
+    SDL_Log("Headless: %d frames, %.3f ms per frame\n", num_frames, ms / num_frames);
+    SDL_Log("Per frame: %.1f draw calls, %.1f instances, %.0f triangles, "
+            "%.1f state changes, %.1f KB uploaded\n",
+            stats.draw_calls / (double)num_frames, stats.instances / (double)num_frames,
+            stats.triangles / (double)num_frames, stats.state_changes / (double)num_frames,
+            stats.upload_bytes / 1024.0 / num_frames);
+}
+
+// Runs until the window is closed, or for num_frames if it isn't 0. 
+// audio_context can be NULL.
 static void RunGame(Profiler* profiler, FileLoadThreadData* file_load_thread_data, 
                     StackAllocator* stack_allocator, GraphicsContext* graphics_context,
-                    AudioContext* audio_context) 
+                    AudioContext* audio_context, ThreadPool* thread_pool, 
+                    const char* write_dir, int num_frames) 
 {
+    bool headless = (graphics_context->backend == kGraphicsBackendNull);
     GameState* game_state;
-    game_state = new((GameState*)stack_allocator->Alloc(sizeof(game_state))) GameState();
+    game_state = new((GameState*)stack_allocator->Alloc(sizeof(GameState))) GameState();
     if(!game_state){
         FormattedError("Error", "Could not alloc memory for game state");
         exit(1);
     }
-    game_state->Init(profiler, file_load_thread_data, stack_allocator);
+    game_state->Init(profiler, file_load_thread_data, stack_allocator, thread_pool, write_dir);
+    DrawGameData draw_game_data = {game_state, graphics_context};
+    RenderThread render_thread;
+    render_thread.Init(graphics_context, DrawGame, &draw_game_data, kRenderThread);
     int last_ticks = SDL_GetTicks();
     bool game_running = true;
-    while(game_running){
+    int frame = 0;
+    if(headless){
+        ResetGraphicsStats(); // Count frames only, not loading
+    }
+    Uint64 start_perf_count = SDL_GetPerformanceCounter();
+    while(game_running && (num_frames == 0 || frame < num_frames)){
         profiler->StartEvent("Game loop");
         SDL_Event event;
         glm::vec2 mouse_rel;
@@ -44,20 +87,30 @@ static void RunGame(Profiler* profiler, FileLoadThreadData* file_load_thread_dat
         }
         profiler->StartEvent("Update");
         float time_scale = 1.0f;// 0.1f;
-        int ticks = SDL_GetTicks();
-        game_state->Update(mouse_rel, (ticks - last_ticks) / 1000.0f * time_scale);
+        int ticks = headless ? (int)(frame * kHeadlessTimeStep * 1000.0f) : SDL_GetTicks();
+        float time_step = headless ? kHeadlessTimeStep : (ticks - last_ticks) / 1000.0f;
+        game_state->Update(mouse_rel, time_step * time_scale);
         last_ticks = ticks;
         profiler->EndEvent();
-        profiler->StartEvent("Draw");
-        game_state->Draw(graphics_context, SDL_GetTicks());
+        game_state->PublishFrame(ticks);
+        profiler->StartEvent("Wait for draw");
+        render_thread.Wait();
         profiler->EndEvent();
-        profiler->StartEvent("Audio");
-        UpdateAudio(audio_context);
-        profiler->EndEvent();
-        profiler->StartEvent("Swap");
-        SDL_GL_SwapWindow(graphics_context->window);
+        game_state->SwapFrames();
+        profiler->StartEvent("Draw");
+        render_thread.Kick(); // Returns right away unless unthreaded
         profiler->EndEvent();
+        if(audio_context){
+            profiler->StartEvent("Audio");
+            UpdateAudio(audio_context);
+            profiler->EndEvent();
+        }
         profiler->EndEvent();
+        ++frame;
+    }
+    render_thread.Dispose();
+    if(headless){
+        LogHeadlessResults(frame, SDL_GetPerformanceCounter() - start_perf_count);
     }
 }
 
@@ -65,6 +118,17 @@ int main(int argc, char* argv[]) {
     Profiler profiler;
     profiler.Init();
 
+    int headless_frames = 0;
+    for(int i=1; i<argc; ++i){
+        if(strcmp(argv[i], "-headless") == 0){
+            headless_frames = kHeadlessFrames;
+            if(i+1 < argc && atoi(argv[i+1]) > 0){
+                headless_frames = atoi(argv[++i]);
+            }
+        }
+    }
+    bool headless = (headless_frames != 0);
+
     profiler.StartEvent("Allocate game memory block");
         static const int kGameMemSize = 1024*1024*64;
         StackAllocator stack_allocator;
@@ -76,7 +140,11 @@ int main(int argc, char* argv[]) {
     profiler.EndEvent();
 
     profiler.StartEvent("Initializing SDL");
-        if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER | SDL_INIT_AUDIO) < 0) {
+        Uint32 sdl_flags = SDL_INIT_EVENTS | SDL_INIT_TIMER;
+        if(!headless){
+            sdl_flags |= SDL_INIT_VIDEO | SDL_INIT_AUDIO;
+        }
+        if(SDL_Init(sdl_flags) < 0) {
             FormattedError("SDL_Init failed", "Could not initialize SDL: %s", SDL_GetError());
             return 1;
         }
@@ -122,14 +190,27 @@ int main(int argc, char* argv[]) {
 
     profiler.StartEvent("Set up graphics context");
         GraphicsContext graphics_context;
-        InitGraphicsContext(&graphics_context);
+        if(headless){
+            InitNullGraphicsContext(&graphics_context, kHeadlessScreenDims[0], 
+                                    kHeadlessScreenDims[1]);
+        } else {
+            InitGraphicsContext(&graphics_context);
+        }
     profiler.EndEvent();
 
     AudioContext audio_context;
-    InitAudio(&audio_context, &stack_allocator);
+    if(!headless){
+        InitAudio(&audio_context, &stack_allocator);
+    }
 
-    RunGame(&profiler, &file_load_thread_data, &stack_allocator, 
-            &graphics_context, &audio_context);
+    // Leave a core each for the main thread, the file loader and the render 
+    // thread, but always have at least one worker
+    ThreadPool thread_pool;
+    int num_reserved_cores = kRenderThread ? 3 : 2;
+    thread_pool.Init(max(1, SDL_GetCPUCount() - num_reserved_cores));
+
+    RunGame(&profiler, &file_load_thread_data, &stack_allocator, &graphics_context, 
+            headless ? NULL : &audio_context, &thread_pool, write_dir, headless_frames);
 
     {
         static const int kMaxPathSize = 4096;
@@ -138,13 +219,16 @@ int main(int argc, char* argv[]) {
         profiler.Export(path);
     }
 
-    // Wait for the audio to fade out
-    // TODO: handle this better -- e.g. force audio fade immediately
-    SDL_Delay(200);
     // We can probably just skip most of this if we want to quit faster
-    SDL_CloseAudioDevice(audio_context.device_id);
-    SDL_GL_DeleteContext(graphics_context.gl_context);  
-    SDL_DestroyWindow(graphics_context.window);
+    thread_pool.Dispose();
+    if(!headless){
+        // Wait for the audio to fade out
+        // TODO: handle this better -- e.g. force audio fade immediately
+        SDL_Delay(200);
+        SDL_CloseAudioDevice(audio_context.device_id);
+        SDL_GL_DeleteContext(graphics_context.gl_context);  
+        SDL_DestroyWindow(graphics_context.window);
+    }
     // Cleanly shut down file load thread 
     if (SDL_LockMutex(file_load_thread_data.mutex) == 0) {
         file_load_thread_data.wants_to_quit = true;
@@ -1,6 +1,6 @@
 #include "platform_sdl/debug_draw.h"
+#include "platform_sdl/graphics.h"
 #include "glm/glm.hpp"
-#include "GL/glew.h"
 #include <cstring>
 
 using namespace glm;
@@ -33,21 +33,17 @@ bool DebugDrawLines::Add(const vec3& start, const vec3& end,
     }
 }
 
-void DebugDrawLines::Draw(const glm::mat4& proj_view_mat) {
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_lines*sizeof(GLfloat)*kElementsPerPoint*2, draw_data, GL_STREAM_DRAW);
-    glUseProgram(shader);
-    GLuint modelview_matrix_uniform = glGetUniformLocation(shader, "mv_mat");
-    glUniformMatrix4fv(modelview_matrix_uniform, 1, false, (GLfloat*)&proj_view_mat);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), 0);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 7 * sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
-    glDrawArrays(GL_LINES, 0, num_lines*2);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glUseProgram(0);
+// Transform comes from the PerFrame uniform block
+void DebugDrawLines::Draw() {
+    int data_size = num_lines*sizeof(float)*kElementsPerPoint*2;
+    int offset;
+    void* mapped = StreamBufferMap(stream_buffer, data_size, &offset);
+    if(mapped){
+        memcpy(mapped, draw_data, data_size);
+        StreamBufferUnmap(stream_buffer);
+        DrawUnbatched(shader, kInterleave_3V4C, stream_buffer->vbo, offset, -1, 
+                      kDrawLines, num_lines*2);
+    }
 
     for(int i=0; i<num_lines; ++i){        
         DebugDrawCommon& line = common[i];
@@ -61,7 +57,7 @@ void DebugDrawLines::Draw(const glm::mat4& proj_view_mat) {
         if(line.lifetime == kDraw && line.lifetime_int <= 0){
             line = common[num_lines-1];
             memcpy(&draw_data[i*14], &draw_data[(num_lines-1)*14], 
-                   sizeof(GLfloat)*14);
+                   sizeof(float)*14);
             --num_lines;
         } else {
             ++i;
@@ -82,7 +78,9 @@ int DebugDrawLines::AllocMemory(void* mem) {
 static const int s_pos_x = 1 << 0, s_pos_y = 1 << 1, s_pos_z = 1 << 2;
 static const int e_pos_x = 1 << 3, e_pos_y = 1 << 4, e_pos_z = 1 << 5;
 
-static void AddBBLine(DebugDrawLines* lines, const glm::mat4& mat, glm::vec3 bb[], int flags) {
+static void AddBBLine(DebugDrawLines* lines, const glm::mat4& mat, glm::vec3 bb[], int flags,
+                      DebugDrawLifetime lifetime, int lifetime_int) 
+{
     glm::vec3 points[2];
     points[0][0] = (flags & s_pos_x)?bb[1][0]:bb[0][0];
     points[0][1] = (flags & s_pos_y)?bb[1][1]:bb[0][1];
@@ -92,25 +90,33 @@ static void AddBBLine(DebugDrawLines* lines, const glm::mat4& mat, glm::vec3 bb[
     points[1][2] = (flags & e_pos_z)?bb[1][2]:bb[0][2];
     lines->Add(glm::vec3(mat*glm::vec4(points[0],1.0f)), 
         glm::vec3(mat*glm::vec4(points[1],1.0f)), 
-        glm::vec4(1.0f), kPersistent, 1);
+        glm::vec4(1.0f), lifetime, lifetime_int);
 }
 
-void DrawBoundingBox(DebugDrawLines* lines, const glm::mat4& mat, glm::vec3 bb[]) {
+void DrawBoundingBox(DebugDrawLines* lines, const glm::mat4& mat, glm::vec3 bb[],
+                     DebugDrawLifetime lifetime, int lifetime_int) 
+{
     static const int s_neg_x = 0, s_neg_y = 0, s_neg_z = 0;
     static const int e_neg_x = 0, e_neg_y = 0, e_neg_z = 0;
-    // Neg Y square
-    AddBBLine(lines, mat, bb, s_neg_x | s_neg_y | s_neg_z | e_pos_x | e_neg_y | e_neg_z);
-    AddBBLine(lines, mat, bb, s_pos_x | s_neg_y | s_neg_z | e_pos_x | e_neg_y | e_pos_z);
-    AddBBLine(lines, mat, bb, s_pos_x | s_neg_y | s_pos_z | e_neg_x | e_neg_y | e_pos_z);
-    AddBBLine(lines, mat, bb, s_neg_x | s_neg_y | s_pos_z | e_neg_x | e_neg_y | e_neg_z);
-    // Pos Y square
-    AddBBLine(lines, mat, bb, s_neg_x | s_pos_y | s_neg_z | e_pos_x | e_pos_y | e_neg_z);
-    AddBBLine(lines, mat, bb, s_pos_x | s_pos_y | s_neg_z | e_pos_x | e_pos_y | e_pos_z);
-    AddBBLine(lines, mat, bb, s_pos_x | s_pos_y | s_pos_z | e_neg_x | e_pos_y | e_pos_z);
-    AddBBLine(lines, mat, bb, s_neg_x | s_pos_y | s_pos_z | e_neg_x | e_pos_y | e_neg_z);
-    // Neg Y to Pos Y
-    AddBBLine(lines, mat, bb, s_neg_x | s_neg_y | s_neg_z | e_neg_x | e_pos_y | e_neg_z);
-    AddBBLine(lines, mat, bb, s_pos_x | s_neg_y | s_neg_z | e_pos_x | e_pos_y | e_neg_z);
-    AddBBLine(lines, mat, bb, s_pos_x | s_neg_y | s_pos_z | e_pos_x | e_pos_y | e_pos_z);
-    AddBBLine(lines, mat, bb, s_neg_x | s_neg_y | s_pos_z | e_neg_x | e_pos_y | e_pos_z);
+    static const int kNumEdges = 12;
+    static const int edges[kNumEdges] = {
+        // Neg Y square
+        s_neg_x | s_neg_y | s_neg_z | e_pos_x | e_neg_y | e_neg_z,
+        s_pos_x | s_neg_y | s_neg_z | e_pos_x | e_neg_y | e_pos_z,
+        s_pos_x | s_neg_y | s_pos_z | e_neg_x | e_neg_y | e_pos_z,
+        s_neg_x | s_neg_y | s_pos_z | e_neg_x | e_neg_y | e_neg_z,
+        // Pos Y square
+        s_neg_x | s_pos_y | s_neg_z | e_pos_x | e_pos_y | e_neg_z,
+        s_pos_x | s_pos_y | s_neg_z | e_pos_x | e_pos_y | e_pos_z,
+        s_pos_x | s_pos_y | s_pos_z | e_neg_x | e_pos_y | e_pos_z,
+        s_neg_x | s_pos_y | s_pos_z | e_neg_x | e_pos_y | e_neg_z,
+        // Neg Y to Pos Y
+        s_neg_x | s_neg_y | s_neg_z | e_neg_x | e_pos_y | e_neg_z,
+        s_pos_x | s_neg_y | s_neg_z | e_pos_x | e_pos_y | e_neg_z,
+        s_pos_x | s_neg_y | s_pos_z | e_pos_x | e_pos_y | e_pos_z,
+        s_neg_x | s_neg_y | s_pos_z | e_neg_x | e_pos_y | e_pos_z
+    };
+    for(int i=0; i<kNumEdges; ++i){
+        AddBBLine(lines, mat, bb, edges[i], lifetime, lifetime_int);
+    }
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 
 #include "glm/fwd.hpp"
 
+struct StreamBuffer;
+
 enum DebugDrawLifetime {
     kUpdate,
     kDraw,
@@ -17,7 +19,7 @@ struct DebugDrawCommon {
 
 struct DebugDrawLines {
     int shader;
-    int vbo;
+    StreamBuffer* stream_buffer;
     static const int kMaxLines = 10000;
     static const int kElementsPerPoint = 7; // Interleaved 3V4C
     DebugDrawCommon* common;
@@ -26,9 +28,10 @@ struct DebugDrawLines {
     int AllocMemory(void* memory);
     bool Add(const glm::vec3& start, const glm::vec3& end, 
              const glm::vec4& color, DebugDrawLifetime lifetime, int lifetime_int);
-    void Draw(const glm::mat4& proj_view_mat);
+    void Draw();
 };
 
-void DrawBoundingBox(DebugDrawLines* lines, const glm::mat4& mat, glm::vec3 bb[]);
+void DrawBoundingBox(DebugDrawLines* lines, const glm::mat4& mat, glm::vec3 bb[],
+                     DebugDrawLifetime lifetime, int lifetime_int);
 
 #endif
\ No newline at end of file
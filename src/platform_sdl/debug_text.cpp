@@ -7,95 +7,137 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "internal/common.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 
-void DrawText(TextAtlas *text_atlas, GraphicsContext* context, float x, float y, char *text) {
-    CHECK_GL_ERROR();
-    static const int kMaxDrawStringLength = 1024;
-    GLfloat vert_data[kMaxDrawStringLength*16]; // Four verts per character, 2V 2T per vert
-    GLuint index_data[kMaxDrawStringLength*6]; // Two tris per character
-    int num_draw_chars = 0;
-    int vert_index=0, index_index=0;
-    for(char* text_iter = text; *text_iter != '\0'; ++text_iter) {
-        if (*text_iter >= 32 && *text_iter < 128 && num_draw_chars < kMaxDrawStringLength) {
-            int vert_ref = num_draw_chars*4;
-            ++num_draw_chars;
-            stbtt_aligned_quad q;
-            stbtt_GetBakedQuad(text_atlas->cdata, 512, 512, *text_iter-32, &x, &y, &q, 1);
-            vert_data[vert_index++] = q.x0;
-            vert_data[vert_index++] = q.y0;
-            vert_data[vert_index++] = q.s0;
-            vert_data[vert_index++] = q.t0;
+void InitTextAtlasBuffers(TextAtlas* text_atlas, StreamBuffer* stream_buffer) {
+    static const int kMaxQuads = TextAtlas::kMaxDrawQuads;
+    GLuint* index_data = (GLuint*)malloc(kMaxQuads*sizeof(GLuint)*6);
+    for(int i=0; i<kMaxQuads; ++i){
+        index_data[i*6+0] = i*4 + 0;
+        index_data[i*6+1] = i*4 + 1;
+        index_data[i*6+2] = i*4 + 2;
+        index_data[i*6+3] = i*4 + 0;
+        index_data[i*6+4] = i*4 + 2;
+        index_data[i*6+5] = i*4 + 3;
+    }
+    text_atlas->index_vbo = CreateVBO(kElementVBO, kStaticVBO, index_data, kMaxQuads*sizeof(GLuint)*6);
+    free(index_data);
+    text_atlas->stream_buffer = stream_buffer;
+}
 
-            vert_data[vert_index++] = q.x1;
-            vert_data[vert_index++] = q.y0;
-            vert_data[vert_index++] = q.s1;
-            vert_data[vert_index++] = q.t0;
+// Lays out printable characters from the origin, returns the number of quads
+static int LayoutText(TextAtlas* text_atlas, const char* text, 
+                      stbtt_aligned_quad* quads, int max_quads)
+{
+    float x = 0.0f, y = 0.0f;
+    int num_quads = 0;
+    for(const char* text_iter = text; *text_iter != '\0' && num_quads < max_quads; ++text_iter) {
+        if (*text_iter >= 32 && *text_iter < 128) {
+            stbtt_GetBakedQuad(text_atlas->cdata, 512, 512, *text_iter-32, &x, &y, 
+                               &quads[num_quads++], 1);
+        }
+    }
+    return num_quads;
+}
 
-            vert_data[vert_index++] = q.x1;
-            vert_data[vert_index++] = q.y1;
-            vert_data[vert_index++] = q.s1;
-            vert_data[vert_index++] = q.t1;
+// Four verts per quad, 2V 2T per vert. x and y should be whole pixels so 
+// the glyphs stay aligned with the atlas texels.
+static GLfloat* WriteQuads(const stbtt_aligned_quad* quads, int num_quads, 
+                           float x, float y, GLfloat* vert_data)
+{
+    for(int i=0; i<num_quads; ++i){
+        const stbtt_aligned_quad& q = quads[i];
+        *(vert_data++) = q.x0 + x;
+        *(vert_data++) = q.y0 + y;
+        *(vert_data++) = q.s0;
+        *(vert_data++) = q.t0;
 
-            vert_data[vert_index++] = q.x0;
-            vert_data[vert_index++] = q.y1;
-            vert_data[vert_index++] = q.s0;
-            vert_data[vert_index++] = q.t1;
+        *(vert_data++) = q.x1 + x;
+        *(vert_data++) = q.y0 + y;
+        *(vert_data++) = q.s1;
+        *(vert_data++) = q.t0;
 
-            index_data[index_index++] = vert_ref + 0;
-            index_data[index_index++] = vert_ref + 1;
-            index_data[index_index++] = vert_ref + 2;
+        *(vert_data++) = q.x1 + x;
+        *(vert_data++) = q.y1 + y;
+        *(vert_data++) = q.s1;
+        *(vert_data++) = q.t1;
 
-            index_data[index_index++] = vert_ref + 0;
-            index_data[index_index++] = vert_ref + 2;
-            index_data[index_index++] = vert_ref + 3;
-        }
+        *(vert_data++) = q.x0 + x;
+        *(vert_data++) = q.y1 + y;
+        *(vert_data++) = q.s0;
+        *(vert_data++) = q.t1;
     }
-    CHECK_GL_ERROR();
+    return vert_data;
+}
 
-    glm::mat4 proj_mat = glm::ortho(0.0f, (float)context->screen_dims[0], 
-        (float)context->screen_dims[1], 0.0f, -1.0f, 1.0f);
-    CHECK_GL_ERROR();
-    GLuint proj_mat_uniform = glGetUniformLocation(text_atlas->shader, "proj_mat");
-    CHECK_GL_ERROR();
-    GLuint texture_uniform = glGetUniformLocation(text_atlas->shader, "texture_id");
-    CHECK_GL_ERROR();
-    glUseProgram(text_atlas->shader);
-    CHECK_GL_ERROR();
-    glUniformMatrix4fv(proj_mat_uniform, 1, false, (GLfloat*)&proj_mat);
-    CHECK_GL_ERROR();
-    glUniform1i(texture_uniform, 0);
-    CHECK_GL_ERROR();
-    glActiveTexture(GL_TEXTURE0);
-    CHECK_GL_ERROR();
-    glBindTexture(GL_TEXTURE_2D, text_atlas->texture);
-    CHECK_GL_ERROR();
+static void DrawQuads(TextAtlas* text_atlas, int offset, int num_quads) {
+    // Screen projection comes from the PerFrame uniform block, and the 
+    // sampler unit was assigned when the program was created
+    BindTexture(0, kCommandTexture2D, text_atlas->texture);
+    DrawUnbatched(text_atlas->shader, kInterleave_2V2T, text_atlas->stream_buffer->vbo, offset, 
+                  text_atlas->index_vbo, kDrawTriangles, num_quads*6);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, text_atlas->vert_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_draw_chars*sizeof(GLfloat)*16, vert_data, GL_STREAM_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, text_atlas->index_vbo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_draw_chars*sizeof(GLuint)*6, index_data, GL_STREAM_DRAW);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)(2*sizeof(GLfloat)));
-    glDrawElements(GL_TRIANGLES, num_draw_chars*6, GL_UNSIGNED_INT, 0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glUseProgram(0);
+void DrawText(TextAtlas *text_atlas, float x, float y, char *text) {
+    CHECK_GL_ERROR();
+    static const int kMaxQuads = DebugTextEntry::kDebugTextStrMaxLen;
+    stbtt_aligned_quad quads[kMaxQuads];
+    int num_quads = LayoutText(text_atlas, text, quads, kMaxQuads);
+    if(num_quads == 0){
+        return;
+    }
+    int offset;
+    GLfloat* vert_data = (GLfloat*)StreamBufferMap(text_atlas->stream_buffer, 
+        num_quads*sizeof(GLfloat)*16, &offset);
+    if(!vert_data){
+        return;
+    }
+    WriteQuads(quads, num_quads, floorf(x + 0.5f), floorf(y + 0.5f), vert_data);
+    StreamBufferUnmap(text_atlas->stream_buffer);
+    DrawQuads(text_atlas, offset, num_quads);
     CHECK_GL_ERROR();
 }
 
-void DebugText::Draw(GraphicsContext* context, float time) {
-    int num_draw = 0;
+void DebugText::Draw(float time) {
+    int total_quads = 0;
     for(int i=0; i<kMaxDebugTextEntries; ++i){
         DebugTextEntry& entry = entries[i];
         if(entry.display && time < entry.fade_time){
-            DrawText(text_atlas, context, 40.0f, 40.0f + num_draw * text_atlas->pixel_height * 1.15f, entry.str);
+            if(entry.num_quads == -1){
+                entry.num_quads = LayoutText(text_atlas, entry.str, entry.quads, 
+                                             DebugTextEntry::kDebugTextStrMaxLen);
+            }
+            total_quads += entry.num_quads;
+        }
+    }
+    if(total_quads > TextAtlas::kMaxDrawQuads){
+        total_quads = TextAtlas::kMaxDrawQuads;
+    }
+    if(total_quads == 0){
+        return;
+    }
+    int offset;
+    GLfloat* vert_data = (GLfloat*)StreamBufferMap(text_atlas->stream_buffer, 
+        total_quads*sizeof(GLfloat)*16, &offset);
+    if(!vert_data){
+        return;
+    }
+    int num_draw = 0, num_written = 0;
+    for(int i=0; i<kMaxDebugTextEntries && num_written < total_quads; ++i){
+        DebugTextEntry& entry = entries[i];
+        if(entry.display && time < entry.fade_time){
+            int num_quads = min(entry.num_quads, total_quads - num_written);
+            float y = floorf(40.0f + num_draw * text_atlas->pixel_height * 1.15f + 0.5f);
+            vert_data = WriteQuads(entry.quads, num_quads, 40.0f, y, vert_data);
+            num_written += num_quads;
             ++num_draw;
         }
     }
+    StreamBufferUnmap(text_atlas->stream_buffer);
+    DrawQuads(text_atlas, offset, total_quads);
+    CHECK_GL_ERROR();
 }
 
 void DebugText::Init(TextAtlas* p_text_atlas) {
@@ -105,6 +147,8 @@ void DebugText::Init(TextAtlas* p_text_atlas) {
     }
     for(int i=0; i<kMaxDebugTextEntries; ++i){
         entries[i].display = false;
+        entries[i].str[0] = '\0';
+        entries[i].num_quads = 0;
     }
     free_queue_start = 0;
     free_queue_end = kMaxDebugTextEntries-1;
@@ -130,8 +174,14 @@ void DebugText::ReleaseDebugTextHandle(int handle) {
 
 void DebugText::UpdateDebugTextV(int handle, float fade_time, const char* fmt, va_list args) {
     SDL_assert(handle >= 0 && handle < kMaxDebugTextEntries && entries[handle].display);
-    VFormatString(entries[handle].str, DebugTextEntry::kDebugTextStrMaxLen, fmt, args);
-    entries[handle].fade_time = fade_time;
+    DebugTextEntry& entry = entries[handle];
+    char str[DebugTextEntry::kDebugTextStrMaxLen];
+    VFormatString(str, DebugTextEntry::kDebugTextStrMaxLen, fmt, args);
+    if(strcmp(str, entry.str) != 0){
+        strcpy(entry.str, str);
+        entry.num_quads = -1;
+    }
+    entry.fade_time = fade_time;
 }
 
 
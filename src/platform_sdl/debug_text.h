@@ -5,22 +5,28 @@
 #include "stb_truetype.h"
 #include <cstdio>
 
-struct GraphicsContext;
+struct StreamBuffer;
 
 struct TextAtlas {
+    static const int kMaxDrawQuads = 4096; // Per draw call
     stbtt_bakedchar cdata[96]; // ASCII 32..126 is 95 glyphs
     int texture;
     int shader;
-    int vert_vbo;
-    int index_vbo;
+    StreamBuffer* stream_buffer; // Quads are written straight into this
+    int index_vbo; // Two tris per quad, enough for kMaxDrawQuads
     float pixel_height;
 };
 
+void InitTextAtlasBuffers(TextAtlas* text_atlas, StreamBuffer* stream_buffer);
+
 struct DebugTextEntry {
     bool display;
     static const int kDebugTextStrMaxLen = 512;
     float fade_time;
     char str[kDebugTextStrMaxLen];
+    // Glyphs laid out from the origin, rebuilt in Draw only when str changes
+    int num_quads; // -1 if out of date
+    stbtt_aligned_quad quads[kDebugTextStrMaxLen];
 };
 
 class DebugText {
@@ -37,9 +43,10 @@ public:
     void UpdateDebugText(int handle, float fade_time, const char* fmt, ...);
     void UpdateDebugTextV(int handle, float fade_time, const char* fmt, va_list args);
     void ReleaseDebugTextHandle(int handle);
-    void Draw(GraphicsContext* context, float time);
+    // All visible entries go out in one draw call
+    void Draw(float time);
 };
 
-void DrawText(TextAtlas *text_atlas, GraphicsContext* context, float x, float y, char *text);
+void DrawText(TextAtlas *text_atlas, float x, float y, char *text);
 
 #endif
\ No newline at end of file
@@ -10,5 +10,7 @@ void FormattedError(const char* title, const char* msg_fmt, ...) {
     va_start(args, msg_fmt);
     VFormatString(error_msg, kBufSize, msg_fmt, args);
     va_end(args);
+    // Headless runs have nowhere to show the box
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s: %s", title, error_msg);
     SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, title, error_msg, NULL);
 }
\ No newline at end of file
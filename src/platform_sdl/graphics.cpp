@@ -2,20 +2,53 @@
 #include "platform_sdl/error.h"
 #include "platform_sdl/file_io.h"
 #include "platform_sdl/profiler.h"
+#include "internal/command_list.h"
+#include "internal/common.h"
+#include "internal/dds.h"
+#include "internal/mipmap.h"
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <cstring>
 #include <cstdlib>
+#include <stdint.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 //TODO: these should all be in a config or something
 static const int kMSAA = 4;
 static const float kMaxAnisotropy = 4.0f;
+// Mips are sampled down to this size on the shorter side, and no further
+static const int kMinSampledMipSize = 16;
+static const bool kRunMipmapBenchmark = false;
 
 using namespace glm;
 
+static GraphicsBackend graphics_backend = kGraphicsBackendGL;
+static GraphicsStats graphics_stats;
+static int null_next_id = 0;
+
+static bool IsNullBackend() {
+    return graphics_backend == kGraphicsBackendNull;
+}
+
+// Null backend ids count up from 1, since 0 means none
+static int CreateNullObject() {
+    ++graphics_stats.objects_created;
+    return ++null_next_id;
+}
+
+const GraphicsStats& GetGraphicsStats() {
+    return graphics_stats;
+}
+
+void ResetGraphicsStats() {
+    memset(&graphics_stats, 0, sizeof(graphics_stats));
+}
+
 void CheckGLError(const char *file, int line) {
+    if(IsNullBackend()){
+        return;
+    }
     GLenum err;
     err = glGetError();
     if (err != GL_NO_ERROR)    {
@@ -35,7 +68,12 @@ void CheckGLError(const char *file, int line) {
     }
 }
 
-int CreateShader(int type, const char *src) {
+int CreateShader(ShaderStage stage, const char *src) {
+    if(IsNullBackend()){
+        return CreateNullObject();
+    }
+    static const GLenum kShaderTypes[] = {GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER};
+    GLenum type = kShaderTypes[stage];
     GLuint shader = glCreateShader(type);
     glShaderSource(shader, 1, &src, NULL);
     glCompileShader(shader);
@@ -60,11 +98,24 @@ int CreateShader(int type, const char *src) {
     return shader;
 }
 
+void DeleteShader(int shader) {
+    if(!IsNullBackend()){
+        glDeleteShader(shader);
+    }
+}
+
  int CreateProgram(const int shaders[], int num_shaders) {
+    if(IsNullBackend()){
+        return CreateNullObject();
+    }
     int program = glCreateProgram();
     for(int i=0; i<num_shaders; ++i) {
         glAttachShader(program, shaders[i]);
     }
+    if(GLEW_ARB_get_program_binary){
+        // So ProgramCache can save it
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(program);
     GLint status;
     glGetProgramiv(program, GL_LINK_STATUS, &status);
@@ -81,33 +132,490 @@ int CreateShader(int type, const char *src) {
     return program;
 }
 
- int CreateVBO(VBO_Type type, VBO_Hint hint, void* data, int data_size_bytes) {
-     int type_val;
-     switch(type){
-     case kArrayVBO: type_val = GL_ARRAY_BUFFER; break;
-     case kElementVBO: type_val = GL_ELEMENT_ARRAY_BUFFER; break;
-     default:
-         FormattedError("Invalid VBO type", "CreateStaticVBO called with bad type");
-         exit(1);
-     }
-     int hint_val;
-     switch(hint){
-     case kDynamicVBO: hint_val = GL_DYNAMIC_DRAW; break;
-     case kStaticVBO: hint_val = GL_STATIC_DRAW; break;
-     case kStreamVBO: hint_val = GL_STREAM_DRAW; break;
-     default:
-         FormattedError("Invalid VBO hint", "CreateStaticVBO called with bad hint");
-         exit(1);
-     }
-     GLuint u_vbo;
-     glGenBuffers(1, &u_vbo);
-     glBindBuffer(type_val, u_vbo);
-     if(data_size_bytes > 0){
-         glBufferData(type_val, data_size_bytes, data, hint_val);
-     }
-     glBindBuffer(type_val, 0);
-     return (int)u_vbo;
- }
+static const char* kShaderUniformNames[kNumShaderUniforms] = {
+    "instance_base",
+    "dual_quaternion_skinning"
+};
+
+// Samplers never change unit, so they are assigned once here
+struct SamplerUnit {
+    const char* name;
+    int unit;
+};
+static const SamplerUnit kSamplerUnits[] = {
+    {"texture_id", 0},
+    {"instance_data", 1},
+    {"lights", 2},
+    {"light_clusters", 3},
+    {"light_indices", 4}
+};
+static const int kNumSamplerUnits = sizeof(kSamplerUnits) / sizeof(kSamplerUnits[0]);
+
+static int HashName(const char* name) {
+    return djb2_hash((unsigned char*)name);
+}
+
+static int FindLocation(const int* hashes, const char (*names)[ShaderProgram::kMaxNameLen], 
+                        const int* locations, int num, const char* name) 
+{
+    int hash = HashName(name);
+    for(int i=0; i<num; ++i){
+        if(hashes[i] == hash && strcmp(names[i], name) == 0){
+            return locations[i];
+        }
+    }
+    return -1;
+}
+
+// Uniforms and attributes share the same limits, and going over either
+// would leave draws silently missing inputs
+static void AddReflected(int* hashes, char (*names)[ShaderProgram::kMaxNameLen], 
+                         int* locations, int* num, const char* name, int location, 
+                         const char* kind)
+{
+    if(*num == ShaderProgram::kMaxReflected){
+        FormattedError("Too many shader inputs", "Program has more than %d active %s", 
+                       ShaderProgram::kMaxReflected, kind);
+        exit(1);
+    }
+    int index = (*num)++;
+    hashes[index] = HashName(name);
+    strcpy(names[index], name);
+    locations[index] = location;
+}
+
+int ShaderProgram::GetUniformLocation(const char* name) const {
+    return FindLocation(uniform_hashes, uniform_names, uniform_locations, num_uniforms, name);
+}
+
+int ShaderProgram::GetAttribLocation(const char* name) const {
+    return FindLocation(attrib_hashes, attrib_names, attrib_locations, num_attribs, name);
+}
+
+void CreateShaderProgram(ShaderProgram* shader_program, int program) {
+    shader_program->program = program;
+    if(IsNullBackend()){
+        // Nothing to reflect, so every uniform reads as inactive
+        shader_program->num_uniforms = 0;
+        shader_program->num_attribs = 0;
+        for(int i=0; i<kNumShaderUniforms; ++i){
+            shader_program->uniforms[i] = -1;
+        }
+        return;
+    }
+    static const int kMaxNameLen = ShaderProgram::kMaxNameLen;
+    char name[kMaxNameLen];
+    GLint num_active;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_active);
+    GLint max_name_len;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_len);
+    if(max_name_len > kMaxNameLen){
+        FormattedError("Uniform name too long", "Program has a uniform name longer than %d", 
+                       kMaxNameLen - 1);
+        exit(1);
+    }
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_name_len);
+    if(max_name_len > kMaxNameLen){
+        FormattedError("Attribute name too long", "Program has an attribute name longer than %d", 
+                       kMaxNameLen - 1);
+        exit(1);
+    }
+    shader_program->num_uniforms = 0;
+    for(int i=0; i<num_active; ++i){
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, i, kMaxNameLen, NULL, &size, &type, name);
+        GLint location = glGetUniformLocation(program, name);
+        if(location == -1){
+            continue; // Uniform block member, set through the buffer instead
+        }
+        // Arrays are reported as "name[0]", look them up by the bare name
+        char* bracket = strchr(name, '[');
+        if(bracket){
+            *bracket = '\0';
+        }
+        AddReflected(shader_program->uniform_hashes, shader_program->uniform_names,
+                     shader_program->uniform_locations, &shader_program->num_uniforms,
+                     name, location, "uniforms");
+    }
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &num_active);
+    shader_program->num_attribs = 0;
+    for(int i=0; i<num_active; ++i){
+        GLint size;
+        GLenum type;
+        glGetActiveAttrib(program, i, kMaxNameLen, NULL, &size, &type, name);
+        AddReflected(shader_program->attrib_hashes, shader_program->attrib_names,
+                     shader_program->attrib_locations, &shader_program->num_attribs,
+                     name, glGetAttribLocation(program, name), "attributes");
+    }
+    for(int i=0; i<kNumShaderUniforms; ++i){
+        shader_program->uniforms[i] = shader_program->GetUniformLocation(kShaderUniformNames[i]);
+    }
+    glUseProgram(program);
+    for(int i=0; i<kNumSamplerUnits; ++i){
+        int location = shader_program->GetUniformLocation(kSamplerUnits[i].name);
+        if(location != -1){
+            glUniform1i(location, kSamplerUnits[i].unit);
+        }
+    }
+    glUseProgram(0);
+    GLuint block_index = glGetUniformBlockIndex(program, "PerFrame");
+    if(block_index != GL_INVALID_INDEX){
+        glUniformBlockBinding(program, block_index, kPerFrameUniformBinding);
+    }
+    CHECK_GL_ERROR();
+}
+
+static GLenum GetVBOTarget(VBO_Type type) {
+    switch(type){
+    case kArrayVBO: return GL_ARRAY_BUFFER;
+    case kElementVBO: return GL_ELEMENT_ARRAY_BUFFER;
+    case kTextureVBO: return GL_TEXTURE_BUFFER;
+    case kUniformVBO: return GL_UNIFORM_BUFFER;
+    }
+    FormattedError("Invalid VBO type", "VBO created or updated with bad type");
+    exit(1);
+}
+
+static GLenum GetVBOUsage(VBO_Hint hint) {
+    switch(hint){
+    case kDynamicVBO: return GL_DYNAMIC_DRAW;
+    case kStaticVBO: return GL_STATIC_DRAW;
+    case kStreamVBO: return GL_STREAM_DRAW;
+    }
+    FormattedError("Invalid VBO hint", "VBO created or updated with bad hint");
+    exit(1);
+}
+
+int CreateVBO(VBO_Type type, VBO_Hint hint, void* data, int data_size_bytes) {
+    if(IsNullBackend()){
+        graphics_stats.upload_bytes += max(0, data_size_bytes);
+        return CreateNullObject();
+    }
+    GLenum target = GetVBOTarget(type);
+    GLuint u_vbo;
+    glGenBuffers(1, &u_vbo);
+    glBindBuffer(target, u_vbo);
+    if(data_size_bytes > 0){
+        glBufferData(target, data_size_bytes, data, GetVBOUsage(hint));
+    }
+    glBindBuffer(target, 0);
+    return (int)u_vbo;
+}
+
+void UpdateVBO(VBO_Type type, VBO_Hint hint, int vbo, const void* data, int num_bytes) {
+    if(IsNullBackend()){
+        graphics_stats.upload_bytes += num_bytes;
+        return;
+    }
+    GLenum target = GetVBOTarget(type);
+    glBindBuffer(target, vbo);
+    glBufferData(target, num_bytes, data, GetVBOUsage(hint));
+    glBindBuffer(target, 0);
+}
+
+void BindUniformBuffer(int binding, int vbo) {
+    if(!IsNullBackend()){
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, vbo);
+    }
+}
+
+// Points the attributes at the bound GL_ARRAY_BUFFER starting at offset.
+// Returns how many there are, to enable or disable.
+static int SetVertexAttributes(VBO_Setup layout, int offset) {
+    static const int kMaxAttribs = 5;
+    static const struct {
+        VBO_Setup layout;
+        int sizes[kMaxAttribs]; // Floats per attribute, 0 past the last
+    } kLayouts[] = {
+        {kSimple_3V, {3}},
+        {kSimple_4V, {4}},
+        {kInterleave_2V2T, {2, 2}},
+        {kInterleave_3V4C, {3, 4}},
+        {kInterleave_3V2T3N, {3, 2, 3}},
+        {kInterleave_3V2T3N1L, {3, 2, 3, 1}},
+        {kInterleave_3V2T3N4I4W, {3, 2, 3, 4, 4}}
+    };
+    static const int kNumLayouts = sizeof(kLayouts) / sizeof(kLayouts[0]);
+    for(int i=0; i<kNumLayouts; ++i){
+        if(kLayouts[i].layout != layout){
+            continue;
+        }
+        const int* sizes = kLayouts[i].sizes;
+        int stride = 0, num_attribs = 0;
+        for(; num_attribs<kMaxAttribs && sizes[num_attribs]; ++num_attribs){
+            stride += sizes[num_attribs] * sizeof(GLfloat);
+        }
+        for(int j=0; j<num_attribs; ++j){
+            glVertexAttribPointer(j, sizes[j], GL_FLOAT, GL_FALSE, stride, (void*)(intptr_t)offset);
+            offset += sizes[j] * sizeof(GLfloat);
+        }
+        return num_attribs;
+    }
+    FormattedError("Invalid VBO setup", "Vertex attributes requested for bad layout");
+    exit(1);
+}
+
+int CreateVertexArray(VBO_Setup layout, int vert_vbo, int index_vbo) {
+    if(IsNullBackend()){
+        return CreateNullObject();
+    }
+    GLint prev_vao;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vert_vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
+    int num_attribs = SetVertexAttributes(layout, 0);
+    for(int i=0; i<num_attribs; ++i){
+        glEnableVertexAttribArray(i);
+    }
+    glBindVertexArray(prev_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    CHECK_GL_ERROR();
+    return vao;
+}
+
+void CreateTextureBuffer(TextureBuffer* texture_buffer, int size_bytes) {
+    texture_buffer->size_bytes = size_bytes;
+    texture_buffer->vbo = CreateVBO(kTextureVBO, kStreamVBO, NULL, size_bytes);
+    if(IsNullBackend()){
+        texture_buffer->texture = CreateNullObject();
+        return;
+    }
+    GLuint tmp_texture;
+    glGenTextures(1, &tmp_texture);
+    texture_buffer->texture = tmp_texture;
+    glBindTexture(GL_TEXTURE_BUFFER, texture_buffer->texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, texture_buffer->vbo);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    CHECK_GL_ERROR();
+}
+
+void UpdateTextureBuffer(const TextureBuffer& texture_buffer, int offset, const void* data, 
+                         int num_bytes) 
+{
+    if(IsNullBackend()){
+        graphics_stats.upload_bytes += num_bytes;
+        return;
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, texture_buffer.vbo);
+    if(offset == 0){
+        glBufferData(GL_TEXTURE_BUFFER, texture_buffer.size_bytes, NULL, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_TEXTURE_BUFFER, offset, num_bytes, data);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void CreateStreamBuffer(StreamBuffer* stream_buffer, int segment_size) {
+    stream_buffer->segment_size = segment_size;
+    stream_buffer->segment = 0;
+    stream_buffer->head = 0;
+    for(int i=0; i<StreamBuffer::kNumSegments; ++i){
+        stream_buffer->fences[i] = NULL;
+    }
+    int size_bytes = segment_size * StreamBuffer::kNumSegments;
+    if(IsNullBackend()){
+        // Still written every frame, so the cost of filling it shows up
+        stream_buffer->vbo = CreateNullObject();
+        stream_buffer->persistent_map = (unsigned char*)malloc(size_bytes);
+        if(!stream_buffer->persistent_map){
+            FormattedError("Malloc failed", "Could not allocate %d bytes for stream buffer", size_bytes);
+            exit(1);
+        }
+        return;
+    }
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    stream_buffer->vbo = vbo;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if(GLEW_ARB_buffer_storage){
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size_bytes, NULL, flags);
+        stream_buffer->persistent_map = 
+            (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size_bytes, flags);
+        if(!stream_buffer->persistent_map){
+            FormattedError("glMapBufferRange failed", "Could not map stream buffer");
+            exit(1);
+        }
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, size_bytes, NULL, GL_STREAM_DRAW);
+        stream_buffer->persistent_map = NULL;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    CHECK_GL_ERROR();
+}
+
+void StreamBufferBeginFrame(StreamBuffer* stream_buffer) {
+    if(IsNullBackend()){
+        stream_buffer->head = 0;
+        return;
+    }
+    GLsync fence = (GLsync)stream_buffer->fences[stream_buffer->segment];
+    if(fence){
+        while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED){
+        }
+        glDeleteSync(fence);
+        stream_buffer->fences[stream_buffer->segment] = NULL;
+    }
+    stream_buffer->head = 0;
+}
+
+void StreamBufferEndFrame(StreamBuffer* stream_buffer) {
+    if(IsNullBackend()){
+        return;
+    }
+    stream_buffer->fences[stream_buffer->segment] = 
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream_buffer->segment = (stream_buffer->segment + 1) % StreamBuffer::kNumSegments;
+}
+
+void* StreamBufferMap(StreamBuffer* stream_buffer, int num_bytes, int* offset) {
+    static const int kAlignment = 16;
+    int start = (stream_buffer->head + kAlignment - 1) & ~(kAlignment - 1);
+    if(num_bytes <= 0 || start + num_bytes > stream_buffer->segment_size){
+        return NULL;
+    }
+    stream_buffer->head = start + num_bytes;
+    *offset = stream_buffer->segment * stream_buffer->segment_size + start;
+    if(IsNullBackend()){
+        graphics_stats.upload_bytes += num_bytes;
+        return stream_buffer->persistent_map + *offset;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, stream_buffer->vbo);
+    if(stream_buffer->persistent_map){
+        return stream_buffer->persistent_map + *offset;
+    }
+    // The fence wait in StreamBufferBeginFrame already made this range safe
+    return glMapBufferRange(GL_ARRAY_BUFFER, *offset, num_bytes, GL_MAP_WRITE_BIT | 
+        GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+void StreamBufferUnmap(StreamBuffer* stream_buffer) {
+    if(!stream_buffer->persistent_map && !IsNullBackend()){
+        glBindBuffer(GL_ARRAY_BUFFER, stream_buffer->vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+}
+
+// Indexed by CommandTextureTarget
+static const GLenum kCommandTextureTargets[] = {
+    GL_TEXTURE_2D,
+    GL_TEXTURE_2D_ARRAY,
+    GL_TEXTURE_BUFFER
+};
+
+void UseProgram(int program) {
+    if(IsNullBackend()){
+        ++graphics_stats.state_changes;
+        return;
+    }
+    glUseProgram(program);
+}
+
+void BindTexture(int unit, CommandTextureTarget target, int texture) {
+    if(IsNullBackend()){
+        ++graphics_stats.state_changes;
+        return;
+    }
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(kCommandTextureTargets[target], texture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void BindVertexArray(int vao) {
+    if(IsNullBackend()){
+        ++graphics_stats.state_changes;
+        return;
+    }
+    glBindVertexArray(vao);
+}
+
+// Counts what the list would have done
+static void ExecuteCommandListNull(const CommandList& command_list) {
+    for(int i=0; i<command_list.num_commands; ++i){
+        const Command& command = command_list.commands[i];
+        switch(command.type){
+        case kCommandUseProgram:
+        case kCommandBindTexture:
+        case kCommandBindVertexArray:
+            ++graphics_stats.state_changes;
+            break;
+        case kCommandSetUniformInt:
+            break;
+        case kCommandDrawIndexedInstanced:
+            ++graphics_stats.draw_calls;
+            graphics_stats.instances += command.args[2];
+            graphics_stats.triangles += command.args[0] / 3 * command.args[2];
+            break;
+        }
+    }
+}
+
+void ExecuteCommandList(const CommandList& command_list) {
+    if(IsNullBackend()){
+        ExecuteCommandListNull(command_list);
+        return;
+    }
+    for(int i=0; i<command_list.num_commands; ++i){
+        const Command& command = command_list.commands[i];
+        const int* args = command.args;
+        switch(command.type){
+        case kCommandUseProgram:
+            glUseProgram(args[0]);
+            break;
+        case kCommandBindTexture:
+            glActiveTexture(GL_TEXTURE0 + args[0]);
+            glBindTexture(kCommandTextureTargets[args[1]], args[2]);
+            break;
+        case kCommandBindVertexArray:
+            glBindVertexArray(args[0]);
+            break;
+        case kCommandSetUniformInt:
+            glUniform1i(args[0], args[1]);
+            break;
+        case kCommandDrawIndexedInstanced:
+            glDrawElementsInstanced(GL_TRIANGLES, args[0], GL_UNSIGNED_INT, 
+                                    (void*)(args[1] * sizeof(GLuint)), args[2]);
+            break;
+        }
+    }
+    glActiveTexture(GL_TEXTURE0);
+    CHECK_GL_ERROR();
+}
+
+void DrawUnbatched(int program, VBO_Setup layout, int vbo, int vbo_offset, int index_vbo,
+                   DrawPrimitive primitive, int count) 
+{
+    if(IsNullBackend()){
+        ++graphics_stats.state_changes;
+        ++graphics_stats.draw_calls;
+        ++graphics_stats.instances;
+        graphics_stats.triangles += (primitive == kDrawTriangles) ? count / 3 : 0;
+        return;
+    }
+    GLenum mode = (primitive == kDrawTriangles) ? GL_TRIANGLES : GL_LINES;
+    glUseProgram(program);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    int num_attribs = SetVertexAttributes(layout, vbo_offset);
+    for(int i=0; i<num_attribs; ++i){
+        glEnableVertexAttribArray(i);
+    }
+    if(index_vbo != -1){
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
+        glDrawElements(mode, count, GL_UNSIGNED_INT, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    } else {
+        glDrawArrays(mode, 0, count);
+    }
+    for(int i=0; i<num_attribs; ++i){
+        glDisableVertexAttribArray(i);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+    CHECK_GL_ERROR();
+}
 
  void InitGraphicsContext(GraphicsContext *graphics_context) {
     static const bool kForceModernOpenGL = true;
@@ -166,6 +674,41 @@ int CreateShader(int type, const char *src) {
     GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
+    graphics_context->default_vao = vao;
+    graphics_context->backend = kGraphicsBackendGL;
+    graphics_backend = kGraphicsBackendGL;
+}
+
+void InitNullGraphicsContext(GraphicsContext *graphics_context, int width, int height) {
+    graphics_backend = kGraphicsBackendNull;
+    ResetGraphicsStats();
+    graphics_context->backend = kGraphicsBackendNull;
+    graphics_context->screen_dims[0] = width;
+    graphics_context->screen_dims[1] = height;
+    graphics_context->window = NULL;
+    graphics_context->gl_context = NULL;
+    graphics_context->default_vao = CreateNullObject();
+}
+
+void ClearFrame(const GraphicsContext* context, const vec4& color) {
+    if(IsNullBackend()){
+        return;
+    }
+    glViewport(0, 0, context->screen_dims[0], context->screen_dims[1]);
+    glClearColor(color[0], color[1], color[2], color[3]);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void PresentFrame(GraphicsContext* context) {
+    if(context->backend == kGraphicsBackendGL){
+        SDL_GL_SwapWindow(context->window);
+    }
+}
+
+bool SupportsCompressedTextures() {
+    // Compressed data is just bytes to the null backend
+    return IsNullBackend() || GLEW_EXT_texture_compression_s3tc;
 }
 
 void InitGraphicsData(int *triangle_vbo, int *index_vbo) {
@@ -190,135 +733,358 @@ void InitGraphicsData(int *triangle_vbo, int *index_vbo) {
     CHECK_GL_ERROR();
 }
 
-void BoxFilterHalve(unsigned char* data, int channels, int old_width, int old_height) {
-    int new_width = old_width / 2;
-    int new_height = old_height / 2;
-    int temp_data_size = channels * new_width * new_height;
-    unsigned char* temp_data = (unsigned char*)malloc(temp_data_size); // TODO: no temp alloc
-    // TODO: This is very slow, make it faster once it works
-    for(int new_x=0, old_x=0, len=old_width/2; 
-        new_x<len; 
-        ++new_x, old_x+=2)
-    {
-        for(int new_y=0, old_y=0, len=old_height/2;
-            new_y<len; 
-            ++new_y, old_y+=2)
-        {
-            int old_index = (old_x + old_y * old_width) * channels;
-            int new_index = (new_x + new_y * new_width) * channels;
-            for(int k=0; k<channels; ++k){
-                temp_data[new_index+k] = (data[old_index+k] +
-                                          data[old_index+k+channels] +
-                                          data[old_index+k+channels + old_width*channels] +
-                                          data[old_index+k + old_width*channels]) / 4;
-            }
-        }
+// Asks the file loader for path and waits for it. Returns with the loader's
+// mutex locked and the file in file_load_data->memory; unlock when done.
+static void LockAndLoadFile(const char* path, FileLoadThreadData* file_load_data) {
+    int path_len = strlen(path);
+    if(path_len > FileRequest::kMaxFileRequestPathLen){
+        FormattedError("File path too long", "Path is %d characters, %d allowed", path_len, FileRequest::kMaxFileRequestPathLen);
+        exit(1);
+    }
+    if (SDL_LockMutex(file_load_data->mutex) != 0) {
+        FormattedError("SDL_LockMutex failed", "Could not lock file loader mutex: %s", SDL_GetError());
+        exit(1);
+    }
+    FileRequest* request = file_load_data->queue.AddNewRequest();
+    for(int i=0; i<path_len + 1; ++i){
+        request->path[i] = path[i];
+    }
+    request->condition = SDL_CreateCond();
+    SDL_CondWait(request->condition, file_load_data->mutex);
+    if(file_load_data->err){
+        FormattedError(file_load_data->err_title, file_load_data->err_msg);
+        exit(1);
     }
-    memcpy(data, temp_data, temp_data_size);
-    free(temp_data);
 }
 
-int GetPow2(int val, int* remainder) {
-    SDL_assert(val>0);
-    int ret = 0;
-    int test = 1;
-    while(test < val){
-        ++ret;
-        test *= 2;
+static unsigned char* DecodeImage(const char* path, FileLoadThreadData* file_load_data, 
+                                  int* x, int* y, int* comp) 
+{
+    unsigned char *data = stbi_load_from_memory((const stbi_uc*)file_load_data->memory, file_load_data->memory_len, x, y, comp, STBI_default);
+    if(!data){
+        FormattedError("Could not load image", "%s: %s", path, stbi_failure_reason());
+        exit(1);
     }
-    if(test > val){
-        test /= 2;
-        --ret;
-        *remainder = val - test;
-    } else {
-        *remainder = 0;
+    return data;
+}
+
+static GLint GetImageFormat(int comp) {
+    switch(comp){
+    case 1: return GL_LUMINANCE;
+    case 3: return GL_RGB;
+    case 4: return GL_RGBA;
+    }
+    return -1;
+}
+
+struct ImageMips {
+    MipLevel levels[kMaxMipLevels];
+    int num_levels;
+    unsigned char* storage; // Levels after 0, free when uploaded
+};
+
+static void BuildImageMips(const char* path, unsigned char* data, int x, int y, int comp, 
+                           ThreadPool* thread_pool, ImageMips* mips) 
+{
+    if(kRunMipmapBenchmark){
+        Profiler profiler;
+        profiler.Init();
+        BenchmarkMipChain(data, x, y, comp, 20, thread_pool, &profiler);
+    }
+    int storage_bytes;
+    mips->num_levels = CalcMipChainLevels(x, y, comp, NULL, mips->levels, &storage_bytes);
+    mips->storage = (unsigned char*)malloc(storage_bytes);
+    if(!mips->storage && storage_bytes > 0){
+        FormattedError("Malloc failed", "Could not allocate %d bytes for mipmaps of %s", storage_bytes, path);
+        exit(1);
     }
-    return ret;
+    CalcMipChainLevels(x, y, comp, mips->storage, mips->levels, &storage_bytes);
+    mips->levels[0].data = data;
+    GenerateMipChain(mips->levels, mips->num_levels, comp, thread_pool);
 }
 
-static void TestPow2() {
-    int test_ret, test_remainder;
-    test_ret = GetPow2(256, &test_remainder);
-    SDL_assert(test_ret == 8 && test_remainder == 0);
-    test_ret = GetPow2(8, &test_remainder);
-    SDL_assert(test_ret == 3 && test_remainder == 0);
-    test_ret = GetPow2(12, &test_remainder);
-    SDL_assert(test_ret == 3 && test_remainder == 4);
-    test_ret = GetPow2(130, &test_remainder);
-    SDL_assert(test_ret == 7 && test_remainder == 2);
+// Stops short of the tiny levels, which just blur everything to one color
+static int GetMaxSampledLevel(const MipLevel* levels, int num_levels) {
+    int max_level = 0;
+    for(int i=1; i<num_levels; ++i){
+        if(min(levels[i].width, levels[i].height) >= kMinSampledMipSize){
+            max_level = i;
+        }
+    }
+    return max_level;
 }
 
-int LoadImage(const char* path, FileLoadThreadData* file_load_data){
-    int path_len = strlen(path);
-    if(path_len > FileRequest::kMaxFileRequestPathLen){
-        FormattedError("File path too long", "Path is %d characters, %d allowed", path_len, FileRequest::kMaxFileRequestPathLen);
+static void SetMipSampling(GLenum target, int base_level, int max_level) {
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, base_level);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, max_level);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, kMaxAnisotropy);
+}
+
+// Points the levels at the blocks of a DDS written by texture_compressor
+static void ParseDDS(const char* path, int data_len, TextureSource* source) {
+    const unsigned char* data = source->image;
+    const DDSHeader* header = (const DDSHeader*)(data + sizeof(kDDSMagic));
+    if(data_len < (int)(sizeof(kDDSMagic) + sizeof(DDSHeader)) || 
+       header->size != sizeof(DDSHeader))
+    {
+        FormattedError("Invalid DDS", "Could not read header of %s", path);
         exit(1);
     }
-    int texture = -1;
-    if (SDL_LockMutex(file_load_data->mutex) == 0) {
-        FileRequest* request = file_load_data->queue.AddNewRequest();
-        for(int i=0; i<path_len + 1; ++i){
-            request->path[i] = path[i];
+    int block_bytes;
+    switch(header->pixel_format.four_cc){
+    case kDDSFourCCDXT1:
+        source->internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        block_bytes = 8;
+        break;
+    case kDDSFourCCDXT5:
+        source->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        block_bytes = 16;
+        break;
+    default:
+        FormattedError("Unsupported DDS", "%s is not DXT1 or DXT5", path);
+        exit(1);
+    }
+    source->compressed = true;
+    source->format = source->internal_format;
+    source->num_levels = (header->flags & kDDSFlagMipMapCount) ? 
+        min(kMaxMipLevels, max(1, (int)header->mip_map_count)) : 1;
+    unsigned char* level_data = source->image + sizeof(kDDSMagic) + sizeof(DDSHeader);
+    const unsigned char* end = data + data_len;
+    int dims[] = {(int)header->width, (int)header->height};
+    for(int i=0; i<source->num_levels; ++i){
+        int level_size = GetDXTLevelSize(dims[0], dims[1], block_bytes);
+        if(level_data + level_size > end){
+            FormattedError("Invalid DDS", "%s is missing mip level %d", path, i);
+            exit(1);
         }
-        request->condition = SDL_CreateCond();
-        SDL_CondWait(request->condition, file_load_data->mutex);
-        if(file_load_data->err){
-            FormattedError(file_load_data->err_title, file_load_data->err_msg);
+        source->levels[i].width = dims[0];
+        source->levels[i].height = dims[1];
+        source->levels[i].data = level_data;
+        source->level_bytes[i] = level_size;
+        level_data += level_size;
+        dims[0] = max(1, dims[0] / 2);
+        dims[1] = max(1, dims[1] / 2);
+    }
+}
+
+void ReadTextureSource(const char* path, FileLoadThreadData* file_load_data, 
+                       ThreadPool* thread_pool, TextureSource* source) 
+{
+    LockAndLoadFile(path, file_load_data);
+    if(file_load_data->memory_len >= (int)sizeof(kDDSMagic) &&
+       memcmp(file_load_data->memory, &kDDSMagic, sizeof(kDDSMagic)) == 0)
+    {
+        // The loader reuses its memory, so keep a copy to upload from
+        source->image = (unsigned char*)malloc(file_load_data->memory_len);
+        if(!source->image){
+            FormattedError("Malloc failed", "Could not allocate %d bytes for %s", file_load_data->memory_len, path);
             exit(1);
         }
+        memcpy(source->image, file_load_data->memory, file_load_data->memory_len);
+        SDL_UnlockMutex(file_load_data->mutex);
+        source->mip_storage = NULL;
+        ParseDDS(path, file_load_data->memory_len, source);
+    } else {
         int x,y,comp;
-        unsigned char *data = stbi_load_from_memory((const stbi_uc*)file_load_data->memory, file_load_data->memory_len, &x, &y, &comp, STBI_default);
+        source->image = DecodeImage(path, file_load_data, &x, &y, &comp);
         SDL_UnlockMutex(file_load_data->mutex);
-
-        GLint internal_format = -1;
-        switch(comp){
-        case 1:
-            internal_format = GL_LUMINANCE;
-            break;
-        case 3:
-            internal_format = GL_RGB;
-            break;
-        case 4:
-            internal_format = GL_RGBA;
-            break;
+        source->compressed = false;
+        source->internal_format = GetImageFormat(comp);
+        source->format = source->internal_format;
+        ImageMips mips;
+        BuildImageMips(path, source->image, x, y, comp, thread_pool, &mips);
+        source->mip_storage = mips.storage;
+        source->num_levels = mips.num_levels;
+        for(int i=0; i<mips.num_levels; ++i){
+            source->levels[i] = mips.levels[i];
+            source->level_bytes[i] = mips.levels[i].width * mips.levels[i].height * comp;
         }
-        GLuint tmp_texture;
-        glGenTextures(1, &tmp_texture);
-        texture = tmp_texture;
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, x, y, 0, internal_format, GL_UNSIGNED_BYTE, data);
-        CHECK_GL_ERROR();
-
-        bool can_mip = true;
-        int remainder;
-        int x_mips = GetPow2(x, &remainder);
-        if(remainder){
-            can_mip = false; // Width is not power of 2
+    }
+    source->max_level = GetMaxSampledLevel(source->levels, source->num_levels);
+}
+
+void FreeTextureSource(TextureSource* source) {
+    if(source->compressed){
+        free(source->image);
+    } else {
+        stbi_image_free(source->image);
+    }
+    free(source->mip_storage);
+    source->image = NULL;
+    source->mip_storage = NULL;
+}
+
+// Into the GL_TEXTURE_2D that is bound
+static void UploadBoundTextureLevel(const TextureSource& source, int level) {
+    const MipLevel& mip = source.levels[level];
+    if(source.compressed){
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, source.internal_format, mip.width, mip.height,
+                               0, source.level_bytes[level], mip.data);
+    } else {
+        // Odd widths leave rows unaligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, level, source.internal_format, mip.width, mip.height, 0, 
+                     source.format, GL_UNSIGNED_BYTE, mip.data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    CHECK_GL_ERROR();
+}
+
+int CreateTextureFromSource(const TextureSource& source, int first_level) {
+    if(IsNullBackend()){
+        for(int i=first_level; i<source.num_levels; ++i){
+            graphics_stats.upload_bytes += source.level_bytes[i];
         }
-        int y_mips = GetPow2(y, &remainder);
-        if(remainder){
-            can_mip = false; // Height is not power of 2
+        return CreateNullObject();
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    for(int i=first_level; i<source.num_levels; ++i){
+        UploadBoundTextureLevel(source, i);
+    }
+    SetMipSampling(GL_TEXTURE_2D, first_level, max(first_level, source.max_level));
+    return texture;
+}
+
+void UploadTextureLevel(int texture, const TextureSource& source, int level) {
+    if(IsNullBackend()){
+        graphics_stats.upload_bytes += source.level_bytes[level];
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    UploadBoundTextureLevel(source, level);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void SetTextureBaseLevel(int texture, CommandTextureTarget target, int level) {
+    if(IsNullBackend()){
+        return;
+    }
+    GLenum gl_target = (target == kCommandTexture2DArray) ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    glBindTexture(gl_target, texture);
+    glTexParameteri(gl_target, GL_TEXTURE_BASE_LEVEL, level);
+    glBindTexture(gl_target, 0);
+}
+
+static int GetArrayLevelBytes(const TextureSource* sources, int num_layers, int level) {
+    return sources[0].level_bytes[level] * num_layers;
+}
+
+// Into the GL_TEXTURE_2D_ARRAY that is bound. The layers are packed into
+// one block so the level goes up in a single call.
+static void UploadBoundArrayLevel(const TextureSource* sources, int num_layers, int level) {
+    const TextureSource& first = sources[0];
+    const MipLevel& mip = first.levels[level];
+    int layer_bytes = first.level_bytes[level];
+    unsigned char* data = (unsigned char*)malloc(layer_bytes * num_layers);
+    if(!data){
+        FormattedError("Malloc failed", "Could not allocate %d bytes for a texture array level", 
+                       layer_bytes * num_layers);
+        exit(1);
+    }
+    for(int layer=0; layer<num_layers; ++layer){
+        memcpy(data + layer * layer_bytes, sources[layer].levels[level].data, layer_bytes);
+    }
+    if(first.compressed){
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internal_format, mip.width, 
+                               mip.height, num_layers, 0, layer_bytes * num_layers, data);
+    } else {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internal_format, mip.width, mip.height, 
+                     num_layers, 0, first.format, GL_UNSIGNED_BYTE, data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    free(data);
+    CHECK_GL_ERROR();
+}
+
+int CreateTextureArrayFromSources(const TextureSource* sources, int num_layers, 
+                                  int first_level) 
+{
+    const TextureSource& first = sources[0];
+    for(int layer=1; layer<num_layers; ++layer){
+        const TextureSource& source = sources[layer];
+        if(source.compressed != first.compressed || 
+           source.internal_format != first.internal_format ||
+           source.num_levels != first.num_levels || 
+           source.levels[0].width != first.levels[0].width ||
+           source.levels[0].height != first.levels[0].height)
+        {
+            return -1;
         }
-        int num_mips = 0;
-        if(can_mip){
-            num_mips = min(x_mips, y_mips); // TODO: make this max() and separate box filter axes
-            int dims[] = {x,y};
-            for(int i=0; i<num_mips; ++i){
-                BoxFilterHalve(data, comp, dims[0], dims[1]);
-                dims[0] /= 2;
-                dims[1] /= 2;
-                glTexImage2D(GL_TEXTURE_2D, i+1, internal_format, dims[0], dims[1], 0, internal_format, GL_UNSIGNED_BYTE, data);
-                CHECK_GL_ERROR();
-            }
+    }
+    if(IsNullBackend()){
+        for(int i=first_level; i<first.num_levels; ++i){
+            graphics_stats.upload_bytes += GetArrayLevelBytes(sources, num_layers, i);
         }
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max(0,num_mips-4)); // Don't quite allow mipmap down to 1 pixel
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, kMaxAnisotropy);
-        stbi_image_free(data);
-    } else {
-        FormattedError("SDL_LockMutex failed", "Could not lock file loader mutex: %s", SDL_GetError());
-        exit(1);
+        return CreateNullObject();
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    for(int i=first_level; i<first.num_levels; ++i){
+        UploadBoundArrayLevel(sources, num_layers, i);
+    }
+    SetMipSampling(GL_TEXTURE_2D_ARRAY, first_level, max(first_level, first.max_level));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture;
+}
+
+void UploadTextureArrayLevel(int texture, const TextureSource* sources, int num_layers, 
+                             int level) 
+{
+    if(IsNullBackend()){
+        graphics_stats.upload_bytes += GetArrayLevelBytes(sources, num_layers, level);
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    UploadBoundArrayLevel(sources, num_layers, level);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+int CreateSingleChannelTexture(int width, int height, const unsigned char* data) {
+    if(IsNullBackend()){
+        graphics_stats.upload_bytes += width * height;
+        return CreateNullObject();
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECK_GL_ERROR();
+    return texture;
+}
+
+int LoadImage(const char* path, FileLoadThreadData* file_load_data, ThreadPool* thread_pool){
+    TextureSource source;
+    ReadTextureSource(path, file_load_data, thread_pool, &source);
+    int texture = CreateTextureFromSource(source, 0);
+    FreeTextureSource(&source);
+    return texture;
+}
+
+int LoadImageArray(const char* const* paths, int num_paths, FileLoadThreadData* file_load_data, 
+                   ThreadPool* thread_pool)
+{
+    static const int kMaxLayers = 16;
+    SDL_assert(num_paths <= kMaxLayers);
+    TextureSource sources[kMaxLayers];
+    for(int layer=0; layer<num_paths; ++layer){
+        ReadTextureSource(paths[layer], file_load_data, thread_pool, &sources[layer]);
+    }
+    int texture = CreateTextureArrayFromSources(sources, num_paths, 0);
+    if(texture == -1){
+        SDL_Log("Can't put %s and the rest in one array, they differ in size or format\n", 
+                paths[0]);
+    }
+    for(int layer=0; layer<num_paths; ++layer){
+        FreeTextureSource(&sources[layer]);
     }
     return texture;
 }
@@ -3,25 +3,145 @@
 #define PLATFORM_SDL_GRAPHICS_HPP
 
 #include <SDL.h>
+#include "internal/command_list.h"
+#include "internal/mipmap.h"
 #include "glm/glm.hpp"
 
 class FileLoadThreadData;
+class ThreadPool;
+
+// Where the functions below send their work. The null backend creates no
+// window and touches no GPU: it hands out ids and counts what it is asked
+// to do in GraphicsStats, so frames can be run headless to measure the CPU
+// side. Everything outside this file and its helpers goes through here.
+enum GraphicsBackend {
+    kGraphicsBackendGL,
+    kGraphicsBackendNull
+};
 
 struct GraphicsContext {
+    GraphicsBackend backend;
     int screen_dims[2];
-    SDL_Window* window;
+    SDL_Window* window; // NULL for the null backend
     SDL_GLContext gl_context;
+    int default_vao; // For code that sets up its own attributes per draw
+};
+
+// Counted by the null backend since it was set up or last reset
+struct GraphicsStats {
+    int objects_created; // Buffers, textures, vertex arrays, shaders and programs
+    int upload_bytes; // Buffer and texture data
+    int state_changes; // Program, texture and vertex array binds
+    int draw_calls;
+    int instances;
+    int triangles;
 };
 
 void InitGraphicsContext(GraphicsContext *graphics_context);
+void InitNullGraphicsContext(GraphicsContext *graphics_context, int width, int height);
+const GraphicsStats& GetGraphicsStats();
+void ResetGraphicsStats();
 void InitGraphicsData(int *triangle_vbo, int *index_vbo);
-int LoadImage(const char* path, FileLoadThreadData* file_load_data);
-int CreateShader(int type, const char *src);
+// Sets the viewport to the whole window and clears color and depth
+void ClearFrame(const GraphicsContext* context, const glm::vec4& color);
+// Shows the finished frame, from the thread that owns the context
+void PresentFrame(GraphicsContext* context);
+bool SupportsCompressedTextures(); // DXT1 and DXT5
+// Anything stb_image reads, or a DXT .dds from tools/texture_compressor.
+// Mips for the former are built on thread_pool, which can be NULL.
+int LoadImage(const char* path, FileLoadThreadData* file_load_data, ThreadPool* thread_pool);
+
+// A decoded image and its mips kept in memory, so levels can be uploaded
+// a few at a time instead of all at load
+struct TextureSource {
+    int internal_format;
+    int format; // Same as internal_format if compressed
+    bool compressed;
+    int num_levels;
+    int max_level; // Coarsest level worth sampling
+    MipLevel levels[kMaxMipLevels];
+    int level_bytes[kMaxMipLevels];
+    unsigned char* image; // Level 0, or the whole file if compressed
+    unsigned char* mip_storage;
+};
+
+// Same formats as LoadImage
+void ReadTextureSource(const char* path, FileLoadThreadData* file_load_data, 
+                       ThreadPool* thread_pool, TextureSource* source);
+void FreeTextureSource(TextureSource* source);
+// Uploads first_level and coarser and samples only those
+int CreateTextureFromSource(const TextureSource& source, int first_level);
+// For adding finer levels to a texture from CreateTextureFromSource later.
+// Move the base level down once they are there.
+void UploadTextureLevel(int texture, const TextureSource& source, int level);
+void SetTextureBaseLevel(int texture, CommandTextureTarget target, int level);
+// The same for a GL_TEXTURE_2D_ARRAY with one layer per source. Returns -1
+// if the sources differ in size, format or number of levels.
+int CreateTextureArrayFromSources(const TextureSource* sources, int num_layers, 
+                                  int first_level);
+void UploadTextureArrayLevel(int texture, const TextureSource* sources, int num_layers, 
+                             int level);
+// One byte per texel, read as red, not mipmapped
+int CreateSingleChannelTexture(int width, int height, const unsigned char* data);
+// One GL_TEXTURE_2D_ARRAY layer per image, in order, from the same formats
+// as LoadImage. Images must all be the same size and format, otherwise
+// returns -1 so separate textures can be used instead.
+int LoadImageArray(const char* const* paths, int num_paths, FileLoadThreadData* file_load_data, 
+                   ThreadPool* thread_pool);
+enum ShaderStage {
+    kVertexShader,
+    kGeometryShader,
+    kFragmentShader
+};
+int CreateShader(ShaderStage stage, const char *src);
+void DeleteShader(int shader);
 int CreateProgram(const int shaders[], int num_shaders);
 
+// Uniforms the renderer sets per draw, located once when the program is created
+enum ShaderUniform {
+    kUniformInstanceBase, // "instance_base"
+    kUniformDualQuaternionSkinning, // "dual_quaternion_skinning"
+    kNumShaderUniforms
+};
+
+// Linked program with its active uniforms and attributes reflected into
+// a table, so draws never have to ask the driver for locations by name.
+// Lookups compare hashes first and then the names.
+struct ShaderProgram {
+    static const int kMaxReflected = 32;
+    static const int kMaxNameLen = 64;
+    int program;
+    int num_uniforms;
+    int uniform_hashes[kMaxReflected];
+    char uniform_names[kMaxReflected][kMaxNameLen];
+    int uniform_locations[kMaxReflected];
+    int num_attribs;
+    int attrib_hashes[kMaxReflected];
+    char attrib_names[kMaxReflected][kMaxNameLen];
+    int attrib_locations[kMaxReflected];
+    int uniforms[kNumShaderUniforms]; // -1 if not active in this program
+    int GetUniformLocation(const char* name) const; // -1 if not active
+    int GetAttribLocation(const char* name) const; // -1 if not active
+};
+
+void CreateShaderProgram(ShaderProgram* shader_program, int program);
+
+// Shared by every program that declares the PerFrame block. std140, so 
+// keep it to mat4/vec4 members and in the same order as the shaders.
+static const int kPerFrameUniformBinding = 0;
+struct PerFrameUniforms {
+    glm::mat4 proj_mat;
+    glm::mat4 view_mat;
+    glm::mat4 proj_view_mat;
+    glm::mat4 screen_ortho_mat; // Pixel coordinates, origin top left
+    glm::vec4 light_cluster_params; // From LightGrid::GetClusterParams
+};
+
 enum VBO_Type {
     kArrayVBO,
-    kElementVBO
+    kElementVBO,
+    kTextureVBO,
+    kUniformVBO
 };
 enum VBO_Hint {
     kStaticVBO,
@@ -30,6 +150,78 @@ enum VBO_Hint {
 };
 
 int CreateVBO(VBO_Type type, VBO_Hint hint, void* data, int num_data_elements);
+// Replaces the whole contents, resizing to num_bytes
+void UpdateVBO(VBO_Type type, VBO_Hint hint, int vbo, const void* data, int num_bytes);
+void BindUniformBuffer(int binding, int vbo);
+
+enum VBO_Setup {
+    kSimple_3V, // 3 vert
+    kSimple_4V, // 4 vert
+    kInterleave_2V2T, // 2 vert, 2 tex coord
+    kInterleave_3V4C, // 3 vert, 4 color
+    kInterleave_3V2T3N, // 3 vert, 2 tex coord, 3 normal
+    kInterleave_3V2T3N1L, // 3 vert, 2 tex coord, 3 normal, 1 texture array layer
+    kInterleave_3V2T3N4I4W // 3 vert, 2 tex coord, 3 normal, 4 bone index, 4 bone weight
+};
+
+// Captures the attribute layout and both buffers, so drawing only needs 
+// glBindVertexArray. Buffer contents can still be replaced afterwards.
+// Leaves the previously bound vertex array bound.
+int CreateVertexArray(VBO_Setup layout, int vert_vbo, int index_vbo);
+
+// Buffer readable from shaders with texelFetch, one vec4 (RGBA32F) per texel
+struct TextureBuffer {
+    int vbo;
+    int texture;
+    int size_bytes;
+};
+
+void CreateTextureBuffer(TextureBuffer* texture_buffer, int size_bytes);
+// Writing at offset 0 orphans the old contents, so write front to back
+void UpdateTextureBuffer(const TextureBuffer& texture_buffer, int offset, const void* data, 
+                         int num_bytes);
+
+// Ring of per-frame segments for vertex data that is rewritten every 
+// frame. Each frame writes into its own segment, fenced when the frame 
+// ends, so the driver never has to reallocate or synchronize. Persistently
+// mapped if ARB_buffer_storage is there, else mapped unsynchronized per write.
+struct StreamBuffer {
+    static const int kNumSegments = 3; // Frames in flight
+    int vbo;
+    int segment_size;
+    int segment; // Written this frame
+    int head; // Next free byte in segment
+    unsigned char* persistent_map; // NULL if mapping per write
+    void* fences[kNumSegments]; // GLsync
+};
+
+void CreateStreamBuffer(StreamBuffer* stream_buffer, int segment_size);
+// Waits until the GPU is done with the segment this frame will reuse
+void StreamBufferBeginFrame(StreamBuffer* stream_buffer);
+void StreamBufferEndFrame(StreamBuffer* stream_buffer);
+// Binds the buffer to GL_ARRAY_BUFFER and returns memory to write num_bytes
+// to, with offset set to where it starts in the buffer. Returns NULL if 
+// this frame's segment is full. Call StreamBufferUnmap before drawing.
+void* StreamBufferMap(StreamBuffer* stream_buffer, int num_bytes, int* offset);
+void StreamBufferUnmap(StreamBuffer* stream_buffer);
+
+// The immediate versions of the CommandList calls, for state set around
+// lists or around the unbatched draws below. 0 unbinds.
+void UseProgram(int program);
+void BindTexture(int unit, CommandTextureTarget target, int texture);
+void BindVertexArray(int vao);
+void ExecuteCommandList(const CommandList& command_list);
+
+enum DrawPrimitive {
+    kDrawTriangles,
+    kDrawLines
+};
+
+// Draws count verts, or count indices from index_vbo if it isn't -1, with
+// the layout set up on the bound vertex array starting at vbo_offset. For
+// debug drawing, where the data moves every frame.
+void DrawUnbatched(int program, VBO_Setup layout, int vbo, int vbo_offset, int index_vbo,
+                   DrawPrimitive primitive, int count);
 
 void CheckGLError(const char *file, int line);
 #ifdef _DEBUG
@@ -0,0 +1,142 @@
+#include "platform_sdl/program_cache.h"
+#include "internal/common.h"
+#include "GL/glew.h"
+#include "SDL.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const uint32_t kProgramCacheMagic = 0x50524743; // "PRGC"
+static const uint32_t kProgramCacheVersion = 1;
+
+// Precedes the binary in each file. The key is checked again on load in
+// case two entries ever hash to the same file name.
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t binary_format;
+    uint32_t binary_len;
+};
+
+// FNV-1a, wider than djb2 since a collision would load the wrong program
+static uint64_t HashBytes(uint64_t hash, const void* data, int len) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(int i=0; i<len; ++i){
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t HashString(uint64_t hash, const char* str) {
+    // Include the terminator so "ab","c" and "a","bc" differ
+    return HashBytes(hash, str, str ? (int)strlen(str) + 1 : 0);
+}
+
+void ProgramCache::Init(const char* dir) {
+    enabled = false;
+    if(!dir || !GLEW_ARB_get_program_binary || strlen(dir) + 32 > kMaxPathLen){
+        return;
+    }
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    if(num_formats == 0){
+        return;
+    }
+    FormatString(this->dir, kMaxPathLen, "%s", dir);
+    driver_hash = 14695981039346656037ULL;
+    driver_hash = HashString(driver_hash, (const char*)glGetString(GL_VENDOR));
+    driver_hash = HashString(driver_hash, (const char*)glGetString(GL_RENDERER));
+    driver_hash = HashString(driver_hash, (const char*)glGetString(GL_VERSION));
+    enabled = true;
+}
+
+uint64_t ProgramCache::GetKey(const char* const* sources, int num_sources) {
+    uint64_t key = driver_hash;
+    for(int i=0; i<num_sources; ++i){
+        key = HashString(key, sources[i]);
+    }
+    return key;
+}
+
+void ProgramCache::GetPath(uint64_t key, char* path) {
+    FormatString(path, kMaxPathLen, "%sprogram_%08x%08x.bin", dir, 
+                 (unsigned)(key >> 32), (unsigned)key);
+}
+
+int ProgramCache::Load(const char* const* sources, int num_sources) {
+    if(!enabled){
+        return -1;
+    }
+    uint64_t key = GetKey(sources, num_sources);
+    char path[kMaxPathLen];
+    GetPath(key, path);
+    SDL_RWops* file = SDL_RWFromFile(path, "rb");
+    if(!file){
+        return -1;
+    }
+    ProgramCacheHeader header;
+    void* binary = NULL;
+    bool ok = SDL_RWread(file, &header, sizeof(header), 1) == 1 &&
+              header.magic == kProgramCacheMagic && 
+              header.version == kProgramCacheVersion &&
+              header.key == key && header.binary_len > 0;
+    if(ok){
+        binary = malloc(header.binary_len);
+        ok = binary && SDL_RWread(file, binary, header.binary_len, 1) == 1;
+    }
+    SDL_RWclose(file);
+    int program = -1;
+    if(ok){
+        program = glCreateProgram();
+        glProgramBinary(program, header.binary_format, binary, header.binary_len);
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if(status == GL_FALSE){
+            // Driver was updated in a way the version string doesn't show.
+            // Clear any error the rejected format raised, too.
+            while(glGetError() != GL_NO_ERROR){}
+            glDeleteProgram(program);
+            program = -1;
+        }
+    }
+    free(binary);
+    return program;
+}
+
+void ProgramCache::Save(int program, const char* const* sources, int num_sources) {
+    if(!enabled || program == -1){
+        return;
+    }
+    GLint binary_len = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_len);
+    if(binary_len <= 0){
+        return;
+    }
+    void* binary = malloc(binary_len);
+    if(!binary){
+        return;
+    }
+    ProgramCacheHeader header;
+    header.magic = kProgramCacheMagic;
+    header.version = kProgramCacheVersion;
+    header.key = GetKey(sources, num_sources);
+    GLenum binary_format;
+    glGetProgramBinary(program, binary_len, NULL, &binary_format, binary);
+    header.binary_format = binary_format;
+    header.binary_len = binary_len;
+    char path[kMaxPathLen];
+    GetPath(header.key, path);
+    // Not worth stopping the game over, it just compiles again next time
+    SDL_RWops* file = SDL_RWFromFile(path, "wb");
+    if(file){
+        bool ok = SDL_RWwrite(file, &header, sizeof(header), 1) == 1 &&
+                  SDL_RWwrite(file, binary, binary_len, 1) == 1;
+        SDL_RWclose(file);
+        if(!ok){
+            remove(path);
+        }
+    }
+    free(binary);
+}
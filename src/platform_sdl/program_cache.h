@@ -0,0 +1,31 @@
+#pragma once
+#ifndef PLATFORM_SDL_PROGRAM_CACHE_H
+#define PLATFORM_SDL_PROGRAM_CACHE_H
+
+#include <stdint.h>
+
+// Linked program binaries saved to disk, so later runs on the same driver
+// can skip compiling. Entries are keyed by a hash of the shader sources
+// and the GL vendor, renderer and version, and anything the driver turns
+// down is just reported as a miss.
+class ProgramCache {
+public:
+    static const int kMaxPathLen = 4096;
+    // dir must end in a path separator, as from SDL_GetPrefPath. The cache 
+    // does nothing if dir is NULL or the driver can't return binaries.
+    void Init(const char* dir);
+    // Returns a linked program, or -1 to compile from source
+    int Load(const char* const* sources, int num_sources);
+    // Call with a program linked from sources, after a miss
+    void Save(int program, const char* const* sources, int num_sources);
+
+private:
+    bool enabled;
+    char dir[kMaxPathLen];
+    uint64_t driver_hash;
+
+    uint64_t GetKey(const char* const* sources, int num_sources);
+    void GetPath(uint64_t key, char* path);
+};
+
+#endif
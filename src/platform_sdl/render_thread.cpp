@@ -0,0 +1,91 @@
+#include "platform_sdl/render_thread.h"
+#include "platform_sdl/error.h"
+#include "platform_sdl/graphics.h"
+#include <cstdlib>
+
+void RenderThread::Init(GraphicsContext* context, RenderFunc func, void* data, bool threaded) {
+    this->context = context;
+    this->func = func;
+    this->data = data;
+    this->threaded = threaded;
+    frame_in_flight = false;
+    wants_to_quit = false;
+    thread = NULL;
+    if(!threaded){
+        return;
+    }
+    frame_ready = SDL_CreateSemaphore(0);
+    frame_done = SDL_CreateSemaphore(0);
+    if(!frame_ready || !frame_done){
+        FormattedError("SDL_CreateSemaphore failed", "Could not create render thread semaphore: %s", SDL_GetError());
+        exit(1);
+    }
+    // A context can only be current on one thread at a time
+    if(context->backend == kGraphicsBackendGL){
+        SDL_GL_MakeCurrent(context->window, NULL);
+    }
+    thread = SDL_CreateThread(RenderMain, "RenderThread", this);
+    if(!thread){
+        FormattedError("SDL_CreateThread failed", "Could not create render thread: %s", SDL_GetError());
+        exit(1);
+    }
+}
+
+void RenderThread::Dispose() {
+    if(!threaded){
+        return;
+    }
+    Wait();
+    wants_to_quit = true;
+    SDL_SemPost(frame_ready);
+    SDL_WaitThread(thread, NULL);
+    SDL_DestroySemaphore(frame_ready);
+    SDL_DestroySemaphore(frame_done);
+    if(context->backend == kGraphicsBackendGL){
+        SDL_GL_MakeCurrent(context->window, context->gl_context);
+    }
+}
+
+void RenderThread::Kick() {
+    if(!threaded){
+        DrawFrame();
+        return;
+    }
+    SDL_assert(!frame_in_flight);
+    frame_in_flight = true;
+    SDL_SemPost(frame_ready);
+}
+
+void RenderThread::Wait() {
+    if(frame_in_flight){
+        SDL_SemWait(frame_done);
+        frame_in_flight = false;
+    }
+}
+
+void RenderThread::DrawFrame() {
+    func(data);
+    PresentFrame(context);
+}
+
+int RenderThread::RenderMain(void* data) {
+    RenderThread* render_thread = (RenderThread*)data;
+    GraphicsContext* context = render_thread->context;
+    bool use_gl = (context->backend == kGraphicsBackendGL);
+    if(use_gl && SDL_GL_MakeCurrent(context->window, context->gl_context) != 0){
+        FormattedError("SDL_GL_MakeCurrent failed", "Could not use GL context on render thread: %s", SDL_GetError());
+        exit(1);
+    }
+    while(true){
+        SDL_SemWait(render_thread->frame_ready);
+        if(render_thread->wants_to_quit){
+            break;
+        }
+        render_thread->DrawFrame();
+        SDL_SemPost(render_thread->frame_done);
+    }
+    if(use_gl){
+        SDL_GL_MakeCurrent(context->window, NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#ifndef PLATFORM_SDL_RENDER_THREAD_H
+#define PLATFORM_SDL_RENDER_THREAD_H
+
+#include <SDL.h>
+
+struct GraphicsContext;
+
+typedef void (*RenderFunc)(void* data);
+
+// Owns the GL context while running, and draws one frame and swaps per
+// Kick. The caller must not touch GL between Init and Dispose, and must
+// Wait before changing anything the render func reads. Unthreaded, Kick
+// just draws and swaps on the calling thread.
+class RenderThread {
+public:
+    void Init(GraphicsContext* context, RenderFunc func, void* data, bool threaded);
+    void Dispose(); // Gives the GL context back to the calling thread
+    void Kick();
+    void Wait(); // Until the kicked frame is swapped
+
+private:
+    GraphicsContext* context;
+    RenderFunc func;
+    void* data;
+    bool threaded;
+    bool frame_in_flight;
+    bool wants_to_quit; // Only read after frame_ready is posted
+    SDL_Thread* thread;
+    SDL_sem* frame_ready;
+    SDL_sem* frame_done;
+
+    void DrawFrame();
+    static int RenderMain(void* data);
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "platform_sdl/texture_streamer.h"
+#include "internal/common.h"
+#include <cmath>
+
+void TextureStreamer::Init(int upload_budget_bytes, int resident_budget_bytes) {
+    this->upload_budget_bytes = upload_budget_bytes;
+    this->resident_budget_bytes = resident_budget_bytes;
+    resident_bytes = 0;
+    num_pending = 0;
+    num_textures = 0;
+    num_sources = 0;
+    last_found = 0;
+    next_update = 0;
+}
+
+void TextureStreamer::Dispose() {
+    for(int i=0; i<num_textures; ++i){
+        FreeSources(&textures[i]);
+    }
+    num_textures = 0;
+    num_sources = 0;
+}
+
+int TextureStreamer::GetLevelBytes(const StreamedTexture& streamed, int level) const {
+    return streamed.sources[0].level_bytes[level] * streamed.num_layers;
+}
+
+void TextureStreamer::FreeSources(StreamedTexture* streamed) {
+    for(int i=0; i<streamed->num_layers; ++i){
+        if(streamed->sources[i].image){
+            FreeTextureSource(&streamed->sources[i]);
+        }
+    }
+}
+
+int TextureStreamer::Add(TextureSource* source) {
+    return AddLayers(source, 1, false);
+}
+
+int TextureStreamer::AddArray(TextureSource* layer_sources, int num_layers) {
+    return AddLayers(layer_sources, num_layers, true);
+}
+
+int TextureStreamer::AddLayers(TextureSource* layer_sources, int num_layers, bool is_array) {
+    if(num_textures == kMaxTextures || num_sources + num_layers > kMaxSources){
+        int texture = is_array ? 
+            CreateTextureArrayFromSources(layer_sources, num_layers, 0) :
+            CreateTextureFromSource(*layer_sources, 0);
+        if(texture != -1){
+            for(int i=0; i<num_layers; ++i){
+                FreeTextureSource(&layer_sources[i]);
+            }
+        }
+        return texture;
+    }
+    const TextureSource& first = layer_sources[0];
+    int first_level = first.num_levels - 1;
+    while(first_level > 0 && 
+          max(first.levels[first_level-1].width, 
+              first.levels[first_level-1].height) <= kInitialLevelSize)
+    {
+        --first_level;
+    }
+    int texture = is_array ? 
+        CreateTextureArrayFromSources(layer_sources, num_layers, first_level) :
+        CreateTextureFromSource(first, first_level);
+    if(texture == -1){
+        return -1;
+    }
+    StreamedTexture& streamed = textures[num_textures++];
+    streamed.texture = texture;
+    streamed.is_array = is_array;
+    streamed.resident_level = first_level;
+    streamed.wanted_level = first_level;
+    streamed.sources = &sources[num_sources];
+    streamed.num_layers = num_layers;
+    for(int i=0; i<num_layers; ++i){
+        sources[num_sources++] = layer_sources[i];
+    }
+    for(int i=first_level; i<first.num_levels; ++i){
+        resident_bytes += GetLevelBytes(streamed, i);
+    }
+    if(first_level == 0){
+        FreeSources(&streamed);
+    }
+    return streamed.texture;
+}
+
+TextureStreamer::StreamedTexture* TextureStreamer::Find(int texture) {
+    if(last_found < num_textures && textures[last_found].texture == texture){
+        return &textures[last_found];
+    }
+    for(int i=0; i<num_textures; ++i){
+        if(textures[i].texture == texture){
+            last_found = i;
+            return &textures[i];
+        }
+    }
+    return NULL;
+}
+
+void TextureStreamer::RequestSize(int texture, float pixels) {
+    StreamedTexture* streamed = Find(texture);
+    if(!streamed || streamed->wanted_level == 0){
+        return;
+    }
+    const TextureSource& source = streamed->sources[0];
+    int level = streamed->wanted_level;
+    while(level > 0 && max(source.levels[level].width, source.levels[level].height) < pixels){
+        --level;
+    }
+    streamed->wanted_level = level;
+}
+
+void TextureStreamer::Update() {
+    int budget = upload_budget_bytes;
+    bool uploaded_any = false;
+    bool progress = true;
+    // One level per texture per pass, so coarse levels everywhere go up 
+    // before fine levels anywhere
+    while(progress){
+        progress = false;
+        for(int i=0; i<num_textures; ++i){
+            StreamedTexture& streamed = textures[(next_update + i) % num_textures];
+            if(streamed.resident_level <= streamed.wanted_level){
+                continue;
+            }
+            int level = streamed.resident_level - 1;
+            int level_bytes = GetLevelBytes(streamed, level);
+            if((level_bytes > budget && uploaded_any) ||
+               resident_bytes + level_bytes > resident_budget_bytes)
+            {
+                continue;
+            }
+            if(streamed.is_array){
+                UploadTextureArrayLevel(streamed.texture, streamed.sources, 
+                                        streamed.num_layers, level);
+                SetTextureBaseLevel(streamed.texture, kCommandTexture2DArray, level);
+            } else {
+                UploadTextureLevel(streamed.texture, streamed.sources[0], level);
+                SetTextureBaseLevel(streamed.texture, kCommandTexture2D, level);
+            }
+            streamed.resident_level = level;
+            resident_bytes += level_bytes;
+            budget -= level_bytes;
+            uploaded_any = true;
+            progress = true;
+            if(level == 0){
+                FreeSources(&streamed);
+            }
+        }
+    }
+    num_pending = 0;
+    for(int i=0; i<num_textures; ++i){
+        if(textures[i].resident_level > textures[i].wanted_level){
+            ++num_pending;
+        }
+    }
+    if(num_textures){
+        next_update = (next_update + 1) % num_textures;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef PLATFORM_SDL_TEXTURE_STREAMER_H
+#define PLATFORM_SDL_TEXTURE_STREAMER_H
+
+#include "platform_sdl/graphics.h"
+
+// Textures that start out with only their small mips resident and get
+// finer levels uploaded a few per frame, as far as they are asked for by
+// how large they appear on screen. Everything here uploads, so call it
+// from whichever thread owns the context.
+class TextureStreamer {
+public:
+    static const int kMaxTextures = 64;
+    static const int kMaxSources = kMaxTextures * 2; // Array layers count one each
+    static const int kInitialLevelSize = 64; // Largest level uploaded by Add
+
+    void Init(int upload_budget_bytes, int resident_budget_bytes);
+    void Dispose();
+    // Takes ownership of source and returns a texture usable right away. 
+    // Falls back to uploading every level if there is no room left.
+    int Add(TextureSource* source);
+    // The same for a GL_TEXTURE_2D_ARRAY with one layer per source. Returns
+    // -1 and leaves the sources with the caller if they can't share one.
+    int AddArray(TextureSource* sources, int num_layers);
+    // Asks for enough detail to cover pixels texels across. Textures that
+    // were not added here are ignored, as are requests for less detail.
+    void RequestSize(int texture, float pixels);
+    // Uploads requested levels, coarsest first, until this frame's budget 
+    // is used up. At least one level goes up per frame if any is wanted.
+    void Update();
+
+    int resident_bytes;
+    int num_pending; // Textures with requested levels not resident yet
+
+private:
+    struct StreamedTexture {
+        int texture;
+        bool is_array;
+        int resident_level; // Finest level uploaded
+        int wanted_level;
+        TextureSource* sources; // One per layer, freed once level 0 is resident
+        int num_layers;
+    };
+    StreamedTexture textures[kMaxTextures];
+    int num_textures;
+    TextureSource sources[kMaxSources];
+    int num_sources;
+    int last_found; // Draws come sorted by texture, so check this first
+    int next_update; // Round robin start, so no texture starves the rest
+    int upload_budget_bytes;
+    int resident_budget_bytes;
+
+    StreamedTexture* Find(int texture);
+    int GetLevelBytes(const StreamedTexture& streamed, int level) const;
+    void FreeSources(StreamedTexture* streamed);
+    int AddLayers(TextureSource* layer_sources, int num_layers, bool is_array);
+};
+
+#endif
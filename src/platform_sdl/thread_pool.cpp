@@ -0,0 +1,105 @@
+#include "platform_sdl/thread_pool.h"
+#include "platform_sdl/error.h"
+#include "internal/common.h"
+#include <cstdlib>
+
+void InitJobCounter(JobCounter* counter) {
+    SDL_AtomicSet(&counter->count, 0);
+}
+
+void ThreadPool::Init(int num_worker_threads) {
+    num_threads = max(0, min(kMaxThreads, num_worker_threads));
+    start = 0;
+    end = 0;
+    wants_to_quit = false;
+    mutex = SDL_CreateMutex();
+    job_added = SDL_CreateCond();
+    if(!mutex || !job_added){
+        FormattedError("SDL_CreateMutex failed", "Could not create thread pool mutex: %s", SDL_GetError());
+        exit(1);
+    }
+    for(int i=0; i<num_threads; ++i){
+        char name[32];
+        FormatString(name, 32, "Worker%d", i);
+        threads[i] = SDL_CreateThread(WorkerMain, name, this);
+        if(!threads[i]){
+            FormattedError("SDL_CreateThread failed", "Could not create worker thread: %s", SDL_GetError());
+            exit(1);
+        }
+    }
+}
+
+void ThreadPool::Dispose() {
+    SDL_LockMutex(mutex);
+    wants_to_quit = true;
+    SDL_CondBroadcast(job_added);
+    SDL_UnlockMutex(mutex);
+    for(int i=0; i<num_threads; ++i){
+        SDL_WaitThread(threads[i], NULL);
+    }
+    SDL_DestroyCond(job_added);
+    SDL_DestroyMutex(mutex);
+}
+
+void ThreadPool::AddJob(JobFunc func, void* data, JobCounter* counter) {
+    SDL_AtomicIncRef(&counter->count);
+    Job job = {func, data, counter};
+    SDL_LockMutex(mutex);
+    int new_end = (end+1)%kMaxJobs;
+    if(new_end == start){
+        // Queue is full, so the workers are busy anyway
+        SDL_UnlockMutex(mutex);
+        RunJob(job);
+        return;
+    }
+    jobs[end] = job;
+    end = new_end;
+    SDL_CondSignal(job_added);
+    SDL_UnlockMutex(mutex);
+}
+
+bool ThreadPool::PopJob(Job* job) {
+    if(start == end){
+        return false;
+    }
+    *job = jobs[start];
+    start = (start+1)%kMaxJobs;
+    return true;
+}
+
+void ThreadPool::RunJob(const Job& job) {
+    job.func(job.data);
+    SDL_AtomicDecRef(&job.counter->count);
+}
+
+void ThreadPool::Wait(JobCounter* counter) {
+    while(SDL_AtomicGet(&counter->count) > 0){
+        // Help out instead of blocking, jobs may belong to other groups
+        Job job;
+        SDL_LockMutex(mutex);
+        bool got_job = PopJob(&job);
+        SDL_UnlockMutex(mutex);
+        if(got_job){
+            RunJob(job);
+        } else {
+            SDL_Delay(0);
+        }
+    }
+}
+
+int ThreadPool::WorkerMain(void* data) {
+    ThreadPool* pool = (ThreadPool*)data;
+    SDL_LockMutex(pool->mutex);
+    while(!pool->wants_to_quit){
+        Job job;
+        if(pool->PopJob(&job)){
+            SDL_UnlockMutex(pool->mutex);
+            RunJob(job);
+            SDL_LockMutex(pool->mutex);
+        } else {
+            SDL_CondWait(pool->job_added, pool->mutex);
+        }
+    }
+    SDL_UnlockMutex(pool->mutex);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#ifndef PLATFORM_SDL_THREAD_POOL_H
+#define PLATFORM_SDL_THREAD_POOL_H
+
+#include <SDL.h>
+
+typedef void (*JobFunc)(void* data);
+
+// Number of unfinished jobs in a group, to wait on
+struct JobCounter {
+    SDL_atomic_t count;
+};
+
+struct Job {
+    JobFunc func;
+    void* data;
+    JobCounter* counter;
+};
+
+// Fixed set of worker threads pulling from one job queue. Jobs must not
+// touch GL. Waiting runs queued jobs on the calling thread, so a pool 
+// with zero workers still works, just serially.
+class ThreadPool {
+public:
+    static const int kMaxThreads = 8;
+    static const int kMaxJobs = 256;
+    int num_threads;
+
+    void Init(int num_worker_threads);
+    void Dispose();
+    void AddJob(JobFunc func, void* data, JobCounter* counter); // Runs it now if the queue is full
+    void Wait(JobCounter* counter);
+
+private:
+    SDL_Thread* threads[kMaxThreads];
+    SDL_mutex* mutex;
+    SDL_cond* job_added;
+    Job jobs[kMaxJobs];
+    int start, end;
+    bool wants_to_quit;
+
+    bool PopJob(Job* job); // Call with mutex locked
+    static void RunJob(const Job& job);
+    static int WorkerMain(void* data);
+};
+
+void InitJobCounter(JobCounter* counter);
+
+#endif
@@ -0,0 +1,160 @@
+// Offline texture compressor. Writes each input image next to itself as
+// a .dds with a full mip chain in DXT1, or DXT5 if it has any transparency,
+// so the game can upload it without decoding or building mips.
+//
+// Usage: texture_compressor [-hq] image.tga [image.tga ...]
+
+#include "internal/dds.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+#define STB_DXT_IMPLEMENTATION
+#include "stb_dxt.h"
+
+static const int kMaxPathLen = 4096;
+
+static bool HasTransparency(const unsigned char* rgba, int num_pixels) {
+    for(int i=0; i<num_pixels; ++i){
+        if(rgba[i*4+3] != 255){
+            return true;
+        }
+    }
+    return false;
+}
+
+// Compresses one level, repeating the edge pixels to fill partial blocks
+static void CompressLevel(const unsigned char* rgba, int width, int height,
+                          bool alpha, int mode, unsigned char* dest)
+{
+    int block_bytes = alpha ? 16 : 8;
+    for(int block_y=0; block_y<height; block_y+=4){
+        for(int block_x=0; block_x<width; block_x+=4){
+            unsigned char block[4*4*4];
+            for(int y=0; y<4; ++y){
+                int src_y = block_y+y < height ? block_y+y : height-1;
+                for(int x=0; x<4; ++x){
+                    int src_x = block_x+x < width ? block_x+x : width-1;
+                    memcpy(&block[(y*4+x)*4], &rgba[(src_y*width+src_x)*4], 4);
+                }
+            }
+            stb_compress_dxt_block(dest, block, alpha ? 1 : 0, mode);
+            dest += block_bytes;
+        }
+    }
+}
+
+static bool CompressImage(const char* path, int mode) {
+    int width, height, comp;
+    unsigned char* rgba = stbi_load(path, &width, &height, &comp, 4);
+    if(!rgba){
+        fprintf(stderr, "Could not load %s: %s\n", path, stbi_failure_reason());
+        return false;
+    }
+    bool alpha = HasTransparency(rgba, width * height);
+    int block_bytes = alpha ? 16 : 8;
+
+    int num_levels = 1;
+    int total_bytes = GetDXTLevelSize(width, height, block_bytes);
+    for(int w=width, h=height; w>1 || h>1; ++num_levels){
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+        total_bytes += GetDXTLevelSize(w, h, block_bytes);
+    }
+    unsigned char* compressed = (unsigned char*)malloc(total_bytes);
+    unsigned char* level_rgba = (unsigned char*)malloc(width * height * 4);
+    unsigned char* next_rgba = (unsigned char*)malloc(width * height * 4);
+    if(!compressed || !level_rgba || !next_rgba){
+        fprintf(stderr, "Could not allocate memory for %s\n", path);
+        exit(1);
+    }
+    memcpy(level_rgba, rgba, width * height * 4);
+
+    unsigned char* dest = compressed;
+    int w = width, h = height;
+    for(int level=0; level<num_levels; ++level){
+        CompressLevel(level_rgba, w, h, alpha, mode, dest);
+        dest += GetDXTLevelSize(w, h, block_bytes);
+        if(level+1 < num_levels){
+            int next_w = w > 1 ? w / 2 : 1;
+            int next_h = h > 1 ? h / 2 : 1;
+            // Filter in linear space so dark and bright texels average evenly
+            stbir_resize_uint8_srgb(level_rgba, w, h, 0, next_rgba, next_w, next_h, 0,
+                                    4, 3, 0);
+            unsigned char* temp = level_rgba;
+            level_rgba = next_rgba;
+            next_rgba = temp;
+            w = next_w;
+            h = next_h;
+        }
+    }
+
+    char out_path[kMaxPathLen];
+    const char* ext = strrchr(path, '.');
+    int stem_len = ext ? (int)(ext - path) : (int)strlen(path);
+    if(stem_len + 5 > kMaxPathLen){
+        fprintf(stderr, "Path too long: %s\n", path);
+        exit(1);
+    }
+    memcpy(out_path, path, stem_len);
+    strcpy(out_path + stem_len, ".dds");
+
+    DDSHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size = sizeof(DDSHeader);
+    header.flags = kDDSFlagCaps | kDDSFlagHeight | kDDSFlagWidth |
+                   kDDSFlagPixelFormat | kDDSFlagMipMapCount | kDDSFlagLinearSize;
+    header.height = height;
+    header.width = width;
+    header.pitch_or_linear_size = GetDXTLevelSize(width, height, block_bytes);
+    header.mip_map_count = num_levels;
+    header.pixel_format.size = sizeof(DDSPixelFormat);
+    header.pixel_format.flags = kDDSPixelFormatFourCC;
+    header.pixel_format.four_cc = alpha ? kDDSFourCCDXT5 : kDDSFourCCDXT1;
+    header.caps = kDDSCapsTexture | kDDSCapsMipMap | kDDSCapsComplex;
+
+    bool ok = false;
+    FILE* file = fopen(out_path, "wb");
+    if(file){
+        ok = fwrite(&kDDSMagic, sizeof(kDDSMagic), 1, file) == 1 &&
+             fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(compressed, total_bytes, 1, file) == 1;
+        ok = (fclose(file) == 0) && ok;
+    }
+    if(ok){
+        printf("%s: %dx%d, %d levels, %s, %d KB (was %d KB)\n", out_path, width, height,
+               num_levels, alpha ? "DXT5" : "DXT1",
+               (int)(sizeof(kDDSMagic) + sizeof(header) + total_bytes) / 1024,
+               width * height * (comp == 4 ? 4 : 3) / 1024);
+    } else {
+        fprintf(stderr, "Could not write %s\n", out_path);
+    }
+    stbi_image_free(rgba);
+    free(compressed);
+    free(level_rgba);
+    free(next_rgba);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int mode = STB_DXT_NORMAL;
+    int num_failed = 0, num_images = 0;
+    for(int i=1; i<argc; ++i){
+        if(strcmp(argv[i], "-hq") == 0){
+            mode = STB_DXT_HIGHQUAL;
+            continue;
+        }
+        ++num_images;
+        if(!CompressImage(argv[i], mode)){
+            ++num_failed;
+        }
+    }
+    if(num_images == 0){
+        fprintf(stderr, "Usage: %s [-hq] image.tga [image.tga ...]\n", argv[0]);
+        return 1;
+    }
+    return num_failed ? 1 : 0;
+}